@@ -1,7 +1,9 @@
 #ifndef ETYMON_ODBC_H
 #define ETYMON_ODBC_H
 
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <sql.h>
 #include <sqlext.h>
 
@@ -11,6 +13,19 @@ namespace etymon {
 
 const char* odbc_str_error(SQLRETURN rc);
 
+// Counts of database calls made by the calling thread, used to measure
+// the database work done by a part of a program.  Round trips are
+// statements executed and transactions ended; bytes sent are SQL text,
+// and bytes received are column data fetched.
+class odbc_counters {
+public:
+    uint64_t round_trips = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+};
+
+const odbc_counters& odbc_thread_counters();
+
 class odbc_env {
 public:
     SQLHENV env;
@@ -19,6 +34,7 @@ public:
 };
 
 class odbc_stmt;
+class odbc_rowset;
 
 class odbc_conn {
 public:
@@ -28,8 +44,10 @@ public:
     ~odbc_conn();
     void get_dbms_name(string* dbms_name);
     void exec(const string& sql);
+    void exec(const string& sql, int64_t* rows);
     void exec_direct(odbc_stmt* stmt, const string& sql);
     bool fetch(odbc_stmt* stmt);
+    bool fetch(odbc_stmt* stmt, odbc_rowset* rowset);
     void get_data(odbc_stmt* stmt, uint16_t column, string* data);
 private:
     void exec_direct_stmt(odbc_stmt* stmt, const string& sql);
@@ -42,6 +60,25 @@ public:
     ~odbc_stmt();
 };
 
+// Buffers for fetching a block of rows with each call to fetch(),
+// instead of one row at a time.  Every column is bound as a string of
+// at most width - 1 characters; longer values are truncated.
+class odbc_rowset {
+public:
+    odbc_rowset(uint16_t columns, size_t rows, size_t width);
+    size_t size() const;
+    void get_data(size_t row, uint16_t column, string* data) const;
+private:
+    friend class odbc_conn;
+    uint16_t columns;
+    size_t rows;
+    size_t width;
+    vector<char> buffer;
+    vector<SQLLEN> indicator;
+    SQLULEN fetched = 0;
+    SQLHSTMT bound = SQL_NULL_HSTMT;
+};
+
 class odbc_tx {
 public:
     odbc_conn* conn;
@@ -0,0 +1,84 @@
+#ifndef ETYMON_TRACE_H
+#define ETYMON_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+namespace etymon {
+
+// Records spans and counters as Chrome trace events, which can be
+// viewed in Perfetto or chrome://tracing.  Each thread appends events
+// to its own buffer without locking.  When tracing is not started,
+// creating a span only reads a flag.
+
+extern atomic<bool> trace_on;
+
+inline bool trace_enabled()
+{
+    return trace_on.load(memory_order_relaxed);
+}
+
+// Starts recording, discarding any events already recorded.  This
+// should be called before the threads to be traced are started.
+void trace_start();
+// Stops recording and writes the events to a file in the Chrome trace
+// event format.  Threads that are still running should not record
+// events after this has been called.
+void trace_write(const string& filename);
+
+// Maximum length of the detail of an event, such as a table name or a
+// SQL statement, beyond which it is truncated.
+const size_t trace_detail_size = 128;
+
+// Records a span from construction to destruction, with an optional
+// detail shown as the argument arg_name, e.g.
+//     trace_span span("phase", "extract", "table", table.name);
+// The category, name, and arg_name must be string literals.
+class trace_span {
+public:
+    trace_span(const char* category, const char* name)
+    {
+        if (trace_enabled())
+            begin(category, name, nullptr, nullptr, 0);
+    }
+    trace_span(const char* category, const char* name, const char* arg_name,
+               const string& detail)
+    {
+        if (trace_enabled())
+            begin(category, name, arg_name, detail.data(), detail.size());
+    }
+    ~trace_span()
+    {
+        if (active)
+            end();
+    }
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+private:
+    bool active = false;
+    const char* category;
+    const char* name;
+    const char* arg_name;
+    int64_t start;
+    char detail[trace_detail_size];
+    void begin(const char* category, const char* name, const char* arg_name,
+               const char* detail, size_t length);
+    void end();
+};
+
+// Records the value of a counter, which is shown as a track of the
+// process.  The name must be a string literal.
+void trace_counter_value(const char* name, int64_t value);
+
+inline void trace_counter(const char* name, int64_t value)
+{
+    if (trace_enabled())
+        trace_counter_value(name, value);
+}
+
+}
+
+#endif
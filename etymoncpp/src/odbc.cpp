@@ -1,9 +1,18 @@
 #include <stdexcept>
 
 #include "../include/odbc.h"
+#include "../include/trace.h"
 
 namespace etymon {
 
+static thread_local odbc_counters thread_counters;
+
+// Returns the counts of database calls made by the calling thread.
+const odbc_counters& odbc_thread_counters()
+{
+    return thread_counters;
+}
+
 const char* odbc_str_error(SQLRETURN rc)
 {
     switch (rc) {
@@ -73,6 +82,9 @@ void odbc_conn::get_dbms_name(string* dbms_name)
 
 void odbc_conn::exec_direct_stmt(odbc_stmt* stmt, const string& sql)
 {
+    thread_counters.round_trips++;
+    thread_counters.bytes_sent += sql.size();
+    trace_span span("db", "exec", "sql", sql);
     SQLRETURN rc = SQLExecDirect(stmt->stmt, (SQLCHAR *) sql.c_str(),
             SQL_NTS);
     if (!SQL_SUCCEEDED(rc) && rc != SQL_NO_DATA) {
@@ -89,6 +101,17 @@ void odbc_conn::exec(const string& sql)
     exec_direct_stmt(&st, sql);
 }
 
+// Executes a statement and returns the number of rows affected, or -1
+// if the number is not available.
+void odbc_conn::exec(const string& sql, int64_t* rows)
+{
+    odbc_stmt st(this);
+    exec_direct_stmt(&st, sql);
+    SQLLEN n;
+    SQLRETURN rc = SQLRowCount(st.stmt, &n);
+    *rows = SQL_SUCCEEDED(rc) ? n : -1;
+}
+
 void odbc_conn::exec_direct(odbc_stmt* stmt, const string& sql)
 {
     if (stmt == nullptr)
@@ -108,6 +131,47 @@ bool odbc_conn::fetch(odbc_stmt* stmt)
     return true;
 }
 
+// Fetches the next block of rows into the rowset.  The rowset is bound
+// to the statement on the first call.  Returns false if there are no
+// more rows.
+bool odbc_conn::fetch(odbc_stmt* stmt, odbc_rowset* rowset)
+{
+    if (rowset->bound != stmt->stmt) {
+        SQLRETURN rc = SQLSetStmtAttr(stmt->stmt, SQL_ATTR_ROW_BIND_TYPE,
+                (SQLPOINTER) SQL_BIND_BY_COLUMN, 0);
+        if (SQL_SUCCEEDED(rc))
+            rc = SQLSetStmtAttr(stmt->stmt, SQL_ATTR_ROW_ARRAY_SIZE,
+                    (SQLPOINTER) rowset->rows, 0);
+        if (SQL_SUCCEEDED(rc))
+            rc = SQLSetStmtAttr(stmt->stmt, SQL_ATTR_ROWS_FETCHED_PTR,
+                    &(rowset->fetched), 0);
+        for (uint16_t c = 0; SQL_SUCCEEDED(rc) && c < rowset->columns;
+                c++) {
+            rc = SQLBindCol(stmt->stmt, c + 1, SQL_C_CHAR,
+                    &(rowset->buffer[c * rowset->rows * rowset->width]),
+                    rowset->width,
+                    &(rowset->indicator[c * rowset->rows]));
+        }
+        if (!SQL_SUCCEEDED(rc))
+            throw runtime_error("Error binding columns in database: " + dsn);
+        rowset->bound = stmt->stmt;
+    }
+    rowset->fetched = 0;
+    SQLRETURN rc = SQLFetch(stmt->stmt);
+    if (rc == SQL_NO_DATA)
+        return false;
+    if (!SQL_SUCCEEDED(rc))
+        throw runtime_error("Error fetching data in database: " + dsn + ": " +
+                odbc_str_error(rc));
+    for (uint16_t c = 0; c < rowset->columns; c++)
+        for (SQLULEN r = 0; r < rowset->fetched; r++) {
+            SQLLEN ind = rowset->indicator[c * rowset->rows + r];
+            if (ind > 0)
+                thread_counters.bytes_received += ind;
+        }
+    return rowset->fetched > 0;
+}
+
 void odbc_conn::get_data(odbc_stmt* stmt, uint16_t column, string* data)
 {
     SQLLEN indicator;
@@ -116,10 +180,36 @@ void odbc_conn::get_data(odbc_stmt* stmt, uint16_t column, string* data)
             sizeof buffer, &indicator);
     if (!SQL_SUCCEEDED(rc) && rc != SQL_NO_DATA)
         throw runtime_error("Error getting data in database: " + dsn);
-    if (indicator == SQL_NULL_DATA)
+    if (indicator == SQL_NULL_DATA) {
         *data = "NULL";
-    else
+    } else {
         *data = buffer;
+        thread_counters.bytes_received += data->size();
+    }
+}
+
+odbc_rowset::odbc_rowset(uint16_t columns, size_t rows, size_t width) :
+    columns(columns), rows(rows), width(width),
+    buffer(columns * rows * width), indicator(columns * rows)
+{
+}
+
+size_t odbc_rowset::size() const
+{
+    return fetched;
+}
+
+// Gets the value of a column (numbered from 1) in a row of the last
+// block fetched.  A null value is returned as "NULL", as with
+// odbc_conn::get_data().
+void odbc_rowset::get_data(size_t row, uint16_t column, string* data) const
+{
+    size_t c = column - 1;
+    SQLLEN ind = indicator[c * rows + row];
+    if (ind == SQL_NULL_DATA)
+        *data = "NULL";
+    else
+        *data = &(buffer[(c * rows + row) * width]);
 }
 
 odbc_stmt::odbc_stmt(odbc_conn* conn)
@@ -161,6 +251,7 @@ odbc_tx::~odbc_tx()
 void odbc_tx::commit()
 {
     if (!completed) {
+        thread_counters.round_trips++;
         SQLRETURN rc = SQLEndTran(SQL_HANDLE_DBC, conn->conn, SQL_COMMIT);
         set_auto_commit(true, conn);
         if (!SQL_SUCCEEDED(rc))
@@ -173,6 +264,7 @@ void odbc_tx::commit()
 void odbc_tx::rollback()
 {
     if (!completed) {
+        thread_counters.round_trips++;
         SQLEndTran(SQL_HANDLE_DBC, conn->conn, SQL_ROLLBACK);
         set_auto_commit(true, conn);
         completed = true;
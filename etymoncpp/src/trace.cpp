@@ -0,0 +1,263 @@
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../include/trace.h"
+#include "../include/util.h"
+
+namespace etymon {
+
+atomic<bool> trace_on(false);
+
+// Number of events in each chunk of a thread's buffer.
+static const size_t trace_chunk_size = 1024;
+
+class trace_event {
+public:
+    char type;  // 'X' for a span or 'C' for a counter.
+    const char* category;
+    const char* name;
+    const char* arg_name;
+    int64_t ts;  // Microseconds since the trace was started.
+    int64_t dur;
+    int64_t value;
+    char detail[trace_detail_size];
+};
+
+// Only the owning thread appends to a chunk, and it publishes each event
+// by incrementing count, so that the chunk can be read at any time
+// without locking.
+class trace_chunk {
+public:
+    trace_event events[trace_chunk_size];
+    atomic<size_t> count{0};
+    atomic<trace_chunk*> next{nullptr};
+};
+
+class trace_buffer {
+public:
+    long tid;
+    uint64_t generation;
+    trace_chunk* head;
+    trace_chunk* tail;
+    trace_buffer* next = nullptr;
+    trace_buffer(uint64_t generation) : generation(generation)
+    {
+        tid = syscall(SYS_gettid);
+        head = new trace_chunk();
+        tail = head;
+    }
+    ~trace_buffer()
+    {
+        trace_chunk* c = head;
+        while (c != nullptr) {
+            trace_chunk* n = c->next.load(memory_order_relaxed);
+            delete c;
+            c = n;
+        }
+    }
+};
+
+// Buffers of all threads, added by each thread when it first records an
+// event, and freed when tracing is started again.
+static atomic<trace_buffer*> buffers(nullptr);
+static atomic<uint64_t> generation(0);
+static chrono::steady_clock::time_point epoch;
+
+static thread_local trace_buffer* thread_buffer = nullptr;
+
+static int64_t trace_now()
+{
+    return chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - epoch).count();
+}
+
+static trace_event* next_event()
+{
+    uint64_t g = generation.load(memory_order_acquire);
+    if (thread_buffer == nullptr || thread_buffer->generation != g) {
+        trace_buffer* b = new trace_buffer(g);
+        b->next = buffers.load(memory_order_relaxed);
+        while (!buffers.compare_exchange_weak(b->next, b,
+                                              memory_order_release,
+                                              memory_order_relaxed))
+            ;
+        thread_buffer = b;
+    }
+    trace_chunk* c = thread_buffer->tail;
+    size_t n = c->count.load(memory_order_relaxed);
+    if (n == trace_chunk_size) {
+        trace_chunk* nc = new trace_chunk();
+        c->next.store(nc, memory_order_release);
+        thread_buffer->tail = nc;
+        return nc->events;
+    }
+    return c->events + n;
+}
+
+static void publish_event()
+{
+    trace_chunk* c = thread_buffer->tail;
+    c->count.store(c->count.load(memory_order_relaxed) + 1,
+                   memory_order_release);
+}
+
+// Copies a detail, truncating it if necessary at the start of a UTF-8
+// character.
+static void copy_detail(char* dest, const char* src, size_t length)
+{
+    if (length >= trace_detail_size) {
+        length = trace_detail_size - 1;
+        while (length > 0 && (src[length] & 0xc0) == 0x80)
+            length--;
+    }
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+}
+
+void trace_span::begin(const char* category, const char* name,
+                       const char* arg_name, const char* detail,
+                       size_t length)
+{
+    active = true;
+    this->category = category;
+    this->name = name;
+    this->arg_name = arg_name;
+    if (arg_name != nullptr)
+        copy_detail(this->detail, detail, length);
+    start = trace_now();
+}
+
+void trace_span::end()
+{
+    if (!trace_enabled())
+        return;
+    int64_t now = trace_now();
+    trace_event* e = next_event();
+    e->type = 'X';
+    e->category = category;
+    e->name = name;
+    e->arg_name = arg_name;
+    e->ts = start;
+    e->dur = now - start;
+    if (arg_name != nullptr)
+        memcpy(e->detail, detail, strlen(detail) + 1);
+    publish_event();
+}
+
+void trace_counter_value(const char* name, int64_t value)
+{
+    trace_event* e = next_event();
+    e->type = 'C';
+    e->category = nullptr;
+    e->name = name;
+    e->arg_name = nullptr;
+    e->ts = trace_now();
+    e->value = value;
+    publish_event();
+}
+
+void trace_start()
+{
+    trace_on = false;
+    trace_buffer* b = buffers.exchange(nullptr);
+    while (b != nullptr) {
+        trace_buffer* n = b->next;
+        delete b;
+        b = n;
+    }
+    epoch = chrono::steady_clock::now();
+    generation++;
+    thread_buffer = nullptr;
+    trace_on = true;
+}
+
+static void write_json_string(FILE* fp, const char* s)
+{
+    fputc('"', fp);
+    for (const unsigned char* p = (const unsigned char*) s; *p != '\0'; p++) {
+        switch (*p) {
+        case '"':
+            fputs("\\\"", fp);
+            break;
+        case '\\':
+            fputs("\\\\", fp);
+            break;
+        case '\n':
+            fputs("\\n", fp);
+            break;
+        case '\t':
+            fputs("\\t", fp);
+            break;
+        default:
+            if (*p < 0x20)
+                fprintf(fp, "\\u%04x", *p);
+            else
+                fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void write_event(FILE* fp, const trace_event& e, long pid, long tid)
+{
+    fputs("{\"name\":", fp);
+    write_json_string(fp, e.name);
+    if (e.category != nullptr) {
+        fputs(",\"cat\":", fp);
+        write_json_string(fp, e.category);
+    }
+    fprintf(fp, ",\"ph\":\"%c\",\"ts\":%" PRId64 ",\"pid\":%ld,\"tid\":%ld",
+            e.type, e.ts, pid, tid);
+    if (e.type == 'X') {
+        fprintf(fp, ",\"dur\":%" PRId64, e.dur);
+        if (e.arg_name != nullptr) {
+            fputs(",\"args\":{", fp);
+            write_json_string(fp, e.arg_name);
+            fputc(':', fp);
+            write_json_string(fp, e.detail);
+            fputc('}', fp);
+        }
+    } else {
+        fprintf(fp, ",\"args\":{\"value\":%" PRId64 "}", e.value);
+    }
+    fputc('}', fp);
+}
+
+void trace_write(const string& filename)
+{
+    trace_on = false;
+    long pid = getpid();
+    string tmpname = filename + ".tmp";
+    {
+        file f(tmpname, "w");
+        fputs("{\"traceEvents\":[\n", f.fp);
+        bool first = true;
+        for (trace_buffer* b = buffers.load(memory_order_acquire);
+             b != nullptr; b = b->next) {
+            for (trace_chunk* c = b->head; c != nullptr;
+                 c = c->next.load(memory_order_acquire)) {
+                size_t n = c->count.load(memory_order_acquire);
+                for (size_t x = 0; x < n; x++) {
+                    if (!first)
+                        fputs(",\n", f.fp);
+                    first = false;
+                    write_event(f.fp, c->events[x], pid, b->tid);
+                }
+            }
+        }
+        fputs("\n],\"displayTimeUnit\":\"ms\"}\n", f.fp);
+        if (fflush(f.fp) != 0)
+            throw runtime_error("Error writing file: " + tmpname);
+    }
+    if (rename(tmpname.c_str(), filename.c_str()) != 0)
+        throw runtime_error("Error renaming file: " + tmpname + ": " +
+                            string(strerror(errno)));
+}
+
+}
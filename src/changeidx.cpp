@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fcntl.h>
+#include <random>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "changeidx.h"
+
+namespace fs = std::experimental::filesystem;
+
+static const char change_index_magic[8] = {'L', 'D', 'P', 'C', 'I', 'D', 'X',
+    '\0'};
+static const uint32_t change_index_version = 1;
+
+class change_index_header {
+public:
+    char magic[8];
+    uint32_t version;
+    int16_t tenant_id;
+    uint16_t reserved;
+    int64_t stamp;
+    uint64_t count;
+};
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Parses a UUID in canonical (lowercase) form into 16 bytes.
+bool parse_uuid(const char* str, uint8_t* bytes)
+{
+    int b = 0;
+    for (int x = 0; x < 36; x++) {
+        if (x == 8 || x == 13 || x == 18 || x == 23) {
+            if (str[x] != '-')
+                return false;
+            continue;
+        }
+        int h = hex_value(str[x]);
+        if (h == -1)
+            return false;
+        if (b % 2 == 0)
+            bytes[b / 2] = (uint8_t) (h << 4);
+        else
+            bytes[b / 2] |= (uint8_t) h;
+        b++;
+    }
+    return str[36] == '\0';
+}
+
+// Parses a data hash into 16 bytes.  The hash may be in the form
+// returned by data_hash() or in UUID form as stored by PostgreSQL.
+bool parse_hash(const char* str, uint8_t* bytes)
+{
+    int b = 0;
+    for (const char* p = str; *p != '\0'; p++) {
+        if (*p == '-')
+            continue;
+        int h = hex_value(*p);
+        if (h == -1 || b == 32)
+            return false;
+        if (b % 2 == 0)
+            bytes[b / 2] = (uint8_t) (h << 4);
+        else
+            bytes[b / 2] |= (uint8_t) h;
+        b++;
+    }
+    return b == 32;
+}
+
+void format_uuid(const uint8_t* bytes, string* str)
+{
+    static const char digits[] = "0123456789abcdef";
+    str->clear();
+    for (int x = 0; x < 16; x++) {
+        if (x == 4 || x == 6 || x == 8 || x == 10)
+            *str += '-';
+        *str += digits[bytes[x] >> 4];
+        *str += digits[bytes[x] & 0xf];
+    }
+}
+
+static bool entry_less(const change_index_entry& e1,
+                       const change_index_entry& e2)
+{
+    return memcmp(e1.id, e2.id, 16) < 0;
+}
+
+static bool entry_equal_id(const change_index_entry& e1,
+                           const change_index_entry& e2)
+{
+    return memcmp(e1.id, e2.id, 16) == 0;
+}
+
+change_index::change_index(const string& datadir, const string& table_name,
+                           int16_t tenant_id) :
+    table_name(table_name), tenant_id(tenant_id)
+{
+    fs::path p = datadir;
+    p = p / "changeidx" / (table_name + "_" + to_string(tenant_id) + ".idx");
+    path = p;
+}
+
+change_index::~change_index()
+{
+    unmap();
+}
+
+void change_index::unmap()
+{
+    if (map_addr != nullptr) {
+        munmap(map_addr, map_size);
+        map_addr = nullptr;
+        map_size = 0;
+    }
+    rebuilt_entries.clear();
+    entries = nullptr;
+    count = 0;
+}
+
+// Loads the index from the database stamp and the index file, or
+// rebuilds it if the file is missing or stale.
+void change_index::open(etymon::odbc_conn* conn, ldp_log* lg)
+{
+    string sql =
+        "SELECT stamp\n"
+        "    FROM dbsystem.change_index\n"
+        "    WHERE table_name = '" + table_name + "' AND\n"
+        "          tenant_id = " + to_string(tenant_id) + ";";
+    lg->detail(sql);
+    string stamp;
+    {
+        etymon::odbc_stmt stmt(conn);
+        conn->exec_direct(&stmt, sql);
+        if (conn->fetch(&stmt))
+            conn->get_data(&stmt, 1, &stamp);
+    }
+    if (stamp != "" && stamp != "NULL" && load(stoll(stamp))) {
+        lg->trace("Loaded change index: " + path + ": " + to_string(count) +
+                  " records");
+        return;
+    }
+    lg->trace("Rebuilding change index: " + path);
+    rebuild(conn, lg);
+}
+
+// Memory-maps the index file and returns true if it is valid and
+// matches the stamp.
+bool change_index::load(int64_t stamp)
+{
+    unmap();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+            (size_t) st.st_size < sizeof(change_index_header)) {
+        close(fd);
+        return false;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+    const change_index_header* header = (const change_index_header*) addr;
+    if (memcmp(header->magic, change_index_magic, 8) != 0 ||
+            header->version != change_index_version ||
+            header->tenant_id != tenant_id ||
+            header->stamp != stamp ||
+            sizeof(change_index_header) +
+            header->count * sizeof(change_index_entry) !=
+            (size_t) st.st_size) {
+        munmap(addr, st.st_size);
+        return false;
+    }
+    map_addr = addr;
+    map_size = st.st_size;
+    entries = (const change_index_entry*)
+        ((const char*) addr + sizeof(change_index_header));
+    count = header->count;
+    return true;
+}
+
+// Rebuilds the index from the table in the database.  If the table
+// cannot be read, e.g. because it does not yet exist, the index is left
+// empty and all records will be treated as changed.
+void change_index::rebuild(etymon::odbc_conn* conn, ldp_log* lg)
+{
+    unmap();
+    string sql =
+        "SELECT id,\n"
+        "       data_hash\n"
+        "    FROM " + table_name + "\n"
+        "    WHERE tenant_id = " + to_string(tenant_id) + " AND\n"
+        "          data_hash IS NOT NULL;";
+    lg->detail(sql);
+    try {
+        etymon::odbc_stmt stmt(conn);
+        conn->exec_direct(&stmt, sql);
+        string id, hash;
+        change_index_entry e;
+        while (conn->fetch(&stmt)) {
+            conn->get_data(&stmt, 1, &id);
+            conn->get_data(&stmt, 2, &hash);
+            if (parse_uuid(id.c_str(), e.id) &&
+                    parse_hash(hash.c_str(), e.hash))
+                rebuilt_entries.push_back(e);
+        }
+    } catch (runtime_error& e) {
+        string s = e.what();
+        if ( !(s.empty()) && s.back() == '\n' )
+            s.pop_back();
+        lg->detail(s);
+        rebuilt_entries.clear();
+    }
+    sort(rebuilt_entries.begin(), rebuilt_entries.end(), entry_less);
+    entries = rebuilt_entries.data();
+    count = rebuilt_entries.size();
+}
+
+const change_index_entry* change_index::find(const uint8_t* id) const
+{
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = memcmp(entries[mid].id, id, 16);
+        if (c == 0)
+            return entries + mid;
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return nullptr;
+}
+
+// Adds a record to the new index and returns true if the record is
+// present in the current index with the same hash.
+bool change_index::record(const char* id, const string& hash)
+{
+    change_index_entry e;
+    if (!parse_uuid(id, e.id) || !parse_hash(hash.c_str(), e.hash))
+        return false;
+    new_entries.push_back(e);
+    new_entries_sorted = false;
+    const change_index_entry* old = find(e.id);
+    return old != nullptr && memcmp(old->hash, e.hash, 16) == 0;
+}
+
+void change_index::sort_new_entries()
+{
+    if (new_entries_sorted)
+        return;
+    // If an id occurs more than once, the last record is kept.
+    reverse(new_entries.begin(), new_entries.end());
+    stable_sort(new_entries.begin(), new_entries.end(), entry_less);
+    new_entries.erase(unique(new_entries.begin(), new_entries.end(),
+                             entry_equal_id),
+                      new_entries.end());
+    new_entries_sorted = true;
+}
+
+// Returns the ids that are present in the current index but were not
+// recorded in the new index.
+void change_index::deleted_ids(vector<string>* ids)
+{
+    ids->clear();
+    sort_new_entries();
+    size_t y = 0;
+    string id;
+    for (size_t x = 0; x < count; x++) {
+        while (y < new_entries.size() &&
+               memcmp(new_entries[y].id, entries[x].id, 16) < 0)
+            y++;
+        if (y < new_entries.size() &&
+                memcmp(new_entries[y].id, entries[x].id, 16) == 0)
+            continue;
+        format_uuid(entries[x].id, &id);
+        ids->push_back(id);
+    }
+}
+
+// Writes the new index to a temporary file and records its stamp in
+// the database.  This should be called within the transaction that
+// updates the table, and commit() should be called after the
+// transaction has been committed.
+void change_index::save(etymon::odbc_conn* conn, ldp_log* lg)
+{
+    write();
+    save_stamp(conn, lg);
+}
+
+// Writes the new index to a temporary file with a new random stamp.
+void change_index::write()
+{
+    random_device rd;
+    uniform_int_distribution<int64_t> dist(1, INT64_MAX);
+    write(dist(rd));
+}
+
+// Records the stamp of the new index in the database.  This should be
+// called within the transaction that makes the table visible.
+void change_index::save_stamp(etymon::odbc_conn* conn, ldp_log* lg)
+{
+    string sql =
+        "DELETE FROM dbsystem.change_index\n"
+        "    WHERE table_name = '" + table_name + "' AND\n"
+        "          tenant_id = " + to_string(tenant_id) + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+    sql =
+        "INSERT INTO dbsystem.change_index\n"
+        "    (table_name, tenant_id, stamp)\n"
+        "    VALUES\n"
+        "    ('" + table_name + "', " + to_string(tenant_id) + ", " +
+        to_string(new_stamp) + ");";
+    lg->detail(sql);
+    conn->exec(sql);
+}
+
+void change_index::write(int64_t stamp)
+{
+    sort_new_entries();
+    fs::create_directories(fs::path(path).parent_path());
+    string new_path = path + ".new";
+    int fd = ::open(new_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        throw runtime_error("Unable to create change index: " + new_path);
+    change_index_header header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, change_index_magic, 8);
+    header.version = change_index_version;
+    header.tenant_id = tenant_id;
+    header.stamp = stamp;
+    header.count = new_entries.size();
+    bool ok = ::write(fd, &header, sizeof header) == sizeof header;
+    const char* p = (const char*) new_entries.data();
+    size_t remaining = new_entries.size() * sizeof(change_index_entry);
+    while (ok && remaining > 0) {
+        ssize_t n = ::write(fd, p, remaining);
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        p += n;
+        remaining -= n;
+    }
+    if (ok)
+        ok = (fsync(fd) == 0);
+    if (close(fd) != 0)
+        ok = false;
+    if (!ok)
+        throw runtime_error("Unable to write change index: " + new_path);
+    new_stamp = stamp;
+    // The indexes are no longer needed in memory.
+    unmap();
+    vector<change_index_entry>().swap(new_entries);
+}
+
+// Replaces the index file with the new index.
+void change_index::commit()
+{
+    unmap();
+    string new_path = path + ".new";
+    if (rename(new_path.c_str(), path.c_str()) != 0)
+        throw runtime_error("Unable to replace change index: " + path);
+}
@@ -0,0 +1,85 @@
+#ifndef LDP_CHANGEIDX_H
+#define LDP_CHANGEIDX_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../etymoncpp/include/odbc.h"
+#include "log.h"
+
+using namespace std;
+
+class change_index_entry {
+public:
+    uint8_t id[16];
+    uint8_t hash[16];
+};
+
+// Local index of the data hash of each record in one table for one
+// tenant.  The index is a sorted array of (id, hash) entries stored in
+// the data directory and memory-mapped when it is loaded.  During
+// staging, each record is looked up in the index to determine whether
+// it has changed since the last update, and a new index is built from
+// the records that are seen.
+//
+// The index is valid only if its stamp matches the stamp recorded in
+// dbsystem.change_index, which is updated in the same transaction as
+// the table.  If the index file is missing or stale, it is rebuilt
+// from the table in the database.
+//
+// Only records with a canonical (lowercase) UUID as id are indexed;
+// other records are always treated as changed.
+class change_index {
+public:
+    // Enables skipping of unchanged records during staging.
+    bool filter = false;
+    // Number of unchanged records skipped during staging.
+    size_t skipped = 0;
+    change_index(const string& datadir, const string& table_name,
+                 int16_t tenant_id);
+    ~change_index();
+    change_index(const change_index&) = delete;
+    change_index& operator=(const change_index&) = delete;
+    void open(etymon::odbc_conn* conn, ldp_log* lg);
+    bool load(int64_t stamp);
+    void rebuild(etymon::odbc_conn* conn, ldp_log* lg);
+    bool record(const char* id, const string& hash);
+    void deleted_ids(vector<string>* ids);
+    void save(etymon::odbc_conn* conn, ldp_log* lg);
+    void write();
+    void write(int64_t stamp);
+    void save_stamp(etymon::odbc_conn* conn, ldp_log* lg);
+    void commit();
+    int16_t tenant() const { return tenant_id; }
+    size_t size() const { return count; }
+private:
+    string path;
+    string table_name;
+    int16_t tenant_id;
+    void* map_addr = nullptr;
+    size_t map_size = 0;
+    const change_index_entry* entries = nullptr;
+    size_t count = 0;
+    vector<change_index_entry> rebuilt_entries;
+    vector<change_index_entry> new_entries;
+    bool new_entries_sorted = false;
+    int64_t new_stamp = 0;
+    void unmap();
+    void sort_new_entries();
+    const change_index_entry* find(const uint8_t* id) const;
+};
+
+typedef map<int16_t, unique_ptr<change_index>> change_index_map;
+
+// Regular expression matching the ids that can be indexed.
+const char canonical_uuid_pattern[] =
+    "^[0-9a-f]{8}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{12}$";
+
+bool parse_uuid(const char* str, uint8_t* bytes);
+bool parse_hash(const char* str, uint8_t* bytes);
+void format_uuid(const uint8_t* bytes, string* str);
+
+#endif
@@ -0,0 +1,434 @@
+#include <cctype>
+#include <ctime>
+#include <experimental/filesystem>
+#include <stdexcept>
+#include <vector>
+#include <zlib.h>
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include "compact.h"
+#include "dbtype.h"
+#include "merge.h"
+#include "names.h"
+#include "timer.h"
+
+namespace fs = std::experimental::filesystem;
+namespace json = rapidjson;
+
+// History tables are compacted in batches of ids, each in a separate
+// transaction, so that locks are held only briefly.  The range of ids
+// is divided into this many batches.
+static const int compact_batches = 256;
+
+class history_retention {
+public:
+    string table_name;
+    bool remove_duplicates = false;
+    // Age in days after which versions are thinned, or -1 if versions
+    // are not thinned.
+    int thin_after_days = -1;
+    string thin_interval;
+    bool archive = false;
+};
+
+// Compressed archive of the versions removed from a history table, in
+// the data directory under archive/history/.  Each version is written
+// as one line of JSON.  The file is created when the first version is
+// written.
+class history_archive {
+public:
+    size_t count = 0;
+    history_archive(const string& datadir, const string& table);
+    ~history_archive();
+    history_archive(const history_archive&) = delete;
+    history_archive& operator=(const history_archive&) = delete;
+    void write(const string& tenant_id, const string& id,
+               const string& updated, const string& data);
+    void flush();
+private:
+    string path;
+    gzFile file = nullptr;
+};
+
+history_archive::history_archive(const string& datadir, const string& table)
+{
+    char stamp[32];
+    time_t now = time(nullptr);
+    struct tm t;
+    gmtime_r(&now, &t);
+    strftime(stamp, sizeof stamp, "%Y%m%dT%H%M%SZ", &t);
+    fs::path p = datadir;
+    p = p / "archive" / "history" /
+        (table + "_" + string(stamp) + ".ndjson.gz");
+    path = p;
+}
+
+history_archive::~history_archive()
+{
+    if (file != nullptr)
+        gzclose(file);
+}
+
+void history_archive::write(const string& tenant_id, const string& id,
+                            const string& updated, const string& data)
+{
+    if (file == nullptr) {
+        fs::create_directories(fs::path(path).parent_path());
+        file = gzopen(path.c_str(), "ab");
+        if (file == nullptr)
+            throw runtime_error("Unable to create history archive: " + path);
+    }
+    json::StringBuffer buffer;
+    json::Writer<json::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("id");
+    writer.String(id.c_str(), id.size());
+    writer.Key("updated");
+    writer.String(updated.c_str(), updated.size());
+    writer.Key("tenant_id");
+    writer.Int(stoi(tenant_id));
+    writer.Key("data");
+    writer.RawValue(data.c_str(), data.size(), json::kObjectType);
+    writer.EndObject();
+    if (gzwrite(file, buffer.GetString(), buffer.GetSize()) == 0 ||
+            gzputc(file, '\n') == -1)
+        throw runtime_error("Unable to write history archive: " + path);
+    count++;
+}
+
+// Flushes archived versions to the file.  This should be called before
+// the versions are deleted from the database.
+void history_archive::flush()
+{
+    if (file != nullptr && gzflush(file, Z_SYNC_FLUSH) != Z_OK)
+        throw runtime_error("Unable to write history archive: " + path);
+}
+
+static void select_history_retention(ldp_log* lg, etymon::odbc_conn* conn,
+                                     vector<history_retention>* retention)
+{
+    string sql =
+        "SELECT table_name,\n"
+        "       remove_duplicates,\n"
+        "       thin_after_days,\n"
+        "       thin_interval,\n"
+        "       archive\n"
+        "    FROM dbconfig.history_retention;";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    while (conn->fetch(&stmt)) {
+        history_retention r;
+        string remove_duplicates, thin_after_days, archive;
+        conn->get_data(&stmt, 1, &(r.table_name));
+        conn->get_data(&stmt, 2, &remove_duplicates);
+        conn->get_data(&stmt, 3, &thin_after_days);
+        conn->get_data(&stmt, 4, &(r.thin_interval));
+        conn->get_data(&stmt, 5, &archive);
+        r.remove_duplicates = (remove_duplicates == "1");
+        if (thin_after_days != "NULL")
+            r.thin_after_days = stoi(thin_after_days);
+        r.archive = (archive == "1");
+        retention->push_back(r);
+    }
+}
+
+// Selects the versions of records in one batch, with the data of each
+// version and whether it is to be kept.  In PostgreSQL the data are
+// reconstructed from delta encoded versions.
+static void select_compact_versions_sql(const history_retention& r,
+                                        const dbtype& dbt,
+                                        const string& where, string* sql)
+{
+    string history_table;
+    history_table_name(r.table_name, &history_table);
+    string full_data = dbt.type() == dbsys::postgresql ?
+        "dbsystem.history_data((data)::JSONB, delta)\n"
+        "            OVER (PARTITION BY tenant_id, id\n"
+        "                  ORDER BY updated\n"
+        "                  ROWS UNBOUNDED PRECEDING)" :
+        "data";
+    // A version is a duplicate if its data are the same as those of the
+    // previous version.
+    string duplicate = r.remove_duplicates ?
+        "( prev_data IS NOT NULL AND full_data = prev_data )" : "FALSE";
+    // Versions older than thin_after_days are thinned to the last
+    // version in each interval.
+    string thinned = r.thin_after_days >= 0 ?
+        "( updated < " + string(dbt.current_timestamp()) + " - INTERVAL '" +
+        to_string(r.thin_after_days) + " days' AND\n"
+        "              period_rank > 1 )" :
+        "FALSE";
+    *sql =
+        "SELECT tenant_id,\n"
+        "       id,\n"
+        "       updated,\n"
+        "       ( latest OR\n"
+        "         NOT ( " + duplicate + " OR\n"
+        "               " + thinned + " ) ) AS keep,\n"
+        "       full_data,\n"
+        "       row_number() OVER (PARTITION BY tenant_id, id\n"
+        "                          ORDER BY updated) AS version\n"
+        "    FROM (\n"
+        "SELECT tenant_id,\n"
+        "       id,\n"
+        "       updated,\n"
+        "       latest,\n"
+        "       full_data,\n"
+        "       lag(full_data)\n"
+        "           OVER (PARTITION BY tenant_id, id\n"
+        "                 ORDER BY updated) AS prev_data,\n"
+        "       row_number()\n"
+        "           OVER (PARTITION BY tenant_id, id,\n"
+        "                     date_trunc('" + r.thin_interval + "', updated)\n"
+        "                 ORDER BY updated DESC) AS period_rank\n"
+        "    FROM (\n"
+        "SELECT tenant_id,\n"
+        "       id,\n"
+        "       updated,\n"
+        "       latest,\n"
+        "       " + full_data + " AS full_data\n"
+        "    FROM " + history_table + "\n"
+        "    WHERE\n" + where +
+        "          TRUE\n"
+        "    ) AS h\n"
+        "    ) AS v";
+}
+
+// In PostgreSQL, delta encoded versions that follow removed versions
+// are re-encoded relative to the previous version that is kept, or
+// stored in full if there is no such version.
+static void repair_deltas(const history_retention& r, ldp_log* lg,
+                          etymon::odbc_conn* conn,
+                          const string& compact_table)
+{
+    string history_table;
+    history_table_name(r.table_name, &history_table);
+    string kept =
+        "(SELECT tenant_id,\n"
+        "                 id,\n"
+        "                 updated,\n"
+        "                 full_data,\n"
+        "                 version,\n"
+        "                 lag(version)\n"
+        "                     OVER (PARTITION BY tenant_id, id\n"
+        "                           ORDER BY updated) AS prev_version,\n"
+        "                 CASE WHEN version = 1 OR\n"
+        "                           lag(version)\n"
+        "                               OVER (PARTITION BY tenant_id, id\n"
+        "                                     ORDER BY updated) IS NULL\n"
+        "                      THEN NULL\n"
+        "                      ELSE dbsystem.jsonb_diff(\n"
+        "                          lag(full_data)\n"
+        "                              OVER (PARTITION BY tenant_id, id\n"
+        "                                    ORDER BY updated),\n"
+        "                          full_data) END AS delta\n"
+        "              FROM " + compact_table + "\n"
+        "              WHERE keep)";
+    string sql =
+        "UPDATE " + history_table + " AS h\n"
+        "    SET data = c.full_data,\n"
+        "        delta_seq = 0\n"
+        "    FROM " + kept + " AS c\n"
+        "    WHERE h.tenant_id = c.tenant_id AND\n"
+        "          h.id = c.id AND\n"
+        "          h.updated = c.updated AND\n"
+        "          c.version > 1 AND\n"
+        "          c.prev_version IS NULL AND\n"
+        "          h.data IS NULL;";
+    lg->detail(sql);
+    conn->exec(sql);
+    sql =
+        "UPDATE " + history_table + " AS h\n"
+        "    SET delta = c.delta,\n"
+        "        changed_fields = dbsystem.jsonb_patch_fields(c.delta)\n"
+        "    FROM " + kept + " AS c\n"
+        "    WHERE h.tenant_id = c.tenant_id AND\n"
+        "          h.id = c.id AND\n"
+        "          h.updated = c.updated AND\n"
+        "          c.version > coalesce(c.prev_version, 0) + 1 AND\n"
+        "          h.delta IS NOT NULL;";
+    lg->detail(sql);
+    conn->exec(sql);
+}
+
+// Compacts one batch of a history table and returns the number of
+// versions removed.
+static size_t compact_batch(const history_retention& r, ldp_log* lg,
+                            etymon::odbc_conn* conn, const dbtype& dbt,
+                            const string& where, history_archive* archive)
+{
+    string history_table;
+    history_table_name(r.table_name, &history_table);
+    string compact_table;
+    history_compact_table_name(r.table_name, &compact_table);
+
+    etymon::odbc_tx tx(conn);
+
+    string select;
+    select_compact_versions_sql(r, dbt, where, &select);
+    string sql =
+        "CREATE TEMPORARY TABLE\n"
+        "    " + compact_table + "\n"
+        "    AS\n" + select + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+
+    sql =
+        "SELECT count(*)\n"
+        "    FROM " + compact_table + "\n"
+        "    WHERE NOT keep;";
+    lg->detail(sql);
+    string count;
+    {
+        etymon::odbc_stmt stmt(conn);
+        conn->exec_direct(&stmt, sql);
+        conn->fetch(&stmt);
+        conn->get_data(&stmt, 1, &count);
+    }
+
+    size_t removed = stoull(count);
+    if (removed > 0) {
+        if (r.archive) {
+            sql =
+                "SELECT tenant_id,\n"
+                "       id,\n"
+                "       updated,\n"
+                "       full_data\n"
+                "    FROM " + compact_table + "\n"
+                "    WHERE NOT keep\n"
+                "    ORDER BY tenant_id, id, updated;";
+            lg->detail(sql);
+            {
+                etymon::odbc_stmt stmt(conn);
+                conn->exec_direct(&stmt, sql);
+                string tenant_id, id, updated, data;
+                while (conn->fetch(&stmt)) {
+                    conn->get_data(&stmt, 1, &tenant_id);
+                    conn->get_data(&stmt, 2, &id);
+                    conn->get_data(&stmt, 3, &updated);
+                    conn->get_data(&stmt, 4, &data);
+                    archive->write(tenant_id, id, updated, data);
+                }
+            }
+            archive->flush();
+        }
+
+        if (dbt.type() == dbsys::postgresql)
+            repair_deltas(r, lg, conn, compact_table);
+
+        // A version that is followed by removed versions remains valid
+        // until the next version that is kept.
+        sql =
+            "UPDATE " + history_table + " AS h\n"
+            "    SET valid_to = c.next_updated\n"
+            "    FROM (SELECT tenant_id,\n"
+            "                 id,\n"
+            "                 updated,\n"
+            "                 version,\n"
+            "                 lead(updated)\n"
+            "                     OVER (PARTITION BY tenant_id, id\n"
+            "                           ORDER BY updated) AS next_updated,\n"
+            "                 lead(version)\n"
+            "                     OVER (PARTITION BY tenant_id, id\n"
+            "                           ORDER BY updated) AS next_version\n"
+            "              FROM " + compact_table + "\n"
+            "              WHERE keep) AS c\n"
+            "    WHERE h.tenant_id = c.tenant_id AND\n"
+            "          h.id = c.id AND\n"
+            "          h.updated = c.updated AND\n"
+            "          c.next_version > c.version + 1;";
+        lg->detail(sql);
+        conn->exec(sql);
+
+        sql =
+            "DELETE FROM " + history_table + "\n"
+            "    USING " + compact_table + " AS c\n"
+            "    WHERE " + history_table + ".tenant_id = c.tenant_id AND\n"
+            "          " + history_table + ".id = c.id AND\n"
+            "          " + history_table + ".updated = c.updated AND\n"
+            "          NOT c.keep;";
+        lg->detail(sql);
+        conn->exec(sql);
+
+        sql =
+            "UPDATE dbsystem.tables\n"
+            "    SET history_row_count = history_row_count - " +
+            to_string(removed) + "\n"
+            "    WHERE table_name = '" + r.table_name + "';";
+        lg->detail(sql);
+        conn->exec(sql);
+    }
+
+    sql = "DROP TABLE " + compact_table + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+
+    tx.commit();
+    return removed;
+}
+
+static size_t compact_table(const ldp_options& opt,
+                            const history_retention& r, ldp_log* lg,
+                            etymon::odbc_conn* conn, const dbtype& dbt)
+{
+    if (!r.remove_duplicates && r.thin_after_days < 0)
+        return 0;
+    for (char c : r.table_name)
+        if (!(isalnum(c) || c == '_'))
+            throw runtime_error("Invalid table name: " + r.table_name);
+    if (r.thin_interval != "day" && r.thin_interval != "week")
+        throw runtime_error("Invalid thinning interval: " + r.thin_interval);
+    lg->write(log_level::trace, "", "",
+              "Compacting history table: history." + r.table_name, -1);
+    timer compact_timer(opt);
+    history_archive archive(opt.datadir, r.table_name);
+    size_t removed = 0;
+    for (int batch = 0; batch < compact_batches; batch++) {
+        string where;
+        id_range_condition("id", batch, compact_batches, &where);
+        removed += compact_batch(r, lg, conn, dbt, where, &archive);
+    }
+    lg->write(log_level::debug, "update", r.table_name,
+              "Compacted history table: history." + r.table_name + ": " +
+              to_string(removed) + " versions removed",
+              compact_timer.elapsed_time());
+    return removed;
+}
+
+// Removes duplicate and thinned versions from the history tables listed
+// in dbconfig.history_retention that were selected for this update or
+// merged in it, so that a refresh compacts only the refreshed tables.
+// The number of versions removed from each table is added to changes.
+void compact_history(const ldp_options& opt, ldp_log* lg,
+                     etymon::odbc_env* odbc,
+                     map<string, table_changes>* changes)
+{
+    etymon::odbc_conn conn(odbc, opt.db);
+    dbtype dbt(&conn);
+    vector<history_retention> retention;
+    select_history_retention(lg, &conn, &retention);
+    for (auto& r : retention) {
+        if (!table_selected(opt, r.table_name) &&
+                changes->count(r.table_name) == 0)
+            continue;
+        try {
+            size_t removed = compact_table(opt, r, lg, &conn, dbt);
+            if (removed > 0) {
+                int64_t& rows = (*changes)[r.table_name].history_rows;
+                if (rows >= 0)
+                    rows += removed;
+            }
+        } catch (runtime_error& e) {
+            string s = e.what();
+            if ( !(s.empty()) && s.back() == '\n' )
+                s.pop_back();
+            lg->write(log_level::warning, "update", r.table_name,
+                      "Unable to compact history table:\n"
+                      "    Table: history." + r.table_name + "\n"
+                      "    Error: " + s, -1);
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef LDP_COMPACT_H
+#define LDP_COMPACT_H
+
+#include <map>
+
+#include "../etymoncpp/include/odbc.h"
+#include "log.h"
+#include "maintain.h"
+#include "options.h"
+
+using namespace std;
+
+void compact_history(const ldp_options& opt, ldp_log* lg,
+                     etymon::odbc_env* odbc,
+                     map<string, table_changes>* changes);
+
+#endif
@@ -0,0 +1,127 @@
+#include <sstream>
+#include <stdexcept>
+
+#include "cron.h"
+
+static int parse_number(const string& expression, const string& s)
+{
+    if (s.empty() || s.find_first_not_of("0123456789") != string::npos ||
+            s.size() > 2)
+        throw runtime_error("Invalid cron expression: " + expression);
+    return stoi(s);
+}
+
+// Parses one field of a cron expression, setting the allowed values in
+// bits, which has an element for each value from 0 to max.  Sets any if
+// the field is "*".
+static void parse_field(const string& expression, const string& field,
+                        int min, int max, vector<bool>* bits, bool* any)
+{
+    bits->assign(max + 1, false);
+    *any = (field == "*");
+    stringstream items(field);
+    string item;
+    while (getline(items, item, ',')) {
+        int step = 1;
+        size_t slash = item.find('/');
+        if (slash != string::npos) {
+            step = parse_number(expression, item.substr(slash + 1));
+            item = item.substr(0, slash);
+            if (step == 0)
+                throw runtime_error("Invalid cron expression: " + expression);
+        }
+        int first, last;
+        if (item == "*") {
+            first = min;
+            last = max;
+        } else {
+            size_t dash = item.find('-');
+            if (dash == string::npos) {
+                first = parse_number(expression, item);
+                // A step applies only to "*" or a range.
+                if (slash != string::npos)
+                    throw runtime_error("Invalid cron expression: " +
+                                        expression);
+                last = first;
+            } else {
+                first = parse_number(expression, item.substr(0, dash));
+                last = parse_number(expression, item.substr(dash + 1));
+            }
+        }
+        if (first < min || last > max || first > last)
+            throw runtime_error("Invalid cron expression: " + expression);
+        for (int x = first; x <= last; x += step)
+            (*bits)[x] = true;
+    }
+    if (field.empty() || field.back() == ',')
+        throw runtime_error("Invalid cron expression: " + expression);
+}
+
+cron_schedule::cron_schedule(const string& expression)
+{
+    stringstream ss(expression);
+    vector<string> fields;
+    string field;
+    while (ss >> field)
+        fields.push_back(field);
+    if (fields.size() != 5)
+        throw runtime_error("Invalid cron expression: " + expression);
+    bool any;
+    parse_field(expression, fields[0], 0, 59, &minutes, &any);
+    parse_field(expression, fields[1], 0, 23, &hours, &any);
+    parse_field(expression, fields[2], 1, 31, &days, &any_day);
+    parse_field(expression, fields[3], 1, 12, &months, &any);
+    parse_field(expression, fields[4], 0, 7, &weekdays, &any_weekday);
+    if (weekdays[7])
+        weekdays[0] = true;
+}
+
+bool cron_schedule::day_matches(const struct tm& t) const
+{
+    bool d = days[t.tm_mday];
+    bool w = weekdays[t.tm_wday];
+    if (any_day || any_weekday)
+        return d && w;
+    return d || w;
+}
+
+bool cron_schedule::matches(const struct tm& t) const
+{
+    return minutes[t.tm_min] && hours[t.tm_hour] && day_matches(t) &&
+        months[t.tm_mon + 1];
+}
+
+// Returns the first time after the specified time, to the minute, that
+// matches the schedule, or -1 if none is found within five years.
+time_t cron_schedule::next(time_t after) const
+{
+    struct tm t;
+    localtime_r(&after, &t);
+    t.tm_sec = 0;
+    t.tm_min++;
+    t.tm_isdst = -1;
+    int last_year = t.tm_year + 5;
+    while (true) {
+        time_t time = mktime(&t);
+        if (time == -1 || t.tm_year > last_year)
+            return -1;
+        if (!months[t.tm_mon + 1]) {
+            t.tm_mon++;
+            t.tm_mday = 1;
+            t.tm_hour = 0;
+            t.tm_min = 0;
+        } else if (!day_matches(t)) {
+            t.tm_mday++;
+            t.tm_hour = 0;
+            t.tm_min = 0;
+        } else if (!hours[t.tm_hour]) {
+            t.tm_hour++;
+            t.tm_min = 0;
+        } else if (!minutes[t.tm_min]) {
+            t.tm_min++;
+        } else {
+            return time;
+        }
+        t.tm_isdst = -1;
+    }
+}
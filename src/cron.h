@@ -0,0 +1,32 @@
+#ifndef LDP_CRON_H
+#define LDP_CRON_H
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Schedule defined by a cron expression of five fields: minute, hour,
+// day of month, month, and day of week.  Each field is "*", a number,
+// a range "a-b", or a comma-separated list of these, and "*" or a
+// range may be followed by a step "/n".  Day of week 0 or 7 is Sunday.
+// As in cron, if both day fields are restricted, a day matches if
+// either field matches.  Times are in the local time zone.
+class cron_schedule {
+public:
+    explicit cron_schedule(const string& expression);
+    bool matches(const struct tm& t) const;
+    time_t next(time_t after) const;
+private:
+    vector<bool> minutes;
+    vector<bool> hours;
+    vector<bool> days;
+    vector<bool> months;
+    vector<bool> weekdays;
+    bool any_day = false;
+    bool any_weekday = false;
+    bool day_matches(const struct tm& t) const;
+};
+
+#endif
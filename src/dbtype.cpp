@@ -37,6 +37,18 @@ const char* dbtype::json_type() const
     }
 }
 
+const char* dbtype::hash_type() const
+{
+    switch (dbt) {
+    case dbsys::postgresql:
+	return "UUID";
+    case dbsys::redshift:
+	return "CHAR(32)";
+    default:
+	return "(unknown)";
+    }
+}
+
 const char* dbtype::current_timestamp() const
 {
     switch (dbt) {
@@ -13,6 +13,7 @@ class dbtype {
 public:
     dbtype(etymon::odbc_conn* conn);
     const char* json_type() const;
+    const char* hash_type() const;
     const char* current_timestamp() const;
     void rename_sequence(const string& sequence_name,
         const string& new_sequence_name, string* sql) const;
@@ -1,5 +1,8 @@
+#include <vector>
+
 #include "dbup1.h"
 #include "initutil.h"
+#include "partition.h"
 
 void ulog_sql(const string& sql, database_upgrade_options* opt)
 {
@@ -31,6 +34,33 @@ void add_table_to_catalog_sql_dbsystem(etymon::odbc_conn* conn,
         "    ('" + table + "');";
 }
 
+void select_catalog_tables(etymon::odbc_conn* conn, vector<string>* tables)
+{
+    tables->clear();
+    string sql = "SELECT table_name FROM dbsystem.tables ORDER BY table_name;";
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    while (conn->fetch(&stmt)) {
+        string table;
+        conn->get_data(&stmt, 1, &table);
+        tables->push_back(table);
+    }
+}
+
+bool column_exists(etymon::odbc_conn* conn, const string& schema,
+                   const string& table, const string& column)
+{
+    string sql =
+        "SELECT 1\n"
+        "    FROM information_schema.columns\n"
+        "    WHERE table_schema = '" + schema + "' AND\n"
+        "          table_name = '" + table + "' AND\n"
+        "          column_name = '" + column + "';";
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    return conn->fetch(&stmt);
+}
+
 void upgrade_add_new_table_ldpsystem(const string& table,
                                      database_upgrade_options* opt,
                                      const dbtype& dbt)
@@ -106,6 +136,59 @@ void upgrade_add_new_table_dbsystem(const string& table,
     if (autocommit)
         ulog_commit(opt);
 
+    create_history_latest_index_sql(table, opt->conn, dbt, &sql);
+    if (sql != "") {
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+        if (autocommit)
+            ulog_commit(opt);
+    }
+
+    create_history_changed_fields_index_sql(table, opt->conn, dbt, &sql);
+    if (sql != "") {
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+        if (autocommit)
+            ulog_commit(opt);
+    }
+
+    create_history_versions_view_sql(table, opt->conn, dbt, &sql);
+    if (sql != "") {
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+        if (autocommit)
+            ulog_commit(opt);
+        grant_select_on_table_sql("history." + table + "_versions",
+                                  opt->ldp_user, opt->conn, &sql);
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+        if (autocommit)
+            ulog_commit(opt);
+        grant_select_on_table_sql("history." + table + "_versions",
+                                  opt->ldpconfig_user, opt->conn, &sql);
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+        if (autocommit)
+            ulog_commit(opt);
+    }
+
+    vector<string> sqls;
+    create_history_as_of_indexes_sql(table, opt->conn, dbt, &sqls);
+    for (auto& s : sqls) {
+        ulog_sql(s, opt);
+        opt->conn->exec(s);
+        if (autocommit)
+            ulog_commit(opt);
+    }
+
+    create_history_as_of_function_sql(table, opt->conn, dbt, &sql);
+    if (sql != "") {
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+        if (autocommit)
+            ulog_commit(opt);
+    }
+
     grant_select_on_table_sql("history." + table, opt->ldp_user, opt->conn,
                               &sql);
     ulog_sql(sql, opt);
@@ -1373,3 +1456,713 @@ void database_upgrade_20(database_upgrade_options* opt)
     tx.commit();
     ulog_commit(opt);
 }
+
+void database_upgrade_21(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    etymon::odbc_tx tx(opt->conn);
+
+    // Mark the latest version of each record in the history tables, so
+    // that the merge no longer has to search the entire history.
+
+    vector<string> tables;
+    select_catalog_tables(opt->conn, &tables);
+
+    for (auto& table : tables) {
+        string sql;
+        if (!column_exists(opt->conn, "history", table, "latest")) {
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    ADD COLUMN latest BOOLEAN NOT NULL DEFAULT FALSE;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql =
+                "UPDATE history." + table + " AS h1\n"
+                "    SET latest = TRUE\n"
+                "    WHERE NOT EXISTS\n"
+                "      ( SELECT 1\n"
+                "            FROM history." + table + " AS h2\n"
+                "            WHERE h1.tenant_id = h2.tenant_id AND\n"
+                "                  h1.id = h2.id AND\n"
+                "                  h1.updated < h2.updated\n"
+                "      );";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+        }
+
+        if (dbt.type() == dbsys::postgresql) {
+            sql =
+                "CREATE INDEX IF NOT EXISTS\n"
+                "    history_" + table + "_latest\n"
+                "    ON history." + table + " (tenant_id, id)\n"
+                "    WHERE latest;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+        }
+    }
+
+    string sql = "UPDATE dbsystem.main SET database_version = 21;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_22(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    etymon::odbc_tx tx(opt->conn);
+
+    // Add content hashes to the history tables.  Existing versions are
+    // left without a hash and are filled in by the merge process when
+    // the data are next compared.
+
+    vector<string> tables;
+    select_catalog_tables(opt->conn, &tables);
+
+    for (auto& table : tables) {
+        string sql;
+        if (!column_exists(opt->conn, "history", table, "data_hash")) {
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    ADD COLUMN data_hash " + dbt.hash_type() + ";";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+        }
+
+        if (dbt.type() == dbsys::postgresql) {
+            sql = "DROP INDEX IF EXISTS history.history_" + table + "_latest;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+        }
+
+        create_history_latest_index_sql(table, opt->conn, dbt, &sql);
+        if (sql != "") {
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+        }
+    }
+
+    string sql = "UPDATE dbsystem.main SET database_version = 22;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_23(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    etymon::odbc_tx tx(opt->conn);
+
+    string rskeys;
+    dbt.redshift_keys("table_name", "table_name, tenant_id", &rskeys);
+    string sql =
+        "CREATE TABLE dbsystem.change_index (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    tenant_id SMALLINT NOT NULL,\n"
+        "    stamp BIGINT NOT NULL,\n"
+        "        PRIMARY KEY (table_name, tenant_id)\n"
+        ")" + rskeys + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "UPDATE dbsystem.main SET database_version = 23;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_24(database_upgrade_options* opt)
+{
+    etymon::odbc_tx tx(opt->conn);
+
+    string sql = "CREATE SCHEMA ldp_shadow;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "UPDATE dbsystem.main SET database_version = 24;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_25(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    // Each step is committed separately so that converting large history
+    // tables does not hold locks on all of them at once.  Steps that have
+    // already been committed are skipped if the upgrade is run again.
+    string sql;
+    if (!column_exists(opt->conn, "dbconfig", "general",
+                       "history_partition_interval")) {
+        etymon::odbc_tx tx(opt->conn);
+        sql =
+            "ALTER TABLE dbconfig.general\n"
+            "    ADD COLUMN history_partition_interval VARCHAR(63)\n"
+            "    NOT NULL DEFAULT 'month';";
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+        tx.commit();
+        ulog_commit(opt);
+    }
+
+    // In PostgreSQL, convert history tables to tables partitioned by
+    // updated, with monthly partitions covering the existing data.  Each
+    // table is converted in its own transaction.
+    if (dbt.type() == dbsys::postgresql) {
+        vector<string> tables;
+        select_catalog_tables(opt->conn, &tables);
+        for (auto& table : tables) {
+            string relkind;
+            sql =
+                "SELECT c.relkind\n"
+                "    FROM pg_class AS c\n"
+                "        JOIN pg_namespace AS n ON n.oid = c.relnamespace\n"
+                "    WHERE n.nspname = 'history' AND\n"
+                "          c.relname = '" + table + "';";
+            {
+                etymon::odbc_stmt stmt(opt->conn);
+                opt->conn->exec_direct(&stmt, sql);
+                if (opt->conn->fetch(&stmt))
+                    opt->conn->get_data(&stmt, 1, &relkind);
+            }
+            if (relkind != "r")
+                continue;
+
+            etymon::odbc_tx tx(opt->conn);
+
+            sql = "DROP INDEX IF EXISTS history.history_" + table + "_latest;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    RENAME CONSTRAINT history_" + table + "_pkey\n"
+                "    TO history_" + table + "_old_pkey;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    RENAME TO " + table + "_old;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql =
+                "CREATE TABLE history." + table + " (\n"
+                "    id VARCHAR(36) NOT NULL,\n"
+                "    data JSONB NOT NULL,\n"
+                "    updated TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+                "    tenant_id SMALLINT NOT NULL,\n"
+                "    latest BOOLEAN NOT NULL DEFAULT FALSE,\n"
+                "    data_hash UUID,\n"
+                "    CONSTRAINT\n"
+                "        history_" + table + "_pkey\n"
+                "        PRIMARY KEY (id, updated)\n"
+                ")\n"
+                "    PARTITION BY RANGE (updated);";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            vector<string> statements;
+            ensure_history_partitions(opt->conn, table, "month",
+                    "(SELECT min(updated) FROM history." + table + "_old)",
+                    &statements);
+            for (auto& s : statements)
+                ulog_sql(s, opt);
+
+            sql =
+                "INSERT INTO history." + table + "\n"
+                "    (id, data, updated, tenant_id, latest, data_hash)\n"
+                "SELECT id, data, updated, tenant_id, latest, data_hash\n"
+                "    FROM history." + table + "_old;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql = "DROP TABLE history." + table + "_old;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql =
+                "CREATE INDEX history_" + table + "_latest\n"
+                "    ON history." + table + " (tenant_id, id, data_hash)\n"
+                "    WHERE latest;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql =
+                "GRANT SELECT ON history." + table + "\n"
+                "    TO " + opt->ldp_user + ";";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql =
+                "GRANT SELECT ON history." + table + "\n"
+                "    TO " + opt->ldpconfig_user + ";";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            tx.commit();
+            ulog_commit(opt);
+        }
+    }
+
+    etymon::odbc_tx tx(opt->conn);
+
+    sql = "UPDATE dbsystem.main SET database_version = 25;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_26(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    etymon::odbc_tx tx(opt->conn);
+
+    string sql =
+        "ALTER TABLE dbconfig.general\n"
+        "    ADD COLUMN history_keyframe_interval INTEGER NOT NULL DEFAULT 0;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    // In PostgreSQL, add columns for delta encoding to the history
+    // tables.  Existing versions retain their data in full.
+    if (dbt.type() == dbsys::postgresql) {
+        vector<string> sqls;
+        create_history_delta_functions_sql(opt->conn, dbt, &sqls);
+        for (auto& s : sqls) {
+            ulog_sql(s, opt);
+            opt->conn->exec(s);
+        }
+
+        vector<string> tables;
+        select_catalog_tables(opt->conn, &tables);
+        for (auto& table : tables) {
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    ALTER COLUMN data DROP NOT NULL;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            if (!column_exists(opt->conn, "history", table, "delta")) {
+                sql =
+                    "ALTER TABLE history." + table + "\n"
+                    "    ADD COLUMN delta JSONB,\n"
+                    "    ADD COLUMN changed_fields TEXT[],\n"
+                    "    ADD COLUMN delta_seq INTEGER;";
+                ulog_sql(sql, opt);
+                opt->conn->exec(sql);
+            }
+
+            create_history_changed_fields_index_sql(table, opt->conn, dbt,
+                                                    &sql);
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            create_history_versions_view_sql(table, opt->conn, dbt, &sql);
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            grant_select_on_table_sql("history." + table + "_versions",
+                                      opt->ldp_user, opt->conn, &sql);
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            grant_select_on_table_sql("history." + table + "_versions",
+                                      opt->ldpconfig_user, opt->conn, &sql);
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+        }
+    }
+
+    sql = "UPDATE dbsystem.main SET database_version = 26;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_27(database_upgrade_options* opt)
+{
+    etymon::odbc_tx tx(opt->conn);
+
+    string sql =
+        "CREATE TABLE dbconfig.history_retention (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    remove_duplicates BOOLEAN NOT NULL DEFAULT TRUE,\n"
+        "    thin_after_days INTEGER,\n"
+        "    thin_interval VARCHAR(63) NOT NULL DEFAULT 'day',\n"
+        "    archive BOOLEAN NOT NULL DEFAULT TRUE\n"
+        ");";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql =
+        "GRANT SELECT ON dbconfig.history_retention\n"
+        "    TO " + opt->ldp_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql =
+        "GRANT SELECT, INSERT, UPDATE, DELETE ON dbconfig.history_retention\n"
+        "    TO " + opt->ldpconfig_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "UPDATE dbsystem.main SET database_version = 27;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_28(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    etymon::odbc_tx tx(opt->conn);
+
+    // Add validity ranges to the history tables.  Each version is valid
+    // from the time it was added until the next version was added.
+
+    vector<string> tables;
+    select_catalog_tables(opt->conn, &tables);
+
+    for (auto& table : tables) {
+        string sql;
+        if (!column_exists(opt->conn, "history", table, "valid_from")) {
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    ADD COLUMN valid_from TIMESTAMP WITH TIME ZONE;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    ADD COLUMN valid_to TIMESTAMP WITH TIME ZONE;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+
+            sql =
+                "UPDATE history." + table + " AS h\n"
+                "    SET valid_from = n.updated,\n"
+                "        valid_to = n.next_updated\n"
+                "    FROM (SELECT tenant_id,\n"
+                "                 id,\n"
+                "                 updated,\n"
+                "                 lead(updated)\n"
+                "                     OVER (PARTITION BY tenant_id, id\n"
+                "                           ORDER BY updated) AS next_updated\n"
+                "              FROM history." + table + ") AS n\n"
+                "    WHERE h.tenant_id = n.tenant_id AND\n"
+                "          h.id = n.id AND\n"
+                "          h.updated = n.updated;";
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+        }
+
+        vector<string> sqls;
+        create_history_as_of_indexes_sql(table, opt->conn, dbt, &sqls);
+        for (auto& s : sqls) {
+            ulog_sql(s, opt);
+            opt->conn->exec(s);
+        }
+
+        create_history_as_of_function_sql(table, opt->conn, dbt, &sql);
+        if (sql != "") {
+            ulog_sql(sql, opt);
+            opt->conn->exec(sql);
+        }
+    }
+
+    string sql = "UPDATE dbsystem.main SET database_version = 28;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_29(database_upgrade_options* opt)
+{
+    etymon::odbc_tx tx(opt->conn);
+
+    // History row counts are now maintained incrementally.  Clear the
+    // existing counts, which may not reflect history compaction, so
+    // that each history table is counted once more at its next update.
+
+    string sql =
+        "UPDATE dbsystem.tables\n"
+        "    SET history_row_count = NULL;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "UPDATE dbsystem.main SET database_version = 29;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_30(database_upgrade_options* opt)
+{
+    etymon::odbc_tx tx(opt->conn);
+
+    // Record the duration of each phase of a table update, which is
+    // used to schedule the next update.
+
+    for (auto column : {"extract_time", "stage_time", "merge_time"}) {
+        string sql =
+            "ALTER TABLE dbsystem.tables\n"
+            "    ADD COLUMN " + string(column) + " REAL;";
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+    }
+
+    string sql = "UPDATE dbsystem.main SET database_version = 30;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_31(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    etymon::odbc_tx tx(opt->conn);
+
+    // Queue of table update jobs for distributed updates.
+
+    string rskeys;
+    dbt.redshift_keys("table_name", "table_name", &rskeys);
+    string sql =
+        "CREATE TABLE dbsystem.jobs (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    run_id BIGINT NOT NULL,\n"
+        "    estimated_time REAL,\n"
+        "    status VARCHAR(7) NOT NULL,\n"
+        "    worker VARCHAR(255) NOT NULL DEFAULT '',\n"
+        "    attempts INTEGER NOT NULL DEFAULT 0,\n"
+        "    heartbeat TIMESTAMP WITH TIME ZONE,\n"
+        "    replaced BOOLEAN,\n"
+        "    row_count BIGINT,\n"
+        "    history_row_count BIGINT,\n"
+        "        PRIMARY KEY (table_name)\n"
+        ")" + rskeys + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "GRANT SELECT ON dbsystem.jobs TO " + opt->ldp_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+    sql = "GRANT SELECT ON dbsystem.jobs TO " + opt->ldpconfig_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "UPDATE dbsystem.main SET database_version = 31;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_32(database_upgrade_options* opt)
+{
+    etymon::odbc_tx tx(opt->conn);
+
+    // Schedules for refreshing individual tables.
+
+    string sql =
+        "CREATE TABLE dbconfig.table_schedule (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    schedule VARCHAR(63) NOT NULL,\n"
+        "    enable_schedule BOOLEAN NOT NULL DEFAULT TRUE\n"
+        ");";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql =
+        "GRANT SELECT ON dbconfig.table_schedule\n"
+        "    TO " + opt->ldp_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql =
+        "GRANT SELECT, INSERT, UPDATE, DELETE ON dbconfig.table_schedule\n"
+        "    TO " + opt->ldpconfig_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "UPDATE dbsystem.main SET database_version = 32;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_33(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    etymon::odbc_tx tx(opt->conn);
+
+    // Target staleness of each table, and the staleness achieved.
+
+    string sql =
+        "ALTER TABLE dbconfig.table_schedule\n"
+        "    ADD COLUMN target_staleness INTEGER;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    string rskeys;
+    dbt.redshift_keys("table_name", "updated", &rskeys);
+    sql =
+        "CREATE TABLE dbsystem.table_freshness (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    updated TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    staleness REAL,\n"
+        "    target_staleness INTEGER\n"
+        ")" + rskeys + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "GRANT SELECT ON dbsystem.table_freshness TO " + opt->ldp_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+    sql = "GRANT SELECT ON dbsystem.table_freshness TO " +
+        opt->ldpconfig_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "UPDATE dbsystem.main SET database_version = 33;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_34(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    etymon::odbc_tx tx(opt->conn);
+
+    // Journal of full updates, used to resume an update that did not
+    // complete.
+
+    string rskeys;
+    dbt.redshift_keys("run_id", "run_id", &rskeys);
+    string sql =
+        "CREATE TABLE dbsystem.update_runs (\n"
+        "    run_id BIGINT NOT NULL,\n"
+        "    selection VARCHAR(63) NOT NULL,\n"
+        "    status VARCHAR(9) NOT NULL,\n"
+        "    started TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    completed TIMESTAMP WITH TIME ZONE,\n"
+        "    resumes INTEGER NOT NULL DEFAULT 0,\n"
+        "        PRIMARY KEY (run_id)\n"
+        ")" + rskeys + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    dbt.redshift_keys("table_name", "run_id", &rskeys);
+    sql =
+        "CREATE TABLE dbsystem.run_journal (\n"
+        "    run_id BIGINT NOT NULL,\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    phase VARCHAR(7) NOT NULL,\n"
+        "    completed TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    duration REAL,\n"
+        "    merge_mode VARCHAR(7),\n"
+        "    record_count BIGINT,\n"
+        "    replaced BOOLEAN,\n"
+        "    row_count BIGINT,\n"
+        "    history_row_count BIGINT,\n"
+        "        PRIMARY KEY (run_id, table_name, phase)\n"
+        ")" + rskeys + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    for (auto table : {"update_runs", "run_journal"}) {
+        sql = "GRANT SELECT ON dbsystem." + string(table) + " TO " +
+            opt->ldp_user + ";";
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+        sql = "GRANT SELECT ON dbsystem." + string(table) + " TO " +
+            opt->ldpconfig_user + ";";
+        ulog_sql(sql, opt);
+        opt->conn->exec(sql);
+    }
+
+    sql = "UPDATE dbsystem.main SET database_version = 34;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
+
+void database_upgrade_35(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    etymon::odbc_tx tx(opt->conn);
+
+    // Measurements of each phase of each table in an update.
+
+    string rskeys;
+    dbt.redshift_keys("table_name", "run_id", &rskeys);
+    string sql =
+        "CREATE TABLE dbsystem.perf (\n"
+        "    run_id BIGINT NOT NULL,\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    phase VARCHAR(7) NOT NULL,\n"
+        "    started TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    wall_time REAL NOT NULL,\n"
+        "    cpu_time REAL NOT NULL,\n"
+        "    records BIGINT NOT NULL,\n"
+        "    bytes_in BIGINT NOT NULL,\n"
+        "    bytes_out BIGINT NOT NULL,\n"
+        "    round_trips BIGINT NOT NULL\n"
+        ")" + rskeys + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "GRANT SELECT ON dbsystem.perf TO " + opt->ldp_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+    sql = "GRANT SELECT ON dbsystem.perf TO " + opt->ldpconfig_user + ";";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    sql = "UPDATE dbsystem.main SET database_version = 35;";
+    ulog_sql(sql, opt);
+    opt->conn->exec(sql);
+
+    tx.commit();
+    ulog_commit(opt);
+}
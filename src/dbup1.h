@@ -23,6 +23,21 @@ void database_upgrade_17(database_upgrade_options* opt);
 void database_upgrade_18(database_upgrade_options* opt);
 void database_upgrade_19(database_upgrade_options* opt);
 void database_upgrade_20(database_upgrade_options* opt);
+void database_upgrade_21(database_upgrade_options* opt);
+void database_upgrade_22(database_upgrade_options* opt);
+void database_upgrade_23(database_upgrade_options* opt);
+void database_upgrade_24(database_upgrade_options* opt);
+void database_upgrade_25(database_upgrade_options* opt);
+void database_upgrade_26(database_upgrade_options* opt);
+void database_upgrade_27(database_upgrade_options* opt);
+void database_upgrade_28(database_upgrade_options* opt);
+void database_upgrade_29(database_upgrade_options* opt);
+void database_upgrade_30(database_upgrade_options* opt);
+void database_upgrade_31(database_upgrade_options* opt);
+void database_upgrade_32(database_upgrade_options* opt);
+void database_upgrade_33(database_upgrade_options* opt);
+void database_upgrade_34(database_upgrade_options* opt);
+void database_upgrade_35(database_upgrade_options* opt);
 
 void ulog_sql(const string& sql, database_upgrade_options* opt);
 void ulog_commit(database_upgrade_options* opt);
@@ -1,3 +1,4 @@
+#include <atomic>
 #include <cassert>
 #include <cstring>
 #include <ctype.h>
@@ -9,14 +10,19 @@
 #include <unistd.h>
 
 #include "../etymoncpp/include/postgres.h"
+#include "../etymoncpp/include/trace.h"
 #include "../etymoncpp/include/util.h"
 #include "extract.h"
+#include "metrics.h"
 #include "paging.h"
 #include "timer.h"
 #include "util.h"
 
 static const int curl_timeout_seconds = 60L;
 
+// Number of pages fetched by this process, shown in traces.
+static atomic<int64_t> pages_fetched(0);
+
 extraction_files::~extraction_files()
 {
     if (!opt.savetemps) {
@@ -39,6 +45,8 @@ extraction_files::~extraction_files()
 curl_wrapper::curl_wrapper()
 {
     curl = curl_easy_init();
+    // Timeouts must not use signals, which are not safe in threads.
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
     headers = NULL;
 }
 
@@ -48,6 +56,16 @@ curl_wrapper::~curl_wrapper()
     curl_easy_cleanup(curl);
 }
 
+// Clears the options and headers so that the handle can be reused,
+// while keeping its open connections.
+void curl_wrapper::reset()
+{
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_slist_free_all(headers);
+    headers = NULL;
+}
+
 void encodeLogin(const string& okapiUser, const string& okapiPassword,
         string* login)
 {
@@ -203,16 +221,27 @@ static PageStatus retrieve(const curl_wrapper& c, const ldp_options& opt,
             throw runtime_error(string("Error extracting data: ") +
                                 curl_easy_strerror(cc));
 
-        lg->write(log_level::detail, "", "",
-                "Retrieving from:\n"
-                "    Path: " + table.source_spec + "\n"
-                "    Query: " + query, -1);
+        if (lg->enabled(log_level::detail))
+            lg->write(log_level::detail, "", "",
+                    "Retrieving from:\n"
+                    "    Path: " + table.source_spec + "\n"
+                    "    Query: " + query, -1);
 
-        cc = curl_easy_perform(c.curl);
+        {
+            etymon::trace_span span("http", "fetch_page", "url", path);
+            cc = curl_easy_perform(c.curl);
+        }
         if (cc != CURLE_OK)
             throw runtime_error(string("Error extracting data: ") +
                                 curl_easy_strerror(cc));
     }
+    etymon::trace_counter("pages_fetched", ++pages_fetched);
+
+    if (opt.metrics != nullptr) {
+        double seconds = 0;
+        curl_easy_getinfo(c.curl, CURLINFO_TOTAL_TIME, &seconds);
+        opt.metrics->record_http_request(seconds);
+    }
 
     long response_code = 0;
     curl_easy_getinfo(c.curl, CURLINFO_RESPONSE_CODE, &response_code);
@@ -259,8 +288,9 @@ bool retrieve_pages(const curl_wrapper& c, const ldp_options& opt,
 {
     size_t page = 0;
     while (true) {
-        lg->write(log_level::detail, "", "",
-                "Extracting page: " + to_string(page), -1);
+        if (lg->enabled(log_level::detail))
+            lg->write(log_level::detail, "", "",
+                    "Extracting page: " + to_string(page), -1);
         PageStatus status = retrieve(c, opt, source, lg, token, table, loadDir,
                                      ext_files, page);
         switch (status) {
@@ -348,3 +378,37 @@ bool retrieve_direct(const data_source& source, ldp_log* lg,
     return true;
 }
 
+
+// Adds the files that an earlier update extracted for a table from a
+// source, so that they can be staged without extracting the data again.
+// Returns false if the count file or any page is missing.
+bool find_extracted_files(const data_source& source, const string& loadDir,
+                          const string& tableName,
+                          extraction_files* ext_files)
+{
+    string prefix = loadDir;
+    etymon::join(&prefix, tableName);
+    prefix += "_" + source.source_name;
+    string count_file = prefix + "_count.txt";
+    if (access(count_file.c_str(), R_OK) != 0)
+        return false;
+    size_t count;
+    {
+        etymon::file f(count_file, "r");
+        int r = fscanf(f.fp, "%zu", &count);
+        if (r < 1 || r == EOF)
+            return false;
+    }
+    ext_files->files.push_back(count_file);
+    // The empty page that ends a paged extraction is also removed.
+    for (size_t page = 0; page <= count; page++) {
+        string output = prefix + "_" + to_string(page) + ".json";
+        if (access(output.c_str(), R_OK) != 0) {
+            if (page < count)
+                return false;
+            continue;
+        }
+        ext_files->files.push_back(output);
+    }
+    return true;
+}
@@ -21,6 +21,7 @@ public:
     struct curl_slist* headers;
     curl_wrapper();
     ~curl_wrapper();
+    void reset();
 };
 
 void okapi_login(const ldp_options& opt, const data_source& source,
@@ -34,6 +35,9 @@ bool retrieve_pages(const curl_wrapper& c, const ldp_options& opt,
                     const data_source& source, ldp_log* lg,
                     const string& token, const table_schema& table,
                     const string& loadDir, extraction_files* ext_files);
+bool find_extracted_files(const data_source& source, const string& loadDir,
+                          const string& tableName,
+                          extraction_files* ext_files);
 
 #endif
 
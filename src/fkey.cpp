@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "changeidx.h"
+#include "fkey.h"
+
+void id_set::add(const char* id)
+{
+    uuid_bytes b;
+    if (parse_uuid(id, b.data()))
+        ids.push_back(b);
+}
+
+void id_set::finish()
+{
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    ids.shrink_to_fit();
+}
+
+bool id_set::contains(const uuid_bytes& id) const
+{
+    return binary_search(ids.begin(), ids.end(), id);
+}
+
+id_sample::id_sample(size_t capacity) : capacity(capacity)
+{
+}
+
+// Adds a value to the sample using reservoir sampling, so that every
+// value seen has the same probability of being in the sample.
+void id_sample::add(const char* value)
+{
+    uuid_bytes b;
+    if (!parse_uuid(value, b.data()))
+        return;
+    seen++;
+    if (sample.size() < capacity) {
+        sample.push_back(b);
+        return;
+    }
+    uniform_int_distribution<size_t> dist(0, seen - 1);
+    size_t x = dist(rng);
+    if (x < capacity)
+        sample[x] = b;
+}
+
+// Selects the names of the id-typed columns of a table, other than id.
+static void select_id_columns(etymon::odbc_conn* conn, ldp_log* lg,
+                              const string& table, vector<string>* columns)
+{
+    string sql =
+        "SELECT column_name\n"
+        "    FROM information_schema.columns\n"
+        "    WHERE table_schema = 'public' AND\n"
+        "          table_name = '" + table + "' AND\n"
+        "          data_type = 'character varying' AND\n"
+        "          character_maximum_length = 36 AND\n"
+        "          column_name <> 'id'\n"
+        "    ORDER BY column_name;";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    string column;
+    while (conn->fetch(&stmt)) {
+        conn->get_data(&stmt, 1, &column);
+        columns->push_back(column);
+    }
+}
+
+// Reads the ids of a table that was not staged during the current
+// update, and samples the values of its id-typed columns as staging
+// would.  If the table cannot be read, e.g. because it does not exist,
+// the ids and samples are left empty.
+void select_table_ids(etymon::odbc_conn* conn, ldp_log* lg,
+                      const string& table, table_ids* tids)
+{
+    try {
+        vector<string> columns;
+        select_id_columns(conn, lg, table, &columns);
+        string sql = "SELECT id";
+        for (auto& column : columns)
+            sql += ", \"" + column + "\"";
+        sql += " FROM " + table + ";";
+        lg->detail(sql);
+        etymon::odbc_stmt stmt(conn);
+        conn->exec_direct(&stmt, sql);
+        string value;
+        while (conn->fetch(&stmt)) {
+            conn->get_data(&stmt, 1, &value);
+            tids->ids.add(value.c_str());
+            for (size_t x = 0; x < columns.size(); x++) {
+                conn->get_data(&stmt, x + 2, &value);
+                tids->samples[columns[x]].add(value.c_str());
+            }
+        }
+    } catch (runtime_error& e) {
+        string s = e.what();
+        if ( !(s.empty()) && s.back() == '\n' )
+            s.pop_back();
+        lg->detail(s);
+    }
+}
+
+// Suggests a foreign key from each sampled column to each table that
+// contains any of the sampled values.  The results are keyed by
+// referencing table and column.
+void suggest_foreign_keys(map<string, table_ids>* tables,
+                          map<string, vector<reference>>* refs)
+{
+    for (auto& [table, tids] : *tables)
+        tids.ids.finish();
+    for (auto& [table, tids] : *tables) {
+        for (auto& [column, sample] : tids.samples) {
+            for (auto& [table1, tids1] : *tables) {
+                for (auto& value : sample.values()) {
+                    if (tids1.ids.contains(value)) {
+                        reference ref;
+                        ref.referencing_table = table;
+                        ref.referencing_column = column;
+                        ref.referenced_table = table1;
+                        ref.referenced_column = "id";
+                        (*refs)[table + "." + column].push_back(ref);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef LDP_FKEY_H
+#define LDP_FKEY_H
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../etymoncpp/include/odbc.h"
+#include "log.h"
+
+using namespace std;
+
+class reference {
+public:
+    string referencing_table;
+    string referencing_column;
+    string referenced_table;
+    string referenced_column;
+    string constraint_name;
+};
+
+typedef array<uint8_t, 16> uuid_bytes;
+
+// Set of the ids of the records in a table, stored as a sorted array
+// of 128-bit UUIDs.  Ids that are not UUIDs are ignored.  finish() must
+// be called after the ids have been added and before contains().
+class id_set {
+public:
+    void add(const char* id);
+    void finish();
+    bool contains(const uuid_bytes& id) const;
+    size_t size() const { return ids.size(); }
+private:
+    vector<uuid_bytes> ids;
+};
+
+// Uniform random sample of the UUID values of a column, of at most
+// capacity values.
+class id_sample {
+public:
+    explicit id_sample(size_t capacity = 1000);
+    void add(const char* value);
+    const vector<uuid_bytes>& values() const { return sample; }
+private:
+    size_t capacity;
+    size_t seen = 0;
+    vector<uuid_bytes> sample;
+    mt19937_64 rng;
+};
+
+// Ids of one table and samples of its id-typed columns, collected
+// while the table is staged or read from the database, for detecting
+// foreign keys.
+class table_ids {
+public:
+    id_set ids;
+    map<string, id_sample> samples;
+};
+
+void select_table_ids(etymon::odbc_conn* conn, ldp_log* lg,
+                      const string& table, table_ids* tids);
+
+void suggest_foreign_keys(map<string, table_ids>* tables,
+                          map<string, vector<reference>>* refs);
+
+#endif
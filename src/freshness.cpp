@@ -0,0 +1,92 @@
+#include "freshness.h"
+
+// Returns true if the table should be refreshed now, so that it is
+// updated before it exceeds its target staleness.  A table that has
+// never been updated is always due.
+bool table_freshness::refresh_due() const
+{
+    if (target < 0)
+        return false;
+    if (staleness < 0)
+        return true;
+    return staleness + (duration > 0 ? duration : 0) >= target;
+}
+
+// Returns true if the table can be left out of a full update, because
+// it will still be within its target staleness at the next one.
+bool table_freshness::skip_full_update() const
+{
+    if (target < 0 || staleness < 0)
+        return false;
+    return staleness + full_update_interval < target;
+}
+
+// Returns the staleness of the table as a fraction of its target, or 0
+// if it has no target.  Values of 1 or more mean the target has been
+// missed.
+double table_freshness::urgency() const
+{
+    if (target <= 0)
+        return 0;
+    if (staleness < 0)
+        return 1;
+    return staleness / target;
+}
+
+// Reads the staleness, target staleness, and last update duration of
+// each table that has a target staleness.
+void select_table_freshness(etymon::odbc_conn* conn, ldp_log* lg,
+                            const dbtype& dbt,
+                            map<string, table_freshness>* freshness)
+{
+    string sql =
+        "SELECT s.table_name,\n"
+        "       EXTRACT(EPOCH FROM " + string(dbt.current_timestamp()) +
+        ") -\n"
+        "           EXTRACT(EPOCH FROM t.updated),\n"
+        "       s.target_staleness,\n"
+        "       t.extract_time + t.stage_time + t.merge_time\n"
+        "    FROM dbconfig.table_schedule AS s\n"
+        "        LEFT JOIN dbsystem.tables AS t\n"
+        "            ON s.table_name = t.table_name\n"
+        "    WHERE s.enable_schedule AND s.target_staleness IS NOT NULL;";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    while (conn->fetch(&stmt)) {
+        string table, staleness, target, duration;
+        conn->get_data(&stmt, 1, &table);
+        conn->get_data(&stmt, 2, &staleness);
+        conn->get_data(&stmt, 3, &target);
+        conn->get_data(&stmt, 4, &duration);
+        table_freshness& f = (*freshness)[table];
+        f.staleness = (staleness == "NULL" ? -1 : stod(staleness));
+        f.target = stod(target) * 60;
+        f.duration = (duration == "NULL" ? -1 : stod(duration));
+    }
+}
+
+// Records the staleness of a table just before its update is
+// committed, which is the longest time its data were out of date, in
+// dbsystem.table_freshness.  This should be called in the transaction
+// that updates the table and before dbsystem.tables is updated.
+void record_table_freshness(etymon::odbc_conn* conn, ldp_log* lg,
+                            const dbtype& dbt, const string& table)
+{
+    string now = dbt.current_timestamp();
+    string sql =
+        "INSERT INTO dbsystem.table_freshness\n"
+        "    (table_name, updated, staleness, target_staleness)\n"
+        "SELECT table_name,\n"
+        "       " + now + ",\n"
+        "       EXTRACT(EPOCH FROM " + now + ") -\n"
+        "           EXTRACT(EPOCH FROM updated),\n"
+        "       (SELECT min(target_staleness)\n"
+        "            FROM dbconfig.table_schedule\n"
+        "            WHERE table_name = '" + table + "' AND\n"
+        "                enable_schedule)\n"
+        "    FROM dbsystem.tables\n"
+        "    WHERE table_name = '" + table + "';";
+    lg->detail(sql);
+    conn->exec(sql);
+}
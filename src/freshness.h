@@ -0,0 +1,36 @@
+#ifndef LDP_FRESHNESS_H
+#define LDP_FRESHNESS_H
+
+#include <map>
+#include <string>
+
+#include "../etymoncpp/include/odbc.h"
+#include "dbtype.h"
+#include "log.h"
+
+using namespace std;
+
+// Interval in seconds between full updates, assumed when deciding
+// whether a table can wait for the next one.
+const double full_update_interval = 86400;
+
+// Staleness of a table that has a target staleness in
+// dbconfig.table_schedule.  Times are in seconds, and staleness is the
+// time since the table was last updated.  Unknown values are -1.
+class table_freshness {
+public:
+    double staleness = -1;
+    double target = -1;
+    double duration = -1;
+    bool refresh_due() const;
+    bool skip_full_update() const;
+    double urgency() const;
+};
+
+void select_table_freshness(etymon::odbc_conn* conn, ldp_log* lg,
+                            const dbtype& dbt,
+                            map<string, table_freshness>* freshness);
+void record_table_freshness(etymon::odbc_conn* conn, ldp_log* lg,
+                            const dbtype& dbt, const string& table);
+
+#endif
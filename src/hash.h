@@ -0,0 +1,15 @@
+#ifndef LDP_HASH_H
+#define LDP_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+void murmur3_128(const void* key, size_t length, uint32_t seed,
+                 uint64_t* h1, uint64_t* h2);
+
+void data_hash(const char* data, size_t length, string* hash);
+
+#endif
@@ -12,7 +12,7 @@
 
 namespace fs = std::experimental::filesystem;
 
-static int64_t ldp_latest_database_version = 20;
+static int64_t ldp_latest_database_version = 35;
 
 database_upgrade_array database_upgrades[] = {
     nullptr,  // Version 0 has no migration.
@@ -35,7 +35,22 @@ database_upgrade_array database_upgrades[] = {
     database_upgrade_17,
     database_upgrade_18,
     database_upgrade_19,
-    database_upgrade_20
+    database_upgrade_20,
+    database_upgrade_21,
+    database_upgrade_22,
+    database_upgrade_23,
+    database_upgrade_24,
+    database_upgrade_25,
+    database_upgrade_26,
+    database_upgrade_27,
+    database_upgrade_28,
+    database_upgrade_29,
+    database_upgrade_30,
+    database_upgrade_31,
+    database_upgrade_32,
+    database_upgrade_33,
+    database_upgrade_34,
+    database_upgrade_35
 };
 
 int64_t latest_database_version()
@@ -198,7 +213,10 @@ static void init_database_all(etymon::odbc_conn* conn, const string& ldp_user,
         "    row_count BIGINT,\n"
         "    history_row_count BIGINT,\n"
         "    documentation VARCHAR(65535),\n"
-        "    documentation_url VARCHAR(65535)\n"
+        "    documentation_url VARCHAR(65535),\n"
+        "    extract_time REAL,\n"
+        "    stage_time REAL,\n"
+        "    merge_time REAL\n"
         ");";
     conn->exec(sql);
     // Add tables to the catalog.
@@ -233,6 +251,89 @@ static void init_database_all(etymon::odbc_conn* conn, const string& ldp_user,
         ")" + rskeys + ";";
     conn->exec(sql);
 
+    dbt.redshift_keys("table_name", "table_name, tenant_id", &rskeys);
+    sql =
+        "CREATE TABLE dbsystem.change_index (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    tenant_id SMALLINT NOT NULL,\n"
+        "    stamp BIGINT NOT NULL,\n"
+        "        PRIMARY KEY (table_name, tenant_id)\n"
+        ")" + rskeys + ";";
+    conn->exec(sql);
+
+    dbt.redshift_keys("table_name", "updated", &rskeys);
+    sql =
+        "CREATE TABLE dbsystem.table_freshness (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    updated TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    staleness REAL,\n"
+        "    target_staleness INTEGER\n"
+        ")" + rskeys + ";";
+    conn->exec(sql);
+
+    dbt.redshift_keys("table_name", "table_name", &rskeys);
+    sql =
+        "CREATE TABLE dbsystem.jobs (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    run_id BIGINT NOT NULL,\n"
+        "    estimated_time REAL,\n"
+        "    status VARCHAR(7) NOT NULL,\n"
+        "    worker VARCHAR(255) NOT NULL DEFAULT '',\n"
+        "    attempts INTEGER NOT NULL DEFAULT 0,\n"
+        "    heartbeat TIMESTAMP WITH TIME ZONE,\n"
+        "    replaced BOOLEAN,\n"
+        "    row_count BIGINT,\n"
+        "    history_row_count BIGINT,\n"
+        "        PRIMARY KEY (table_name)\n"
+        ")" + rskeys + ";";
+    conn->exec(sql);
+
+    dbt.redshift_keys("run_id", "run_id", &rskeys);
+    sql =
+        "CREATE TABLE dbsystem.update_runs (\n"
+        "    run_id BIGINT NOT NULL,\n"
+        "    selection VARCHAR(63) NOT NULL,\n"
+        "    status VARCHAR(9) NOT NULL,\n"
+        "    started TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    completed TIMESTAMP WITH TIME ZONE,\n"
+        "    resumes INTEGER NOT NULL DEFAULT 0,\n"
+        "        PRIMARY KEY (run_id)\n"
+        ")" + rskeys + ";";
+    conn->exec(sql);
+
+    dbt.redshift_keys("table_name", "run_id", &rskeys);
+    sql =
+        "CREATE TABLE dbsystem.run_journal (\n"
+        "    run_id BIGINT NOT NULL,\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    phase VARCHAR(7) NOT NULL,\n"
+        "    completed TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    duration REAL,\n"
+        "    merge_mode VARCHAR(7),\n"
+        "    record_count BIGINT,\n"
+        "    replaced BOOLEAN,\n"
+        "    row_count BIGINT,\n"
+        "    history_row_count BIGINT,\n"
+        "        PRIMARY KEY (run_id, table_name, phase)\n"
+        ")" + rskeys + ";";
+    conn->exec(sql);
+
+    dbt.redshift_keys("table_name", "run_id", &rskeys);
+    sql =
+        "CREATE TABLE dbsystem.perf (\n"
+        "    run_id BIGINT NOT NULL,\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    phase VARCHAR(7) NOT NULL,\n"
+        "    started TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    wall_time REAL NOT NULL,\n"
+        "    cpu_time REAL NOT NULL,\n"
+        "    records BIGINT NOT NULL,\n"
+        "    bytes_in BIGINT NOT NULL,\n"
+        "    bytes_out BIGINT NOT NULL,\n"
+        "    round_trips BIGINT NOT NULL\n"
+        ")" + rskeys + ";";
+    conn->exec(sql);
+
     //sql = "GRANT SELECT ON ALL TABLES IN SCHEMA dbsystem TO " + ldp_user + ";";
     //conn->exec(sql);
     //sql = "GRANT SELECT ON ALL TABLES IN SCHEMA dbsystem TO " +
@@ -263,6 +364,32 @@ static void init_database_all(etymon::odbc_conn* conn, const string& ldp_user,
     sql = "GRANT SELECT ON dbsystem.tables TO " + ldpconfig_user + ";";
     conn->exec(sql);
 
+    sql = "GRANT SELECT ON dbsystem.table_freshness TO " + ldp_user + ";";
+    conn->exec(sql);
+    sql = "GRANT SELECT ON dbsystem.table_freshness TO " + ldpconfig_user +
+        ";";
+    conn->exec(sql);
+
+    sql = "GRANT SELECT ON dbsystem.jobs TO " + ldp_user + ";";
+    conn->exec(sql);
+    sql = "GRANT SELECT ON dbsystem.jobs TO " + ldpconfig_user + ";";
+    conn->exec(sql);
+
+    sql = "GRANT SELECT ON dbsystem.update_runs TO " + ldp_user + ";";
+    conn->exec(sql);
+    sql = "GRANT SELECT ON dbsystem.update_runs TO " + ldpconfig_user + ";";
+    conn->exec(sql);
+
+    sql = "GRANT SELECT ON dbsystem.run_journal TO " + ldp_user + ";";
+    conn->exec(sql);
+    sql = "GRANT SELECT ON dbsystem.run_journal TO " + ldpconfig_user + ";";
+    conn->exec(sql);
+
+    sql = "GRANT SELECT ON dbsystem.perf TO " + ldp_user + ";";
+    conn->exec(sql);
+    sql = "GRANT SELECT ON dbsystem.perf TO " + ldpconfig_user + ";";
+    conn->exec(sql);
+
     // Schema: dbconfig
 
     sql = "CREATE SCHEMA dbconfig;";
@@ -280,7 +407,9 @@ static void init_database_all(etymon::odbc_conn* conn, const string& ldp_user,
         "    next_full_update TIMESTAMP WITH TIME ZONE NOT NULL,\n"
         "    detect_foreign_keys BOOLEAN NOT NULL DEFAULT FALSE,\n"
         "    enable_foreign_key_warnings BOOLEAN NOT NULL DEFAULT FALSE,\n"
-        "    force_foreign_key_constraints BOOLEAN NOT NULL DEFAULT FALSE\n"
+        "    force_foreign_key_constraints BOOLEAN NOT NULL DEFAULT FALSE,\n"
+        "    history_partition_interval VARCHAR(63) NOT NULL DEFAULT 'month',\n"
+        "    history_keyframe_interval INTEGER NOT NULL DEFAULT 0\n"
         ");";
     conn->exec(sql);
     sql =
@@ -309,6 +438,25 @@ static void init_database_all(etymon::odbc_conn* conn, const string& ldp_user,
         ");";
     conn->exec(sql);
 
+    sql =
+        "CREATE TABLE dbconfig.history_retention (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    remove_duplicates BOOLEAN NOT NULL DEFAULT TRUE,\n"
+        "    thin_after_days INTEGER,\n"
+        "    thin_interval VARCHAR(63) NOT NULL DEFAULT 'day',\n"
+        "    archive BOOLEAN NOT NULL DEFAULT TRUE\n"
+        ");";
+    conn->exec(sql);
+
+    sql =
+        "CREATE TABLE dbconfig.table_schedule (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    schedule VARCHAR(63) NOT NULL,\n"
+        "    enable_schedule BOOLEAN NOT NULL DEFAULT TRUE,\n"
+        "    target_staleness INTEGER\n"
+        ");";
+    conn->exec(sql);
+
     sql = "GRANT SELECT ON ALL TABLES IN SCHEMA dbconfig TO " + ldp_user + ";";
     conn->exec(sql);
     sql = "GRANT SELECT ON ALL TABLES IN SCHEMA dbconfig TO " + ldpconfig_user +
@@ -316,6 +464,17 @@ static void init_database_all(etymon::odbc_conn* conn, const string& ldp_user,
     conn->exec(sql);
     sql = "GRANT UPDATE ON dbconfig.general TO " + ldpconfig_user + ";";
     conn->exec(sql);
+    sql = "GRANT INSERT, UPDATE, DELETE ON dbconfig.history_retention TO " +
+        ldpconfig_user + ";";
+    conn->exec(sql);
+    sql = "GRANT INSERT, UPDATE, DELETE ON dbconfig.table_schedule TO " +
+        ldpconfig_user + ";";
+    conn->exec(sql);
+
+    // Schema: ldp_shadow
+
+    sql = "CREATE SCHEMA ldp_shadow;";
+    conn->exec(sql);
 
     // Schema: history
 
@@ -327,15 +486,42 @@ static void init_database_all(etymon::odbc_conn* conn, const string& ldp_user,
     sql = "GRANT USAGE ON SCHEMA history TO " + ldpconfig_user + ";";
     conn->exec(sql);
 
+    vector<string> sqls;
+    create_history_delta_functions_sql(conn, dbt, &sqls);
+    for (auto& s : sqls)
+        conn->exec(s);
+
     for (auto& table : schema.tables) {
         create_history_table_sql(table.name, conn, dbt, &sql);
         conn->exec(sql);
+        create_history_latest_index_sql(table.name, conn, dbt, &sql);
+        if (sql != "")
+            conn->exec(sql);
+        create_history_changed_fields_index_sql(table.name, conn, dbt, &sql);
+        if (sql != "")
+            conn->exec(sql);
         grant_select_on_table_sql("history." + table.name, ldp_user,
                                   conn, &sql);
         conn->exec(sql);
         grant_select_on_table_sql("history." + table.name, ldpconfig_user,
                                   conn, &sql);
         conn->exec(sql);
+        create_history_versions_view_sql(table.name, conn, dbt, &sql);
+        if (sql != "") {
+            conn->exec(sql);
+            grant_select_on_table_sql("history." + table.name + "_versions",
+                                      ldp_user, conn, &sql);
+            conn->exec(sql);
+            grant_select_on_table_sql("history." + table.name + "_versions",
+                                      ldpconfig_user, conn, &sql);
+            conn->exec(sql);
+        }
+        create_history_as_of_indexes_sql(table.name, conn, dbt, &sqls);
+        for (auto& s : sqls)
+            conn->exec(s);
+        create_history_as_of_function_sql(table.name, conn, dbt, &sql);
+        if (sql != "")
+            conn->exec(sql);
     }
 
     // Schema: public
@@ -10,6 +10,7 @@ void create_main_table_sql(const string& table_name, etymon::odbc_conn* conn,
         "    id VARCHAR(65535) NOT NULL,\n"
         "    data " + dbt.json_type() + ",\n"
         "    tenant_id SMALLINT NOT NULL,\n"
+        "    data_hash " + dbt.hash_type() + ",\n"
         "    PRIMARY KEY (id)\n"
         ")" + rskeys + ";";
 }
@@ -24,13 +25,236 @@ void create_history_table_sql(const string& table_name,
         "CREATE TABLE IF NOT EXISTS\n"
         "    history." + table_name + " (\n"
         "    id VARCHAR(36) NOT NULL,\n"
-        "    data " + dbt.json_type() + " NOT NULL,\n"
+        "    data " + dbt.json_type() +
+        ( dbt.type() == dbsys::postgresql ? "" : " NOT NULL" ) + ",\n"
         "    updated TIMESTAMP WITH TIME ZONE NOT NULL,\n"
         "    tenant_id SMALLINT NOT NULL,\n"
+        "    latest BOOLEAN NOT NULL DEFAULT FALSE,\n"
+        "    data_hash " + dbt.hash_type() + ",\n"
+        "    valid_from TIMESTAMP WITH TIME ZONE,\n"
+        "    valid_to TIMESTAMP WITH TIME ZONE,\n" +
+        ( dbt.type() == dbsys::postgresql ?
+          "    delta JSONB,\n"
+          "    changed_fields TEXT[],\n"
+          "    delta_seq INTEGER,\n" : "" ) +
         "    CONSTRAINT\n"
         "        history_" + table_name + "_pkey\n"
         "        PRIMARY KEY (id, updated)\n"
-        ")" + rskeys + ";";
+        ")" + rskeys +
+        ( dbt.type() == dbsys::postgresql ?
+          "\n    PARTITION BY RANGE (updated)" : "" ) + ";";
+}
+
+void create_history_latest_index_sql(const string& table_name,
+                                     etymon::odbc_conn* conn,
+                                     const dbtype& dbt, string* sql)
+{
+    if (dbt.type() != dbsys::postgresql) {
+        *sql = "";
+        return;
+    }
+    *sql =
+        "CREATE INDEX IF NOT EXISTS\n"
+        "    history_" + table_name + "_latest\n"
+        "    ON history." + table_name + " (tenant_id, id, data_hash)\n"
+        "    WHERE latest;";
+}
+
+void create_history_changed_fields_index_sql(const string& table_name,
+                                             etymon::odbc_conn* conn,
+                                             const dbtype& dbt, string* sql)
+{
+    if (dbt.type() != dbsys::postgresql) {
+        *sql = "";
+        return;
+    }
+    *sql =
+        "CREATE INDEX IF NOT EXISTS\n"
+        "    history_" + table_name + "_changed_fields\n"
+        "    ON history." + table_name + " USING GIN (changed_fields);";
+}
+
+// Indexes supporting point-in-time queries: a covering index for
+// looking up the version of a record that was valid at a given time,
+// and a BRIN index on updated for scanning ranges of time.
+void create_history_as_of_indexes_sql(const string& table_name,
+                                      etymon::odbc_conn* conn,
+                                      const dbtype& dbt,
+                                      vector<string>* sqls)
+{
+    sqls->clear();
+    if (dbt.type() != dbsys::postgresql)
+        return;
+    sqls->push_back(
+        "CREATE INDEX IF NOT EXISTS\n"
+        "    history_" + table_name + "_as_of\n"
+        "    ON history." + table_name + " (tenant_id, id, updated)\n"
+        "    INCLUDE (valid_to);");
+    sqls->push_back(
+        "CREATE INDEX IF NOT EXISTS\n"
+        "    history_" + table_name + "_updated_brin\n"
+        "    ON history." + table_name + " USING BRIN (updated);");
+}
+
+// Creates a function history.<table>_as_of(ts) that returns the
+// version of each record that was valid at time ts.  Delta encoded
+// data are reconstructed from the versions view.
+void create_history_as_of_function_sql(const string& table_name,
+                                       etymon::odbc_conn* conn,
+                                       const dbtype& dbt, string* sql)
+{
+    if (dbt.type() != dbsys::postgresql) {
+        *sql = "";
+        return;
+    }
+    *sql =
+        "CREATE OR REPLACE FUNCTION\n"
+        "    history." + table_name + "_as_of(ts TIMESTAMP WITH TIME ZONE)\n"
+        "    RETURNS TABLE (id VARCHAR,\n"
+        "                   data JSONB,\n"
+        "                   updated TIMESTAMP WITH TIME ZONE,\n"
+        "                   tenant_id SMALLINT,\n"
+        "                   valid_from TIMESTAMP WITH TIME ZONE,\n"
+        "                   valid_to TIMESTAMP WITH TIME ZONE)\n"
+        "    AS $$\n"
+        "SELECT h.id,\n"
+        "       CASE WHEN h.data IS NOT NULL THEN (h.data)::JSONB\n"
+        "            ELSE (SELECT v.data\n"
+        "                      FROM history." + table_name + "_versions AS v\n"
+        "                      WHERE v.tenant_id = h.tenant_id AND\n"
+        "                            v.id = h.id AND\n"
+        "                            v.updated = h.updated)\n"
+        "            END,\n"
+        "       h.updated,\n"
+        "       h.tenant_id,\n"
+        "       h.valid_from,\n"
+        "       h.valid_to\n"
+        "    FROM history." + table_name + " AS h\n"
+        "    WHERE h.updated <= ts AND\n"
+        "          ( h.valid_to IS NULL OR h.valid_to > ts )\n"
+        "$$ LANGUAGE SQL STABLE;";
+}
+
+// Creates a view of a history table in which the data of each version
+// are reconstructed from the nearest preceding version that is stored
+// in full and the deltas that follow it.
+void create_history_versions_view_sql(const string& table_name,
+                                      etymon::odbc_conn* conn,
+                                      const dbtype& dbt, string* sql)
+{
+    if (dbt.type() != dbsys::postgresql) {
+        *sql = "";
+        return;
+    }
+    *sql =
+        "CREATE OR REPLACE VIEW\n"
+        "    history." + table_name + "_versions\n"
+        "    AS\n"
+        "SELECT id,\n"
+        "       dbsystem.history_data((data)::JSONB, delta)\n"
+        "           OVER (PARTITION BY tenant_id, id ORDER BY updated)\n"
+        "           AS data,\n"
+        "       updated,\n"
+        "       tenant_id,\n"
+        "       latest,\n"
+        "       data_hash,\n"
+        "       changed_fields\n"
+        "    FROM history." + table_name + ";";
+}
+
+// Functions used for delta encoding of history data.  A delta is a JSON
+// Patch (RFC 6902) that transforms the previous version of a record
+// into the next version, consisting of add, remove, and replace
+// operations on the top-level fields.
+void create_history_delta_functions_sql(etymon::odbc_conn* conn,
+                                        const dbtype& dbt,
+                                        vector<string>* sqls)
+{
+    sqls->clear();
+    if (dbt.type() != dbsys::postgresql)
+        return;
+    sqls->push_back(
+        "CREATE OR REPLACE FUNCTION dbsystem.jsonb_diff(a JSONB, b JSONB)\n"
+        "    RETURNS JSONB\n"
+        "    AS $$\n"
+        "SELECT CASE WHEN jsonb_typeof(a) = 'object' AND\n"
+        "                 jsonb_typeof(b) = 'object' THEN\n"
+        "    (SELECT coalesce(jsonb_agg(op ORDER BY k), '[]'::JSONB)\n"
+        "         FROM (SELECT k,\n"
+        "                      jsonb_build_object(\n"
+        "                          'op', CASE WHEN a->k IS NULL\n"
+        "                                     THEN 'add'\n"
+        "                                     ELSE 'replace' END,\n"
+        "                          'path', '/' || replace(\n"
+        "                              replace(k, '~', '~0'), '/', '~1'),\n"
+        "                          'value', v) AS op\n"
+        "                   FROM jsonb_each(b) AS e (k, v)\n"
+        "                   WHERE a->k IS DISTINCT FROM v\n"
+        "               UNION ALL\n"
+        "               SELECT k,\n"
+        "                      jsonb_build_object(\n"
+        "                          'op', 'remove',\n"
+        "                          'path', '/' || replace(\n"
+        "                              replace(k, '~', '~0'), '/', '~1'))\n"
+        "                      AS op\n"
+        "                   FROM jsonb_object_keys(a) AS k\n"
+        "                   WHERE b->k IS NULL) AS d)\n"
+        "    ELSE jsonb_build_array(jsonb_build_object('op', 'replace',\n"
+        "                                              'path', '',\n"
+        "                                              'value', b))\n"
+        "    END\n"
+        "$$ LANGUAGE SQL IMMUTABLE;");
+    sqls->push_back(
+        "CREATE OR REPLACE FUNCTION dbsystem.jsonb_patch(doc JSONB,\n"
+        "                                                patch JSONB)\n"
+        "    RETURNS JSONB\n"
+        "    AS $$\n"
+        "DECLARE\n"
+        "    op JSONB;\n"
+        "    k TEXT;\n"
+        "BEGIN\n"
+        "    IF patch IS NULL THEN\n"
+        "        RETURN doc;\n"
+        "    END IF;\n"
+        "    FOR op IN SELECT jsonb_array_elements(patch) LOOP\n"
+        "        IF op->>'path' = '' THEN\n"
+        "            doc := op->'value';\n"
+        "        ELSE\n"
+        "            k := replace(replace(substr(op->>'path', 2),\n"
+        "                                 '~1', '/'), '~0', '~');\n"
+        "            IF op->>'op' = 'remove' THEN\n"
+        "                doc := doc - k;\n"
+        "            ELSE\n"
+        "                doc := doc || jsonb_build_object(k, op->'value');\n"
+        "            END IF;\n"
+        "        END IF;\n"
+        "    END LOOP;\n"
+        "    RETURN doc;\n"
+        "END\n"
+        "$$ LANGUAGE plpgsql IMMUTABLE;");
+    sqls->push_back(
+        "CREATE OR REPLACE FUNCTION dbsystem.jsonb_patch_fields(patch JSONB)\n"
+        "    RETURNS TEXT[]\n"
+        "    AS $$\n"
+        "SELECT array_agg(replace(replace(substr(op->>'path', 2),\n"
+        "                                 '~1', '/'), '~0', '~'))\n"
+        "    FROM jsonb_array_elements(patch) AS op\n"
+        "    WHERE op->>'path' <> ''\n"
+        "$$ LANGUAGE SQL IMMUTABLE;");
+    sqls->push_back(
+        "CREATE OR REPLACE FUNCTION dbsystem.history_data_step(state JSONB,\n"
+        "                                                      data JSONB,\n"
+        "                                                      delta JSONB)\n"
+        "    RETURNS JSONB\n"
+        "    AS $$\n"
+        "SELECT CASE WHEN data IS NOT NULL THEN data\n"
+        "            ELSE dbsystem.jsonb_patch(state, delta) END\n"
+        "$$ LANGUAGE SQL IMMUTABLE;");
+    sqls->push_back(
+        "CREATE AGGREGATE dbsystem.history_data(JSONB, JSONB) (\n"
+        "    SFUNC = dbsystem.history_data_step,\n"
+        "    STYPE = JSONB\n"
+        ");");
 }
 
 void grant_select_on_table_sql(const string& table, const string& user,
@@ -2,6 +2,7 @@
 #define LDP_INITUTIL_H
 
 #include <string>
+#include <vector>
 
 #include "../etymoncpp/include/odbc.h"
 #include "dbtype.h"
@@ -15,6 +16,31 @@ void create_history_table_sql(const string& table_name,
                               etymon::odbc_conn* conn, const dbtype& dbt,
                               string* sql);
 
+void create_history_latest_index_sql(const string& table_name,
+                                     etymon::odbc_conn* conn,
+                                     const dbtype& dbt, string* sql);
+
+void create_history_changed_fields_index_sql(const string& table_name,
+                                             etymon::odbc_conn* conn,
+                                             const dbtype& dbt, string* sql);
+
+void create_history_as_of_indexes_sql(const string& table_name,
+                                      etymon::odbc_conn* conn,
+                                      const dbtype& dbt,
+                                      vector<string>* sqls);
+
+void create_history_as_of_function_sql(const string& table_name,
+                                       etymon::odbc_conn* conn,
+                                       const dbtype& dbt, string* sql);
+
+void create_history_versions_view_sql(const string& table_name,
+                                      etymon::odbc_conn* conn,
+                                      const dbtype& dbt, string* sql);
+
+void create_history_delta_functions_sql(etymon::odbc_conn* conn,
+                                        const dbtype& dbt,
+                                        vector<string>* sqls);
+
 void grant_select_on_table_sql(const string& table, const string& user,
                                etymon::odbc_conn* conn, string* sql);
 
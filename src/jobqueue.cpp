@@ -0,0 +1,245 @@
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "jobqueue.h"
+
+// Returns a name identifying this process, of the form host:pid.
+string job_worker_name()
+{
+    char host[256];
+    if (gethostname(host, sizeof host) != 0)
+        host[0] = '\0';
+    host[sizeof host - 1] = '\0';
+    return string(host) + ":" + to_string(getpid());
+}
+
+// Replaces all jobs with a new queued job for each table.  The tables
+// are paired with their estimated durations, or a negative value if
+// unknown, and longer jobs are claimed first.
+void enqueue_jobs(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                  const vector<pair<string, double>>& tables)
+{
+    etymon::odbc_tx tx(conn);
+    string sql = "DELETE FROM dbsystem.jobs;";
+    lg->detail(sql);
+    conn->exec(sql);
+    for (auto& [table, estimated_time] : tables) {
+        string et = (estimated_time < 0 || !isfinite(estimated_time)) ?
+            "NULL" : to_string(estimated_time);
+        sql =
+            "INSERT INTO dbsystem.jobs\n"
+            "    (table_name, run_id, estimated_time, status)\n"
+            "VALUES\n"
+            "    ('" + table + "', " + to_string(run_id) + ", " + et +
+            ", 'queued');";
+        lg->detail(sql);
+        conn->exec(sql);
+    }
+    tx.commit();
+}
+
+// Claims the queued job with the longest estimated duration, or returns
+// false if there are no queued jobs.  Jobs locked by other workers are
+// skipped rather than waited for.
+bool claim_job(etymon::odbc_conn* conn, ldp_log* lg, const string& worker,
+               job* j)
+{
+    string sql =
+        "UPDATE dbsystem.jobs\n"
+        "    SET status = 'running',\n"
+        "        worker = '" + worker + "',\n"
+        "        attempts = attempts + 1,\n"
+        "        heartbeat = CURRENT_TIMESTAMP\n"
+        "    WHERE table_name = (\n"
+        "        SELECT table_name\n"
+        "            FROM dbsystem.jobs\n"
+        "            WHERE status = 'queued'\n"
+        "            ORDER BY estimated_time DESC NULLS FIRST, table_name\n"
+        "            LIMIT 1\n"
+        "            FOR UPDATE SKIP LOCKED\n"
+        "        )\n"
+        "    RETURNING table_name, run_id, attempts;";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    if (!conn->fetch(&stmt))
+        return false;
+    string run_id, attempts;
+    conn->get_data(&stmt, 1, &(j->table_name));
+    conn->get_data(&stmt, 2, &run_id);
+    conn->get_data(&stmt, 3, &attempts);
+    j->run_id = stoll(run_id);
+    j->attempts = stoi(attempts);
+    return true;
+}
+
+// Condition that matches a job only if it is still held by this
+// worker, i.e. it has not been requeued and claimed again since.
+static string held_job_condition(const string& worker, const job& j)
+{
+    return
+        "table_name = '" + j.table_name + "' AND\n"
+        "        run_id = " + to_string(j.run_id) + " AND\n"
+        "        attempts = " + to_string(j.attempts) + " AND\n"
+        "        worker = '" + worker + "' AND\n"
+        "        status = 'running'";
+}
+
+// Records the result of a job.  Returns false if the job is no longer
+// held by this worker.
+bool finish_job(etymon::odbc_conn* conn, ldp_log* lg, const string& worker,
+                const job& j, const string& status,
+                const table_changes* changes)
+{
+    string sql =
+        "UPDATE dbsystem.jobs\n"
+        "    SET status = '" + status + "'";
+    if (changes != nullptr)
+        sql += string(",\n") +
+            "        replaced = " + (changes->replaced ? "TRUE" : "FALSE") +
+            ",\n"
+            "        row_count = " + to_string(changes->rows) + ",\n"
+            "        history_row_count = " +
+            to_string(changes->history_rows);
+    sql += "\n    WHERE " + held_job_condition(worker, j) + ";";
+    lg->detail(sql);
+    int64_t rows;
+    conn->exec(sql, &rows);
+    return rows > 0;
+}
+
+// Requeues a job after an error, or marks it as failed if it has been
+// attempted job_attempts times.  Returns false if the job is no longer
+// held by this worker.
+bool retry_job(etymon::odbc_conn* conn, ldp_log* lg, const string& worker,
+               const job& j)
+{
+    return finish_job(conn, lg, worker, j,
+                      j.attempts < job_attempts ? "queued" : "failed",
+                      nullptr);
+}
+
+// Requeues running jobs that have not sent a heartbeat within
+// job_timeout seconds, or marks them as failed if they have been
+// attempted job_attempts times.
+void requeue_stale_jobs(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id)
+{
+    string sql =
+        "UPDATE dbsystem.jobs\n"
+        "    SET status = CASE WHEN attempts < " +
+        to_string(job_attempts) + " THEN 'queued'\n"
+        "                      ELSE 'failed' END\n"
+        "    WHERE run_id = " + to_string(run_id) + " AND\n"
+        "        status = 'running' AND\n"
+        "        heartbeat < CURRENT_TIMESTAMP - INTERVAL '" +
+        to_string(job_timeout) + " seconds';";
+    lg->detail(sql);
+    int64_t rows;
+    conn->exec(sql, &rows);
+    if (rows > 0)
+        lg->write(log_level::warning, "server", "",
+                  "Requeued jobs of unresponsive workers: " +
+                  to_string(rows), -1);
+}
+
+void count_jobs(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                job_counts* counts)
+{
+    string sql =
+        "SELECT status, count(*)\n"
+        "    FROM dbsystem.jobs\n"
+        "    WHERE run_id = " + to_string(run_id) + "\n"
+        "    GROUP BY status;";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    *counts = job_counts();
+    while (conn->fetch(&stmt)) {
+        string status, count;
+        conn->get_data(&stmt, 1, &status);
+        conn->get_data(&stmt, 2, &count);
+        if (status == "queued")
+            counts->queued = stoull(count);
+        if (status == "running")
+            counts->running = stoull(count);
+    }
+}
+
+bool queued_jobs_exist(etymon::odbc_conn* conn, ldp_log* lg)
+{
+    string sql =
+        "SELECT 1 FROM dbsystem.jobs WHERE status = 'queued' LIMIT 1;";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    return conn->fetch(&stmt);
+}
+
+// Reads the changes made by the jobs that updated a table.
+void select_job_changes(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                        map<string, table_changes>* changes)
+{
+    string sql =
+        "SELECT table_name, replaced, row_count, history_row_count\n"
+        "    FROM dbsystem.jobs\n"
+        "    WHERE run_id = " + to_string(run_id) + " AND status = 'done';";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    while (conn->fetch(&stmt)) {
+        string table, replaced, rows, history_rows;
+        conn->get_data(&stmt, 1, &table);
+        conn->get_data(&stmt, 2, &replaced);
+        conn->get_data(&stmt, 3, &rows);
+        conn->get_data(&stmt, 4, &history_rows);
+        table_changes& tc = (*changes)[table];
+        tc.replaced = (replaced == "1");
+        tc.rows = stoll(rows);
+        tc.history_rows = stoll(history_rows);
+    }
+}
+
+job_heartbeat::job_heartbeat(etymon::odbc_env* odbc, const string& db,
+                             ldp_log* lg, const string& worker, const job& j)
+{
+    string sql =
+        "UPDATE dbsystem.jobs\n"
+        "    SET heartbeat = CURRENT_TIMESTAMP\n"
+        "    WHERE " + held_job_condition(worker, j) + ";";
+    t = thread([this, odbc, db, lg, sql]() {
+        unique_ptr<etymon::odbc_conn> conn;
+        unique_lock<mutex> lock(m);
+        while (!cv.wait_for(lock, chrono::seconds(job_heartbeat_interval),
+                            [this]() { return stopping; })) {
+            lock.unlock();
+            try {
+                if (!conn)
+                    conn.reset(new etymon::odbc_conn(odbc, db));
+                lg->detail(sql);
+                conn->exec(sql);
+            } catch (runtime_error& e) {
+                conn.reset();
+                string s = e.what();
+                if ( !(s.empty()) && s.back() == '\n' )
+                    s.pop_back();
+                lg->write(log_level::warning, "server", "",
+                          "Unable to send job heartbeat:\n"
+                          "    Error: " + s, -1);
+            }
+            lock.lock();
+        }
+    });
+}
+
+job_heartbeat::~job_heartbeat()
+{
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    cv.notify_one();
+    t.join();
+}
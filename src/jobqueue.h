@@ -0,0 +1,80 @@
+#ifndef LDP_JOBQUEUE_H
+#define LDP_JOBQUEUE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../etymoncpp/include/odbc.h"
+#include "log.h"
+#include "maintain.h"
+
+using namespace std;
+
+// Table update jobs are stored in dbsystem.jobs, one row per table.  A
+// job is queued by the coordinator, claimed by a worker, and finished
+// as done, skipped, or failed.  A running job whose worker stops
+// sending heartbeats is requeued.  Jobs are claimed with SKIP LOCKED,
+// which requires PostgreSQL.
+
+// Number of times a job is attempted before it is marked as failed.
+const int job_attempts = 3;
+// Interval in seconds between heartbeats of a running job.
+const int job_heartbeat_interval = 10;
+// Number of seconds without a heartbeat after which a running job is
+// requeued.
+const int job_timeout = 120;
+
+class job {
+public:
+    string table_name;
+    int64_t run_id = 0;
+    int attempts = 0;
+};
+
+class job_counts {
+public:
+    size_t queued = 0;
+    size_t running = 0;
+};
+
+string job_worker_name();
+
+void enqueue_jobs(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                  const vector<pair<string, double>>& tables);
+bool claim_job(etymon::odbc_conn* conn, ldp_log* lg, const string& worker,
+               job* j);
+bool finish_job(etymon::odbc_conn* conn, ldp_log* lg, const string& worker,
+                const job& j, const string& status,
+                const table_changes* changes);
+bool retry_job(etymon::odbc_conn* conn, ldp_log* lg, const string& worker,
+               const job& j);
+void requeue_stale_jobs(etymon::odbc_conn* conn, ldp_log* lg,
+                        int64_t run_id);
+void count_jobs(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                job_counts* counts);
+bool queued_jobs_exist(etymon::odbc_conn* conn, ldp_log* lg);
+void select_job_changes(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                        map<string, table_changes>* changes);
+
+// Sends heartbeats for a running job from a background thread, on its
+// own connection, until it is destroyed.
+class job_heartbeat {
+public:
+    job_heartbeat(etymon::odbc_env* odbc, const string& db, ldp_log* lg,
+                  const string& worker, const job& j);
+    ~job_heartbeat();
+    job_heartbeat(const job_heartbeat&) = delete;
+    job_heartbeat& operator=(const job_heartbeat&) = delete;
+private:
+    mutex m;
+    condition_variable cv;
+    bool stopping = false;
+    thread t;
+};
+
+#endif
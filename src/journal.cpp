@@ -0,0 +1,197 @@
+#include <chrono>
+#include <stdexcept>
+
+#include "dbtype.h"
+#include "journal.h"
+
+static void select_journal(etymon::odbc_conn* conn, ldp_log* lg,
+                           update_run* run)
+{
+    string sql =
+        "SELECT table_name, phase, duration, merge_mode, record_count,\n"
+        "       replaced, row_count, history_row_count\n"
+        "    FROM dbsystem.run_journal\n"
+        "    WHERE run_id = " + to_string(run->run_id) + ";";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    while (conn->fetch(&stmt)) {
+        string table, phase, duration, mode, record_count, replaced, rows,
+               history_rows;
+        conn->get_data(&stmt, 1, &table);
+        conn->get_data(&stmt, 2, &phase);
+        conn->get_data(&stmt, 3, &duration);
+        conn->get_data(&stmt, 4, &mode);
+        conn->get_data(&stmt, 5, &record_count);
+        conn->get_data(&stmt, 6, &replaced);
+        conn->get_data(&stmt, 7, &rows);
+        conn->get_data(&stmt, 8, &history_rows);
+        journal_entry& e = run->tables[table];
+        double d = (duration == "NULL" ? -1 : stod(duration));
+        if (phase == phase_extract) {
+            e.extracted = true;
+            e.extract_time = d;
+        }
+        if (phase == phase_stage) {
+            e.staged = true;
+            e.stage_time = d;
+            e.mode = (mode == "upsert" ? merge_mode::upsert :
+                      merge_mode::replace);
+            e.record_count = stoull(record_count);
+        }
+        if (phase == phase_merge) {
+            e.merged = true;
+            e.merge_time = d;
+            e.changes.replaced = (replaced == "1");
+            e.changes.rows = stoll(rows);
+            e.changes.history_rows = stoll(history_rows);
+        }
+    }
+}
+
+// Starts a new update run, or if resume is set, resumes the last
+// incomplete run that updated the same selection of tables and reads
+// its journal.  The selection is the table named by the --table option,
+// or empty for all tables.  Starting a new run abandons any incomplete
+// run.
+void begin_update_run(etymon::odbc_conn* conn, ldp_log* lg,
+                      const string& selection, bool resume, update_run* run)
+{
+    *run = update_run();
+    if (resume) {
+        string sql =
+            "SELECT run_id\n"
+            "    FROM dbsystem.update_runs\n"
+            "    WHERE status = 'running' AND selection = '" + selection +
+            "'\n"
+            "    ORDER BY run_id DESC\n"
+            "    LIMIT 1;";
+        lg->detail(sql);
+        string run_id;
+        {
+            etymon::odbc_stmt stmt(conn);
+            conn->exec_direct(&stmt, sql);
+            if (conn->fetch(&stmt))
+                conn->get_data(&stmt, 1, &run_id);
+        }
+        if (run_id != "") {
+            run->run_id = stoll(run_id);
+            run->resumed = true;
+            sql =
+                "UPDATE dbsystem.update_runs\n"
+                "    SET resumes = resumes + 1\n"
+                "    WHERE run_id = " + run_id + ";";
+            lg->detail(sql);
+            conn->exec(sql);
+            select_journal(conn, lg, run);
+            return;
+        }
+    }
+    run->run_id = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    dbtype dbt(conn);
+    etymon::odbc_tx tx(conn);
+    string sql =
+        "UPDATE dbsystem.update_runs\n"
+        "    SET status = 'abandoned'\n"
+        "    WHERE status = 'running';";
+    lg->detail(sql);
+    conn->exec(sql);
+    sql = "DELETE FROM dbsystem.run_journal;";
+    lg->detail(sql);
+    conn->exec(sql);
+    sql =
+        "INSERT INTO dbsystem.update_runs\n"
+        "    (run_id, selection, status, started)\n"
+        "VALUES\n"
+        "    (" + to_string(run->run_id) + ", '" + selection +
+        "', 'running', " + dbt.current_timestamp() + ");";
+    lg->detail(sql);
+    conn->exec(sql);
+    tx.commit();
+}
+
+// Records that a phase of a table has been completed.  The entry
+// supplies the merge mode and record count of a staged table, or the
+// changes made by a merged table.  A stage or merge should be recorded
+// in the transaction that commits it.
+void journal_phase(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                   const string& table, const string& phase, double duration,
+                   const journal_entry* entry)
+{
+    dbtype dbt(conn);
+    string mode = "NULL", record_count = "NULL", replaced = "NULL",
+           rows = "NULL", history_rows = "NULL";
+    if (entry != nullptr && phase == phase_stage) {
+        mode = (entry->mode == merge_mode::upsert ? "'upsert'" : "'replace'");
+        record_count = to_string(entry->record_count);
+    }
+    if (entry != nullptr && phase == phase_merge) {
+        replaced = (entry->changes.replaced ? "TRUE" : "FALSE");
+        rows = to_string(entry->changes.rows);
+        history_rows = to_string(entry->changes.history_rows);
+    }
+    string sql =
+        "INSERT INTO dbsystem.run_journal\n"
+        "    (run_id, table_name, phase, completed, duration, merge_mode,\n"
+        "        record_count, replaced, row_count, history_row_count)\n"
+        "VALUES\n"
+        "    (" + to_string(run_id) + ", '" + table + "', '" + phase + "', " +
+        dbt.current_timestamp() + ", " +
+        (duration < 0 ? "NULL" : to_string(duration)) + ", " + mode + ", " +
+        record_count + ", " + replaced + ", " + rows + ", " + history_rows +
+        ");";
+    lg->detail(sql);
+    conn->exec(sql);
+}
+
+// Removes a phase from the journal, so that a resumed update repeats
+// it.
+void forget_phase(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                  const string& table, const string& phase)
+{
+    string sql =
+        "DELETE FROM dbsystem.run_journal\n"
+        "    WHERE run_id = " + to_string(run_id) + " AND\n"
+        "        table_name = '" + table + "' AND\n"
+        "        phase = '" + phase + "';";
+    lg->detail(sql);
+    conn->exec(sql);
+}
+
+// Marks an update run as completed and removes its journal.
+void complete_update_run(etymon::odbc_conn* conn, ldp_log* lg,
+                         int64_t run_id)
+{
+    dbtype dbt(conn);
+    etymon::odbc_tx tx(conn);
+    string sql =
+        "UPDATE dbsystem.update_runs\n"
+        "    SET status = 'completed',\n"
+        "        completed = " + string(dbt.current_timestamp()) + "\n"
+        "    WHERE run_id = " + to_string(run_id) + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+    sql =
+        "DELETE FROM dbsystem.run_journal\n"
+        "    WHERE run_id = " + to_string(run_id) + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+    tx.commit();
+}
+
+// Returns true if there is an incomplete update run that has been
+// resumed fewer than resume_attempts times.
+bool incomplete_run_exists(etymon::odbc_conn* conn, ldp_log* lg)
+{
+    string sql =
+        "SELECT 1\n"
+        "    FROM dbsystem.update_runs\n"
+        "    WHERE status = 'running' AND resumes < " +
+        to_string(resume_attempts) + "\n"
+        "    LIMIT 1;";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    return conn->fetch(&stmt);
+}
@@ -0,0 +1,68 @@
+#ifndef LDP_JOURNAL_H
+#define LDP_JOURNAL_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "../etymoncpp/include/odbc.h"
+#include "log.h"
+#include "maintain.h"
+#include "options.h"
+
+using namespace std;
+
+// A full update is recorded in dbsystem.update_runs, and the completion
+// of each phase of each table in dbsystem.run_journal, so that an
+// update that does not complete can be resumed.  A resumed update
+// skips the tables and phases that were completed: a merged table is
+// not updated again, a staged table is only merged, and an extracted
+// table is staged from the files already in the data directory.
+
+// Number of times the server resumes a full update that did not
+// complete, before waiting for the next scheduled full update.
+const int resume_attempts = 3;
+// Number of seconds after an incomplete full update before it is
+// resumed.
+const int resume_delay = 300;
+
+// Phases recorded in the journal.
+const char phase_extract[] = "extract";
+const char phase_stage[] = "stage";
+const char phase_merge[] = "merge";
+
+// Phases of a table that were completed in an update run, with the
+// state needed to continue from them.  Durations are in seconds, or -1
+// if not known.
+class journal_entry {
+public:
+    bool extracted = false;
+    bool staged = false;
+    bool merged = false;
+    double extract_time = -1;
+    double stage_time = -1;
+    double merge_time = -1;
+    merge_mode mode = merge_mode::replace;
+    size_t record_count = 0;
+    table_changes changes;
+};
+
+class update_run {
+public:
+    int64_t run_id = 0;
+    bool resumed = false;
+    map<string, journal_entry> tables;
+};
+
+void begin_update_run(etymon::odbc_conn* conn, ldp_log* lg,
+                      const string& selection, bool resume, update_run* run);
+void journal_phase(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                   const string& table, const string& phase, double duration,
+                   const journal_entry* entry);
+void forget_phase(etymon::odbc_conn* conn, ldp_log* lg, int64_t run_id,
+                  const string& table, const string& phase);
+void complete_update_run(etymon::odbc_conn* conn, ldp_log* lg,
+                         int64_t run_id);
+bool incomplete_run_exists(etymon::odbc_conn* conn, ldp_log* lg);
+
+#endif
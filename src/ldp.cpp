@@ -1,9 +1,14 @@
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 #include <signal.h>
 #include <stdexcept>
 #include <string>
@@ -14,10 +19,18 @@
 
 #include "../etymoncpp/include/odbc.h"
 #include "../etymoncpp/include/postgres.h"
+#include "cron.h"
 #include "dbtype.h"
+#include "freshness.h"
 #include "init.h"
+#include "jobqueue.h"
+#include "journal.h"
 #include "ldp.h"
+#include "listen.h"
 #include "log.h"
+#include "metrics.h"
+#include "parallel.h"
+#include "schema.h"
 #include "timer.h"
 #include "update.h"
 #include "util.h"
@@ -30,11 +43,14 @@ static const char* option_help =
 "  init-database       - Initialize a new LDP database\n"
 "  upgrade-database    - Upgrade an LDP database to the current version\n"
 "  update              - Run a full update and exit\n"
+"  worker              - Run table update jobs for distributed updates\n"
 "  help                - Display help information\n"
 "Options:\n"
 "  -D <path>           - Use <path> as the data directory\n"
 "  --trace             - Enable detailed logging\n"
 "  --quiet             - Reduce console output\n"
+"  --trace-file <path> - Write a trace of each update to <path>, in the\n"
+"                        Chrome trace event format\n"
 "Options for init-database:\n"
 "  --profile <prof>    - Initialize the LDP database with profile <prof>\n"
 "                        (required)\n"
@@ -45,6 +61,9 @@ static const char* option_help =
 "                        always should be used for consortial deployments\n"
 "                        to prevent overly broad requests for data\n"
 */
+"Options for update:\n"
+"  --resume            - Resume the last full update if it did not\n"
+"                        complete\n"
 "Development/testing options:\n"
 "  --extract-only      - Extract data in the data directory, but do not\n"
 "                        update them in the database\n"
@@ -218,6 +237,156 @@ static void set_dbsystem_main_anonymize(etymon::odbc_env* odbc,
     conn.exec(sql);
 }
 
+// Runs an update in a child process and waits for it to finish.
+static void run_update_child(const ldp_options& opt, ldp_log* lg,
+                             const string& name)
+{
+    timer update_timer(opt);
+    if (opt.metrics != nullptr)
+        opt.metrics->begin_update();
+    pid_t pid = lg->fork_process();
+    if (pid == 0)
+        run_update_process(opt);
+    if (pid > 0) {
+        int stat;
+        waitpid(pid, &stat, 0);
+        if (WIFEXITED(stat))
+            lg->write(log_level::trace, "", "",
+                    "Status code of " + name + ": " +
+                    to_string(WEXITSTATUS(stat)), -1);
+        else
+            lg->write(log_level::trace, "", "",
+                    "The " + name + " did not terminate normally", -1);
+        if (opt.metrics != nullptr)
+            opt.metrics->end_update(update_timer.elapsed_time(),
+                                    WIFEXITED(stat) &&
+                                    WEXITSTATUS(stat) == 0);
+    }
+    if (pid < 0)
+        throw runtime_error("Error starting child process");
+}
+
+class table_schedule {
+public:
+    string expression;
+    time_t next;
+};
+
+// Adds the tables whose scheduled refresh time in
+// dbconfig.table_schedule has passed, and advances their schedules.
+// The first time a schedule is seen, its next time is computed without
+// refreshing the table.
+static void add_scheduled_tables(etymon::odbc_conn* conn, ldp_log* lg,
+                                 map<string, table_schedule>* schedules,
+                                 set<string>* tables)
+{
+    string sql =
+        "SELECT table_name, schedule\n"
+        "    FROM dbconfig.table_schedule\n"
+        "    WHERE enable_schedule AND schedule <> '';";
+    lg->detail(sql);
+    map<string, string> expressions;
+    {
+        etymon::odbc_stmt stmt(conn);
+        conn->exec_direct(&stmt, sql);
+        while (conn->fetch(&stmt)) {
+            string table, expression;
+            conn->get_data(&stmt, 1, &table);
+            conn->get_data(&stmt, 2, &expression);
+            expressions[table] = expression;
+        }
+    }
+    for (auto it = schedules->begin(); it != schedules->end(); ) {
+        if (expressions.count(it->first) == 0)
+            it = schedules->erase(it);
+        else
+            ++it;
+    }
+    time_t now = time(nullptr);
+    for (auto& [table, expression] : expressions) {
+        auto it = schedules->find(table);
+        bool changed = (it == schedules->end() ||
+                        it->second.expression != expression);
+        if (!changed && (it->second.next == -1 || it->second.next > now))
+            continue;
+        table_schedule& ts = (*schedules)[table];
+        ts.expression = expression;
+        try {
+            ts.next = cron_schedule(expression).next(now);
+        } catch (runtime_error& e) {
+            ts.next = -1;
+            lg->write(log_level::warning, "server", table,
+                      "Invalid schedule in dbconfig.table_schedule:\n"
+                      "    Table: " + table + "\n"
+                      "    Schedule: " + expression, -1);
+        }
+        if (!changed)
+            tables->insert(table);
+    }
+}
+
+// Returns the time at which to resume the last full update, or -1 if it
+// completed or has already been resumed resume_attempts times.
+static time_t next_resume_time(etymon::odbc_conn* conn, ldp_log* lg)
+{
+    if (!incomplete_run_exists(conn, lg))
+        return -1;
+    lg->write(log_level::warning, "server", "",
+              "Full update did not complete\n"
+              "    Action: Resuming in " + to_string(resume_delay) +
+              " seconds", -1);
+    return time(nullptr) + resume_delay;
+}
+
+// Returns next_resume_time(), or if the database cannot be queried,
+// e.g. because it was restarted during the update, the time at which to
+// check again whether an update needs to be resumed.
+static time_t check_resume_time(etymon::odbc_conn* conn, ldp_log* lg)
+{
+    try {
+        return next_resume_time(conn, lg);
+    } catch (runtime_error& e) {
+        lg->write(log_level::warning, "server", "",
+                  "Unable to check for incomplete update\n"
+                  "    Error: " + string(e.what()) + "\n"
+                  "    Action: Checking again in " +
+                  to_string(resume_delay) + " seconds", -1);
+        return time(nullptr) + resume_delay;
+    }
+}
+
+// Adds the tables that are due for refresh to meet their target
+// staleness in dbconfig.table_schedule.  A table is not requested again
+// until half of its target staleness has passed, so that a table whose
+// refresh fails is not retried continuously.
+static void add_stale_tables(etymon::odbc_conn* conn, ldp_log* lg,
+                             const dbtype& dbt, map<string, time_t>* requested,
+                             set<string>* tables)
+{
+    map<string, table_freshness> freshness;
+    select_table_freshness(conn, lg, dbt, &freshness);
+    time_t now = time(nullptr);
+    for (auto& [table, f] : freshness) {
+        if (!f.refresh_due())
+            continue;
+        auto it = requested->find(table);
+        if (it != requested->end() && now - it->second < f.target / 2)
+            continue;
+        (*requested)[table] = now;
+        tables->insert(table);
+    }
+}
+
+// Runs full updates when scheduled in dbconfig.general, and refreshes
+// individual tables when scheduled in dbconfig.table_schedule, when
+// needed to meet their target staleness, or when requested by a
+// notification on the ldp_refresh channel.  Requests
+// that arrive while an update is running are merged and handled
+// together once it has finished, and a full update includes any
+// pending requests.  A full update that does not complete, because
+// the update process failed or some tables could not be updated, is
+// resumed after resume_delay seconds, including one left by a previous
+// server process.
 void server_loop(const ldp_options& opt, etymon::odbc_env* odbc)
 {
     // Check that database version is up to date.
@@ -226,42 +395,132 @@ void server_loop(const ldp_options& opt, etymon::odbc_env* odbc)
     set_dbsystem_main_anonymize(odbc, opt);
 
     etymon::odbc_conn log_conn(odbc, opt.db);
-    ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog);
+    ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog,
+               opt.log_file);
 
     lg.write(log_level::info, "server", "",
             string("Server started") + (opt.cli_mode ? " (CLI mode)" : ""), -1);
 
+    // Live metrics are kept in shared memory, which update processes
+    // inherit and update through update_opt.metrics.
+    ldp_options update_opt = opt;
+    unique_ptr<shared_metrics> metrics;
+    unique_ptr<metrics_server> metrics_srv;
+    if (opt.metrics_port != 0) {
+        ldp_schema schema;
+        ldp_schema::make_default_schema(&schema);
+        vector<string> tables;
+        for (auto& table : schema.tables)
+            tables.push_back(table.name);
+        metrics.reset(new shared_metrics(tables));
+        update_opt.metrics = metrics->get();
+        try {
+            metrics_srv.reset(new metrics_server(opt.metrics_port,
+                                                 metrics->get()));
+        } catch (runtime_error& e) {
+            lg.write(log_level::warning, "server", "",
+                     "Unable to serve metrics:\n"
+                     "    Error: " + string(e.what()), -1);
+        }
+    }
+
     etymon::odbc_conn conn(odbc, opt.db);
     dbtype dbt(&conn);
 
+    refresh_listener listener(opt, &lg);
+    map<string, table_schedule> schedules;
+    map<string, time_t> stale_requests;
+    set<string> refresh_tables;
+    // Resume an update left incomplete by a previous server process,
+    // e.g. one that stopped when the database was restarted.
+    time_t resume_time = opt.cli_mode ? -1 : next_resume_time(&conn, &lg);
+
     do {
         if (opt.cli_mode || time_for_full_update(opt, &conn, &dbt, &lg) ) {
             if (!opt.cli_mode)
                 reschedule_next_daily_load(opt, &conn, &dbt, &lg);
-            pid_t pid = fork();
+            refresh_tables.clear();
+            run_update_child(update_opt, &lg, "full update");
+            if (!opt.cli_mode)
+                resume_time = check_resume_time(&conn, &lg);
+        } else if (resume_time != -1 && time(nullptr) >= resume_time) {
+            // The check for an incomplete update may have failed, in
+            // which case there may be nothing to resume.
+            if (incomplete_run_exists(&conn, &lg)) {
+                ldp_options resume_opt = update_opt;
+                resume_opt.resume = true;
+                run_update_child(resume_opt, &lg, "resumed full update");
+            }
+            resume_time = check_resume_time(&conn, &lg);
+        } else {
+            add_scheduled_tables(&conn, &lg, &schedules, &refresh_tables);
+            add_stale_tables(&conn, &lg, dbt, &stale_requests,
+                             &refresh_tables);
+            if (!refresh_tables.empty()) {
+                ldp_options refresh_opt = update_opt;
+                refresh_opt.refresh_tables = refresh_tables;
+                refresh_tables.clear();
+                run_update_child(refresh_opt, &lg, "refresh");
+            }
+        }
+
+        if (!opt.cli_mode) {
+            // Wake up in time for the next scheduled refresh.
+            time_t now = time(nullptr);
+            int timeout = 60;
+            for (auto& [table, ts] : schedules)
+                if (ts.next != -1 && ts.next - now < timeout)
+                    timeout = (ts.next > now ? ts.next - now : 1);
+            if (resume_time != -1 && resume_time - now < timeout)
+                timeout = (resume_time > now ? resume_time - now : 1);
+            listener.wait(timeout, &refresh_tables);
+        }
+    } while (!opt.cli_mode);
+
+    lg.write(log_level::info, "server", "",
+            string("Server stopped") + (opt.cli_mode ? " (CLI mode)" : ""), -1);
+}
+
+// Runs queued table update jobs in a child process whenever the job
+// queue is not empty.  Unlike the server, any number of workers can run
+// at the same time, on the same host or on other hosts.
+void worker_loop(const ldp_options& opt, etymon::odbc_env* odbc)
+{
+    // Check that database version is up to date.
+    validate_database_latest_version(odbc, opt.db);
+
+    etymon::odbc_conn log_conn(odbc, opt.db);
+    ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog,
+               opt.log_file);
+
+    lg.write(log_level::info, "server", "",
+             "Worker started: " + job_worker_name(), -1);
+
+    etymon::odbc_conn conn(odbc, opt.db);
+
+    while (true) {
+        if (queued_jobs_exist(&conn, &lg)) {
+            pid_t pid = lg.fork_process();
             if (pid == 0)
-                run_update_process(opt);
+                run_jobs_process(opt);
             if (pid > 0) {
                 int stat;
                 waitpid(pid, &stat, 0);
                 if (WIFEXITED(stat))
                     lg.write(log_level::trace, "", "",
-                            "Status code of full update: " +
+                            "Status code of jobs: " +
                             to_string(WEXITSTATUS(stat)), -1);
                 else
                     lg.write(log_level::trace, "", "",
-                            "Full update did not terminate normally", -1);
+                            "Jobs did not terminate normally", -1);
             }
             if (pid < 0)
                 throw runtime_error("Error starting child process");
         }
 
-        if (!opt.cli_mode)
-            std::this_thread::sleep_for(std::chrono::seconds(60));
-    } while (!opt.cli_mode);
-
-    lg.write(log_level::info, "server", "",
-            string("Server stopped") + (opt.cli_mode ? " (CLI mode)" : ""), -1);
+        std::this_thread::sleep_for(
+            std::chrono::seconds(job_heartbeat_interval));
+    }
 }
 
 static void no_update_by_default(etymon::odbc_env* odbc, const string& db)
@@ -310,6 +569,14 @@ void cmd_server(const ldp_options& opt)
     server_loop(opt, &odbc);
 }
 
+void cmd_worker(const ldp_options& opt)
+{
+    etymon::odbc_env odbc;
+    if (opt.lg_level == log_level::trace || opt.lg_level == log_level::detail)
+        fprintf(opt.err, "%s: Starting worker\n", opt.prog);
+    worker_loop(opt, &odbc);
+}
+
 //void config_direct_options(const ldp_config& conf, const string& base,
 //        ldp_options* opt)
 //{
@@ -342,6 +609,19 @@ void config_options(const ldp_config& conf, ldp_options* opt)
     conf.get_required(target + "odbc_database", &(opt->db));
     conf.get(target + "ldpconfig_user", &(opt->ldpconfig_user));
     conf.get(target + "ldp_user", &(opt->ldp_user));
+    conf.get(target + "listen_database_name", &(opt->listen_database_name));
+    conf.get(target + "listen_database_host", &(opt->listen_database_host));
+    int listen_port = 0;
+    if (conf.get_int(target + "listen_database_port", false, &listen_port)) {
+        if (listen_port < 1 || listen_port > 65535)
+            throw runtime_error(
+                    "Invalid value for listen_database_port: " +
+                    to_string(listen_port));
+        opt->listen_database_port = to_string(listen_port);
+    }
+    conf.get(target + "listen_database_user", &(opt->listen_database_user));
+    conf.get(target + "listen_database_password",
+             &(opt->listen_database_password));
 
     ///////////////////////////////////////////////////////////////////////////
     // NEW SOURCE CONFIG
@@ -391,9 +671,76 @@ void config_options(const ldp_config& conf, ldp_options* opt)
             "for information on how to disable anonymization.");
     }
 
+    conf.get("/log_file", &(opt->log_file));
+    if (opt->log_file != "" && opt->log_file[0] != '/')
+        opt->log_file = opt->datadir + "/" + opt->log_file;
+
     conf.get_bool("/anonymize", &(opt->anonymize));
 
     conf.get_bool("/allow_destructive_tests", &(opt->allow_destructive_tests));
+
+    conf.get_bool("/change_index", &(opt->change_index));
+
+    string merge;
+    conf.get("/merge_mode", &merge);
+    if (merge == "upsert")
+        opt->merge = merge_mode::upsert;
+    else if (merge == "replace")
+        opt->merge = merge_mode::replace;
+    else if (merge != "")
+        throw runtime_error("Unknown merge mode: " + merge);
+
+    conf.get_bool("/atomic_publish", &(opt->atomic_publish));
+    conf.get_int("/publish_lock_timeout", false,
+                 &(opt->publish_lock_timeout));
+
+    conf.get_bool("/distributed_update", &(opt->distributed_update));
+
+    conf.get_int("/merge_connections", false, &(opt->merge_connections));
+    if (opt->merge_connections < 1 || opt->merge_connections > 256)
+        throw runtime_error(
+                "Invalid value for merge_connections: " +
+                to_string(opt->merge_connections));
+
+    conf.get_int("/foreign_key_connections", false,
+                 &(opt->foreign_key_connections));
+    if (opt->foreign_key_connections < 1 ||
+            opt->foreign_key_connections > 256)
+        throw runtime_error(
+                "Invalid value for foreign_key_connections: " +
+                to_string(opt->foreign_key_connections));
+
+    conf.get_int("/maintenance_connections", false,
+                 &(opt->maintenance_connections));
+    if (opt->maintenance_connections < 1 ||
+            opt->maintenance_connections > 256)
+        throw runtime_error(
+                "Invalid value for maintenance_connections: " +
+                to_string(opt->maintenance_connections));
+
+    conf.get_int("/extract_concurrency", false, &(opt->extract_concurrency));
+    if (opt->extract_concurrency < 1 || opt->extract_concurrency > 64)
+        throw runtime_error(
+                "Invalid value for extract_concurrency: " +
+                to_string(opt->extract_concurrency));
+
+    conf.get_int("/stage_concurrency", false, &(opt->stage_concurrency));
+    if (opt->stage_concurrency < 1 || opt->stage_concurrency > 64)
+        throw runtime_error(
+                "Invalid value for stage_concurrency: " +
+                to_string(opt->stage_concurrency));
+
+    conf.get_int("/merge_concurrency", false, &(opt->merge_concurrency));
+    if (opt->merge_concurrency < 1 || opt->merge_concurrency > 64)
+        throw runtime_error(
+                "Invalid value for merge_concurrency: " +
+                to_string(opt->merge_concurrency));
+
+    conf.get_int("/metrics_port", false, &(opt->metrics_port));
+    if (opt->metrics_port < 0 || opt->metrics_port > 65535)
+        throw runtime_error(
+                "Invalid value for metrics_port: " +
+                to_string(opt->metrics_port));
 }
 
 void validate_options_in_deployment(const ldp_options& opt)
@@ -432,14 +779,23 @@ void ldp_exec(ldp_options* opt)
 
     validate_options_in_deployment(*opt);
 
+    parallel_init(max({opt->merge_connections, opt->foreign_key_connections,
+                       opt->maintenance_connections}));
+
     if (opt->command == ldp_command::update)
         opt->console = true;
 
-    if (opt->command == ldp_command::server) {
+    if (opt->command == ldp_command::server ||
+            opt->command == ldp_command::worker) {
+        bool worker = (opt->command == ldp_command::worker);
+        const char* name = worker ? "worker" : "server";
         do {
             timer error_timer(*opt);
             try {
-                cmd_server(*opt);
+                if (worker)
+                    cmd_worker(*opt);
+                else
+                    cmd_server(*opt);
             } catch (runtime_error& e) {
                 string s = e.what();
                 if ( !(s.empty()) && s.back() == '\n' )
@@ -448,15 +804,15 @@ void ldp_exec(ldp_options* opt)
                 double elapsed_time = error_timer.elapsed_time();
                 if (elapsed_time < 300) {
                     fprintf(stderr,
-                            "ldp: Server error occurred after %.4f seconds\n",
-                            elapsed_time);
+                            "ldp: %s error occurred after %.4f seconds\n",
+                            worker ? "Worker" : "Server", elapsed_time);
                     long long int wait_time = 300;
                     fprintf(stderr, "ldp: Waiting for %lld seconds\n",
                             wait_time);
                     std::this_thread::sleep_for(
                         std::chrono::seconds(wait_time) );
                 }
-                fprintf(stderr, "ldp: Restarting server\n");
+                fprintf(stderr, "ldp: Restarting %s\n", name);
             }
         } while (true);
         return;
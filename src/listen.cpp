@@ -0,0 +1,92 @@
+#include <cerrno>
+#include <chrono>
+#include <stdexcept>
+#include <sys/select.h>
+#include <thread>
+
+#include "listen.h"
+
+refresh_listener::refresh_listener(const ldp_options& opt, ldp_log* lg) :
+    opt(opt), lg(lg)
+{
+}
+
+bool refresh_listener::enabled() const
+{
+    return opt.listen_database_name != "";
+}
+
+void refresh_listener::connect()
+{
+    try {
+        db.reset(new etymon::Postgres(opt.listen_database_host,
+                                      opt.listen_database_port,
+                                      opt.listen_database_user,
+                                      opt.listen_database_password,
+                                      opt.listen_database_name, "prefer"));
+        string sql = string("LISTEN ") + refresh_channel + ";";
+        lg->detail(sql);
+        etymon::PostgresResult result(db.get(), sql);
+    } catch (runtime_error& e) {
+        db.reset();
+        string s = e.what();
+        if ( !(s.empty()) && s.back() == '\n' )
+            s.pop_back();
+        lg->write(log_level::warning, "server", "",
+                  "Unable to listen for refresh requests:\n"
+                  "    Error: " + s, -1);
+    }
+}
+
+// Adds the table named in each notification that has been received.
+void refresh_listener::read_notifications(set<string>* tables)
+{
+    PGnotify* notify;
+    while ((notify = PQnotifies(db->conn)) != nullptr) {
+        string table = notify->extra;
+        PQfreemem(notify);
+        lg->write(log_level::trace, "", "",
+                  "Received refresh request: " + table, -1);
+        if (table != "")
+            tables->insert(table);
+    }
+}
+
+// Waits until a notification is received or the timeout in seconds
+// expires, and adds the tables whose refresh has been requested.
+// Repeated requests for a table are merged, including any that were
+// received while no one was waiting.
+void refresh_listener::wait(int timeout, set<string>* tables)
+{
+    if (enabled() && !db)
+        connect();
+    if (!db) {
+        std::this_thread::sleep_for(std::chrono::seconds(timeout));
+        return;
+    }
+    int sock = PQsocket(db->conn);
+    fd_set input;
+    FD_ZERO(&input);
+    FD_SET(sock, &input);
+    struct timeval tv;
+    tv.tv_sec = timeout;
+    tv.tv_usec = 0;
+    if (PQconsumeInput(db->conn) != 0)
+        read_notifications(tables);
+    if (tables->empty() && select(sock + 1, &input, NULL, NULL, &tv) < 0 &&
+            errno != EINTR) {
+        db.reset();
+        return;
+    }
+    if (PQconsumeInput(db->conn) == 0) {
+        string s = PQerrorMessage(db->conn);
+        if ( !(s.empty()) && s.back() == '\n' )
+            s.pop_back();
+        lg->write(log_level::warning, "server", "",
+                  "Lost connection for refresh requests:\n"
+                  "    Error: " + s, -1);
+        db.reset();
+        return;
+    }
+    read_notifications(tables);
+}
@@ -0,0 +1,36 @@
+#ifndef LDP_LISTEN_H
+#define LDP_LISTEN_H
+
+#include <memory>
+#include <set>
+#include <string>
+
+#include "../etymoncpp/include/postgres.h"
+#include "log.h"
+#include "options.h"
+
+using namespace std;
+
+// Channel on which refreshes of tables are requested, with the table
+// name as payload, e.g. NOTIFY ldp_refresh, 'circulation_loans'.
+const char refresh_channel[] = "ldp_refresh";
+
+// Listens for refresh requests on a libpq connection to the LDP
+// database.  ODBC does not support notifications, and so the
+// connection is made using the listen_database settings.  If these are
+// not configured, no requests are received.  A lost connection is
+// reopened on the next wait.
+class refresh_listener {
+public:
+    refresh_listener(const ldp_options& opt, ldp_log* lg);
+    bool enabled() const;
+    void wait(int timeout, set<string>* tables);
+private:
+    const ldp_options& opt;
+    ldp_log* lg;
+    unique_ptr<etymon::Postgres> db;
+    void connect();
+    void read_notifications(set<string>* tables);
+};
+
+#endif
@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
+#include <ctime>
+#include <fcntl.h>
 #include <stdexcept>
 #include <unistd.h>
 
@@ -6,24 +10,90 @@
 #include "log.h"
 
 ldp_log::ldp_log(etymon::odbc_conn* conn, log_level lv, bool console, bool quiet,
-        const char* program)
+        const char* program, const string& log_file) :
+    queue(nullptr), queued(0), urgent(false)
 {
-    this->conn = conn;
     this->lv = lv;
     this->console = console;
     this->quiet = quiet;
     this->program = program;
-    dbt = new dbtype(conn);
+    if (log_file != "") {
+        file = open(log_file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (file == -1)
+            throw runtime_error("Unable to open log file: " + log_file +
+                                ": " + strerror(errno));
+    }
+    if (conn != nullptr) {
+        dbt = new dbtype(conn);
+        dsn = conn->dsn;
+    }
+    writer = thread(&ldp_log::run_writer, this);
 }
 
 ldp_log::~ldp_log()
 {
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    cv.notify_one();
+    writer.join();
+    if (file != -1)
+        close(file);
     delete dbt;
 }
 
+// Formats the current time in UTC with microseconds, e.g.
+// 2021-03-10 12:34:56.789012+00, which is accepted as a timestamp with
+// time zone by the database.
+static void format_log_time(string* log_time)
+{
+    auto now = chrono::system_clock::now();
+    time_t t = chrono::system_clock::to_time_t(now);
+    long usec = (long) (chrono::duration_cast<chrono::microseconds>(
+            now.time_since_epoch()).count() % 1000000);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buffer[64];
+    size_t n = strftime(buffer, sizeof buffer, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buffer + n, sizeof buffer - n, ".%06ld+00", usec);
+    *log_time = buffer;
+}
+
 void ldp_log::write(log_level lv, const char* type, const string& table,
         const string& message, double elapsed_time)
 {
+    // Filter messages below selected log level before doing any work.
+    if (!enabled(lv))
+        return;
+    const char* level_str = "";
+    bool print = !quiet;
+    switch (lv) {
+    case log_level::fatal:
+        level_str = "fatal";
+        break;
+    case log_level::error:
+        level_str = "error";
+        break;
+    case log_level::warning:
+        level_str = "warning";
+        break;
+    case log_level::info:
+        level_str = "info";
+        break;
+    case log_level::debug:
+        print = console && !quiet;
+        level_str = "debug";
+        break;
+    case log_level::trace:
+        print = console && !quiet;
+        level_str = "trace";
+        break;
+    case log_level::detail:
+        print = console && !quiet;
+        break;
+    }
+
     // Add a prefix to highlight error states.
     string logmsg;
     switch (lv) {
@@ -47,72 +117,46 @@ void ldp_log::write(log_level lv, const char* type, const string& table,
     else
         sprintf(elapsed_time_str, "%.4f", elapsed_time);
 
+    // Print error states, and other messages if enabled for the console.
     // For printing, prefix with '\n' if the message has multiple lines.
-    string printmsg;
-    if (lv != log_level::detail && message.find('\n') != string::npos)
-        printmsg = "\n" + logmsg;
-    else
-        printmsg = logmsg;
-    if (elapsed_time >= 0)
-        printmsg += " [" + string(elapsed_time_str) + "]";
-
-    // Print error states and filter messages below selected log level.
-    const char* level_str;
-    switch (lv) {
-    case log_level::fatal:
-        if (!quiet)
-            fprintf(stderr, "%s: %s\n", program.c_str(), printmsg.c_str());
-        level_str = "fatal";
-        break;
-    case log_level::error:
-        if (!quiet)
-            fprintf(stderr, "%s: %s\n", program.c_str(), printmsg.c_str());
-        level_str = "error";
-        break;
-    case log_level::warning:
-        if (!quiet)
-            fprintf(stderr, "%s: %s\n", program.c_str(), printmsg.c_str());
-        level_str = "warning";
-        break;
-    case log_level::info:
-        if (!quiet)
+    if (print) {
+        string printmsg;
+        if (lv != log_level::detail && message.find('\n') != string::npos)
+            printmsg = "\n" + logmsg;
+        else
+            printmsg = logmsg;
+        if (elapsed_time >= 0)
+            printmsg += " [" + string(elapsed_time_str) + "]";
+        if (lv <= log_level::info)
             fprintf(stderr, "%s: %s\n", program.c_str(), printmsg.c_str());
-        level_str = "info";
-        break;
-    case log_level::debug:
-        if (this->lv != log_level::debug && this->lv != log_level::trace &&
-                this->lv != log_level::detail)
-            return;
-        if (console && !quiet)
+        else
             fprintf(stderr, "%s\n", printmsg.c_str());
-        level_str = "debug";
-        break;
-    case log_level::trace:
-        if (this->lv != log_level::trace && this->lv != log_level::detail)
-            return;
-        if (console && !quiet)
-            fprintf(stderr, "%s\n", printmsg.c_str());
-        level_str = "trace";
-        break;
-    case log_level::detail:
-        if (this->lv != log_level::detail)
-            return;
-        if (console && !quiet)
-            fprintf(stderr, "%s\n", printmsg.c_str());
-        return;
     }
 
-    // Log the message, and print if the log is not available.
-    string logmsg_encoded;
-    dbt->encode_string_const(logmsg.c_str(), &logmsg_encoded);
-    string sql =
-        "INSERT INTO dbsystem.log\n"
-        "    (log_time, pid, level, type, table_name, message, elapsed_time)\n"
-        "  VALUES\n"
-        "    (" + string(dbt->current_timestamp()) + ", " +
-        to_string(getpid()) + ", '" + level_str + "', '" + type + "', '" +
-        table + "', " + logmsg_encoded + ", " + elapsed_time_str + ");";
-    conn->exec(sql);
+    // Detailed messages are only printed.
+    if (lv == log_level::detail)
+        return;
+
+    // Add the message to the queue for the writer thread.
+    log_record* r = new log_record();
+    format_log_time(&(r->log_time));
+    r->level = level_str;
+    r->type = type;
+    r->table = table;
+    r->message = move(logmsg);
+    r->elapsed_time = elapsed_time_str;
+    r->printed = print;
+    r->next = queue.load(memory_order_relaxed);
+    while (!queue.compare_exchange_weak(r->next, r, memory_order_release,
+                                        memory_order_relaxed))
+        ;
+    size_t n = queued.fetch_add(1, memory_order_relaxed) + 1;
+    if (lv <= log_level::error) {
+        urgent.store(true, memory_order_relaxed);
+        cv.notify_one();
+    } else if (n == log_batch_size) {
+        cv.notify_one();
+    }
 }
 
 void ldp_log::warning(const string& message)
@@ -135,3 +179,193 @@ void ldp_log::perf(const string& message, double elapsed_time)
     write(log_level::debug, "perf", "", message, elapsed_time);
 }
 
+// Waits until all messages written before the call have been written by
+// the writer thread.
+void ldp_log::flush()
+{
+    unique_lock<mutex> lock(m);
+    uint64_t f = ++flush_requested;
+    cv.notify_one();
+    flushed_cv.wait(lock, [this, f] { return flushed >= f; });
+}
+
+// Forks the process after flushing the log, while the writer thread is
+// not using the database, so that the child does not inherit locks held
+// inside the ODBC driver.  The child should create its own log.
+pid_t ldp_log::fork_process()
+{
+    flush();
+    lock_guard<mutex> io(io_mutex);
+    return ::fork();
+}
+
+void ldp_log::run_writer()
+{
+    unique_lock<mutex> lock(m);
+    while (true) {
+        cv.wait_for(lock, chrono::milliseconds(log_flush_interval), [this] {
+            return stopping || flush_requested > flushed ||
+                urgent.load(memory_order_relaxed) ||
+                queued.load(memory_order_relaxed) >= log_batch_size;
+        });
+        bool stop = stopping;
+        uint64_t f = flush_requested;
+        lock.unlock();
+        write_queued();
+        lock.lock();
+        flushed = f;
+        flushed_cv.notify_all();
+        if (stop)
+            break;
+    }
+}
+
+// Takes all queued messages, which are in reverse order, and writes
+// them in the order they were added.
+void ldp_log::write_queued()
+{
+    urgent.store(false, memory_order_relaxed);
+    log_record* r = queue.exchange(nullptr, memory_order_acquire);
+    if (r == nullptr)
+        return;
+    vector<unique_ptr<log_record>> batch;
+    while (r != nullptr) {
+        log_record* next = r->next;
+        batch.push_back(unique_ptr<log_record>(r));
+        r = next;
+    }
+    queued.fetch_sub(batch.size(), memory_order_relaxed);
+    reverse(batch.begin(), batch.end());
+
+    lock_guard<mutex> io(io_mutex);
+    if (file != -1)
+        write_file(batch);
+    try {
+        write_database(batch);
+    } catch (runtime_error& e) {
+        conn.reset();
+        odbc.reset();
+        write_stderr(batch, e.what());
+    }
+}
+
+static void encode_json_string(const string& str, string* enc)
+{
+    char buffer[8];
+    for (char c : str) {
+        switch (c) {
+        case '"':
+            *enc += "\\\"";
+            break;
+        case '\\':
+            *enc += "\\\\";
+            break;
+        case '\n':
+            *enc += "\\n";
+            break;
+        case '\r':
+            *enc += "\\r";
+            break;
+        case '\t':
+            *enc += "\\t";
+            break;
+        default:
+            if ((unsigned char) c < 0x20) {
+                sprintf(buffer, "\\u%04X", (unsigned char) c);
+                *enc += buffer;
+            } else {
+                *enc += c;
+            }
+        }
+    }
+}
+
+// Appends the messages to the log file, one JSON object per line.  The
+// batch is appended with a single write where possible, so that lines
+// from several processes sharing the file are not mixed.
+void ldp_log::write_file(const vector<unique_ptr<log_record>>& batch)
+{
+    string pid = to_string(getpid());
+    string out;
+    for (auto& r : batch) {
+        string log_time = r->log_time;
+        log_time[10] = 'T';
+        log_time.replace(log_time.size() - 3, 3, "Z");
+        out += "{\"log_time\":\"" + log_time + "\",\"pid\":" + pid +
+            ",\"level\":\"" + r->level + "\",\"type\":\"";
+        encode_json_string(r->type, &out);
+        out += "\",\"table_name\":\"";
+        encode_json_string(r->table, &out);
+        out += "\",\"message\":\"";
+        encode_json_string(r->message, &out);
+        out += "\",\"elapsed_time\":" +
+            (r->elapsed_time == "NULL" ? "null" : r->elapsed_time) + "}\n";
+    }
+    const char* p = out.data();
+    size_t remaining = out.size();
+    while (remaining > 0) {
+        ssize_t n = ::write(file, p, remaining);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        p += n;
+        remaining -= n;
+    }
+}
+
+// Inserts the messages into dbsystem.log, several rows per statement,
+// connecting to the database if necessary.
+void ldp_log::write_database(const vector<unique_ptr<log_record>>& batch)
+{
+    if (dbt == nullptr)
+        return;
+    if (!conn) {
+        odbc.reset(new etymon::odbc_env());
+        conn.reset(new etymon::odbc_conn(odbc.get(), dsn));
+    }
+    string pid = to_string(getpid());
+    string sql;
+    size_t rows = 0;
+    for (size_t x = 0; x < batch.size(); x++) {
+        const log_record& r = *(batch[x]);
+        string message_encoded;
+        dbt->encode_string_const(r.message.c_str(), &message_encoded);
+        if (rows == 0)
+            sql =
+                "INSERT INTO dbsystem.log\n"
+                "    (log_time, pid, level, type, table_name, message, "
+                "elapsed_time)\n"
+                "  VALUES\n";
+        else
+            sql += ",\n";
+        sql += "    ('" + r.log_time + "', " + pid + ", '" + r.level +
+            "', '" + r.type + "', '" + r.table + "', " + message_encoded +
+            ", " + r.elapsed_time + ")";
+        rows++;
+        if (rows == log_batch_size || x == batch.size() - 1) {
+            sql += ";";
+            conn->exec(sql);
+            rows = 0;
+        }
+    }
+}
+
+// Prints messages that could not be written to the database, unless
+// they have already been printed or written to the log file.
+void ldp_log::write_stderr(const vector<unique_ptr<log_record>>& batch,
+                           const string& error)
+{
+    if (quiet)
+        return;
+    string s = error;
+    if ( !(s.empty()) && s.back() == '\n' )
+        s.pop_back();
+    fprintf(stderr, "%s: Unable to write to log: %s\n", program.c_str(),
+            s.c_str());
+    if (file != -1)
+        return;
+    for (auto& r : batch)
+        if (!r->printed)
+            fprintf(stderr, "%s: %s\n", program.c_str(), r->message.c_str());
+}
@@ -1,8 +1,16 @@
 #ifndef LDP_LOG_H
 #define LDP_LOG_H
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
 
 #include "../etymoncpp/include/odbc.h"
 #include "dbtype.h"
@@ -19,24 +27,84 @@ enum class log_level {
     detail
 };
 
+// Maximum number of messages inserted into dbsystem.log by one
+// statement.
+const size_t log_batch_size = 500;
+// Interval in milliseconds at which queued messages are written.
+const int log_flush_interval = 1000;
+
+// A message waiting to be written by the log writer thread.
+class log_record {
+public:
+    log_record* next = nullptr;
+    string log_time;
+    const char* level;
+    string type;
+    string table;
+    string message;
+    string elapsed_time;
+    // The message has already been printed to stderr.
+    bool printed;
+};
+
+// Writes log messages to dbsystem.log and optionally to a file of
+// newline-delimited JSON.  If the connection is null, messages are
+// only printed and written to the file.  Messages are added to a
+// lock-free queue and written in batches by a background thread on its
+// own connection, at least once per log_flush_interval and when the log
+// is destroyed.  Errors are written without waiting for the interval.
+// If the database is not available, messages that have not been
+// printed and are not in the log file are printed to stderr instead.
 class ldp_log {
 public:
     ldp_log(etymon::odbc_conn* conn, log_level lv, bool console, bool quiet,
-            const char* program);
+            const char* program, const string& log_file = "");
     ~ldp_log();
+    ldp_log(const ldp_log&) = delete;
+    ldp_log& operator=(const ldp_log&) = delete;
+    // Returns true if messages at the level are logged.  Messages that
+    // are costly to build should be built only if this is true, e.g.
+    //     if (lg->enabled(log_level::detail))
+    //         lg->detail("Record: " + record);
+    bool enabled(log_level lv) const {
+        return lv <= log_level::info || lv <= this->lv;
+    }
     void write(log_level lv, const char* type, const string& table,
             const string& message, double elapsed_time);
     void warning(const string& message);
     void trace(const string& message);
     void detail(const string& message);
     void perf(const string& message, double elapsed_time);
+    void flush();
+    pid_t fork_process();
 private:
     log_level lv;
     bool console = false;
     bool quiet = false;
-    etymon::odbc_conn* conn;
-    dbtype* dbt;
+    dbtype* dbt = nullptr;
+    string dsn;
     string program;
+    int file = -1;
+    atomic<log_record*> queue;
+    atomic<size_t> queued;
+    atomic<bool> urgent;
+    mutex m;
+    condition_variable cv;
+    condition_variable flushed_cv;
+    uint64_t flush_requested = 0;
+    uint64_t flushed = 0;
+    bool stopping = false;
+    // Held while messages are being written.
+    mutex io_mutex;
+    unique_ptr<etymon::odbc_env> odbc;
+    unique_ptr<etymon::odbc_conn> conn;
+    thread writer;
+    void run_writer();
+    void write_queued();
+    void write_file(const vector<unique_ptr<log_record>>& batch);
+    void write_database(const vector<unique_ptr<log_record>>& batch);
+    void write_stderr(const vector<unique_ptr<log_record>>& batch,
+                      const string& error);
 };
 
 #endif
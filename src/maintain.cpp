@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "dbtype.h"
+#include "maintain.h"
+#include "perf.h"
+#include "taskpool.h"
+#include "timer.h"
+
+class maintenance_task {
+public:
+    string table;
+    bool analyze = false;
+    bool vacuum = false;
+    bool vacuum_history = false;
+    int64_t rows = 0;
+};
+
+// Determines the maintenance needed for each table.  A table that was
+// replaced is new, so it needs only statistics; a table changed in
+// place is vacuumed and analyzed.  History tables are vacuumed and
+// analyzed only if rows were added or removed.  Tables without changes
+// are skipped.  An unknown number of rows (-1) is treated as a change.
+static void plan_maintenance(const map<string, table_changes>& changes,
+                             vector<maintenance_task>* tasks)
+{
+    for (auto& [table, c] : changes) {
+        maintenance_task t;
+        t.table = table;
+        if (c.replaced) {
+            t.analyze = true;
+        } else if (c.rows != 0) {
+            t.analyze = true;
+            t.vacuum = true;
+        }
+        t.vacuum_history = c.history_rows != 0;
+        if (!t.analyze && !t.vacuum_history)
+            continue;
+        t.rows = (c.rows < 0 || c.history_rows < 0) ?
+            INT64_MAX : c.rows + c.history_rows;
+        tasks->push_back(t);
+    }
+    // Tables with the most changes are started first, so that they do
+    // not finish last.
+    stable_sort(tasks->begin(), tasks->end(),
+                [](const maintenance_task& a, const maintenance_task& b) {
+                    return a.rows > b.rows;
+                });
+}
+
+static void run_maintenance_task(const ldp_options& opt, ldp_log* lg,
+                                 const maintenance_task& t,
+                                 etymon::odbc_conn* conn)
+{
+    timer task_timer(opt);
+    vector<string> stmts;
+    if (t.vacuum)
+        stmts.push_back("VACUUM " + t.table + ";");
+    if (t.analyze)
+        stmts.push_back("ANALYZE " + t.table + ";");
+    if (t.vacuum_history) {
+        stmts.push_back("VACUUM history." + t.table + ";");
+        stmts.push_back("ANALYZE history." + t.table + ";");
+    }
+    for (auto& sql : stmts) {
+        lg->detail(sql);
+        conn->exec(sql);
+    }
+    lg->write(log_level::debug, "update", t.table,
+              string("Maintained table: ") + t.table + ":" +
+              (t.vacuum ? " vacuum" : "") + (t.analyze ? " analyze" : "") +
+              (t.vacuum_history ? " history" : ""),
+              task_timer.elapsed_time());
+}
+
+// Vacuums and analyzes the tables that were changed during an update,
+// using up to opt.maintenance_connections connections.  Each worker
+// thread opens one connection and reuses it for its tasks.  In Redshift
+// only one vacuum can run at a time, and a single connection is used.
+void vacuum_analyze_tables(const ldp_options& opt, ldp_log* lg,
+                           etymon::odbc_env* odbc,
+                           const map<string, table_changes>& changes)
+{
+    vector<maintenance_task> tasks;
+    plan_maintenance(changes, &tasks);
+    if (tasks.empty())
+        return;
+    size_t threads = opt.maintenance_connections;
+    {
+        etymon::odbc_conn conn(odbc, opt.db);
+        dbtype dbt(&conn);
+        if (dbt.type() != dbsys::postgresql)
+            threads = 1;
+    }
+    if (threads > tasks.size())
+        threads = tasks.size();
+    task_pool pool(threads);
+    worker_local<etymon::odbc_conn> conns(pool, [&]() {
+        return unique_ptr<etymon::odbc_conn>(
+            new etymon::odbc_conn(odbc, opt.db));
+    });
+    perf_context* run_perf = perf_context::current();
+    task_group group(&pool);
+    for (size_t x = 0; x < tasks.size(); x++) {
+        group.run([&, x]() {
+            perf_context pc(run_perf, tasks[x].table);
+            perf_scope ps(perf_vacuum);
+            try {
+                run_maintenance_task(opt, lg, tasks[x], conns.get());
+            } catch (runtime_error& e) {
+                // The connection may be unusable after an error.
+                conns.reset();
+                string s = e.what();
+                if ( !(s.empty()) && s.back() == '\n' )
+                    s.pop_back();
+                lg->write(log_level::warning, "update", tasks[x].table,
+                          "Unable to vacuum/analyze table:\n"
+                          "    Table: " + tasks[x].table + "\n"
+                          "    Error: " + s, -1);
+            }
+        });
+    }
+    group.wait();
+}
@@ -0,0 +1,30 @@
+#ifndef LDP_MAINTAIN_H
+#define LDP_MAINTAIN_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "../etymoncpp/include/odbc.h"
+#include "log.h"
+#include "options.h"
+
+using namespace std;
+
+// Changes made to a table and its history table during an update.
+// Row counts of -1 mean that the number of rows is not known.
+class table_changes {
+public:
+    // The table was replaced by a newly created table.
+    bool replaced = false;
+    // Rows deleted, inserted, or updated in place in the table.
+    int64_t rows = 0;
+    // Rows inserted, updated, or deleted in the history table.
+    int64_t history_rows = 0;
+};
+
+void vacuum_analyze_tables(const ldp_options& opt, ldp_log* lg,
+                           etymon::odbc_env* odbc,
+                           const map<string, table_changes>& changes);
+
+#endif
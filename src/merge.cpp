@@ -1,85 +1,261 @@
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
 #include "merge.h"
 #include "names.h"
+#include "parallel.h"
+#include "perf.h"
 
-void create_latest_history_table(const ldp_options& opt, ldp_log* lg,
-                                 const table_schema& table,
-                                 etymon::odbc_conn* conn)
+// If keyframe_interval is greater than 0, the delta from the latest
+// version is computed for each changed record, together with its
+// position in the sequence of deltas since the last keyframe.
+static void select_history_changes_sql(const table_schema& table,
+                                      const string& where,
+                                      int keyframe_interval, string* sql)
 {
     string history_table;
     history_table_name(table.name, &history_table);
+    string loading_table;
+    loading_table_name(table.name, &loading_table);
+    string delta;
+    if (keyframe_interval > 0) {
+        string next_seq = "coalesce(h.delta_seq, 0) + 1";
+        delta =
+            "       CASE WHEN h.id IS NULL THEN NULL\n"
+            "            ELSE dbsystem.jsonb_diff((h.data)::JSONB,\n"
+            "                                     (s.data)::JSONB)\n"
+            "            END AS delta,\n"
+            "       CASE WHEN h.id IS NULL OR\n"
+            "                 " + next_seq + " >= " +
+            to_string(keyframe_interval) + " THEN 0\n"
+            "            ELSE " + next_seq + " END AS delta_seq,\n";
+    }
+    *sql =
+        "SELECT s.id,\n"
+        "       s.data,\n"
+        "       s.tenant_id,\n"
+        "       s.data_hash,\n" + delta +
+        "       ( h.id IS NULL OR\n"
+        "         h.data_hash IS NOT NULL OR\n"
+        "         (s.data)::VARCHAR <> (h.data)::VARCHAR ) AS changed\n"
+        "    FROM " + loading_table + " AS s\n"
+        "        LEFT JOIN " + history_table + "\n"
+        "            AS h\n"
+        "            ON s.tenant_id = h.tenant_id AND\n"
+        "               s.id = h.id AND\n"
+        "               h.latest\n"
+        "    WHERE s.data IS NOT NULL AND\n" + where +
+        "          ( h.id IS NULL OR\n"
+        "            h.data_hash IS NULL OR\n"
+        "            s.data_hash <> h.data_hash )";
+}
 
-    string latest_history_table;
-    latest_history_table_name(table.name, &latest_history_table);
+// Returns the condition on column selecting part number part of parts,
+// for splitting the range of ids.  The ranges are defined by the first
+// two hexadecimal digits of the id, which divides UUIDs evenly, and the
+// first and last ranges are open so that all ids are covered.
+void id_range_condition(const string& column, int part, int parts,
+                        string* where)
+{
+    char lo[3], hi[3];
+    snprintf(lo, sizeof lo, "%02x", part * 256 / parts);
+    snprintf(hi, sizeof hi, "%02x", (part + 1) * 256 / parts);
+    *where = "";
+    if (part > 0)
+        *where += "          " + column + " >= '" + string(lo) + "' AND\n";
+    if (part < parts - 1)
+        *where += "          " + column + " < '" + string(hi) + "' AND\n";
+}
 
-    string sql =
-        "CREATE TEMPORARY TABLE\n"
-        "    " + latest_history_table + "\n"
-        "    AS\n"
-        "SELECT id, data, tenant_id\n"
-        "    FROM " + history_table + " AS h1\n"
-        "    WHERE NOT EXISTS\n"
-        "      ( SELECT 1\n"
-        "            FROM " + history_table + " AS h2\n"
-        "            WHERE h1.tenant_id = h2.tenant_id AND\n"
-        "                  h1.id = h2.id AND\n"
-        "                  h1.updated < h2.updated\n"
-        "      );";
-    lg->write(log_level::detail, "", "", sql, -1);
-    conn->exec(sql);
+static void history_changes_part_name(const string& table, int part,
+                                      string* name)
+{
+    history_changes_table_name(table, name);
+    *name += "_" + to_string(part);
+}
 
-    sql = "VACUUM " + latest_history_table + ";";
-    lg->detail(sql);
-    conn->exec(sql);
-    sql = "ANALYZE " + latest_history_table + ";";
-    lg->detail(sql);
-    conn->exec(sql);
+// Compares the loading table with the history table in parallel, with
+// the range of ids split into the specified number of parts.  Each
+// part is compared on a separate connection, and the results are
+// written to a table for each part, to be applied to the history table
+// by merge_table().  The loading table must have been committed.
+void compare_history_parallel(const ldp_options& opt, ldp_log* lg,
+                              const table_schema& table,
+                              etymon::odbc_env* odbc, const dbtype& dbt,
+                              int parts, int keyframe_interval)
+{
+    perf_scope* scope = perf_scope::current();
+    parallel_for(parts, parts, [&](size_t part) {
+        perf_share share(scope);
+        etymon::odbc_conn conn(odbc, opt.db);
+        string changes_table;
+        history_changes_part_name(table.name, part, &changes_table);
+        string sql = "DROP TABLE IF EXISTS " + changes_table + ";";
+        lg->detail(sql);
+        conn.exec(sql);
+        string where;
+        id_range_condition("s.id", part, parts, &where);
+        string select;
+        select_history_changes_sql(table, where, keyframe_interval,
+                                   &select);
+        sql =
+            "CREATE " +
+            string(dbt.type() == dbsys::postgresql ? "UNLOGGED " : "") +
+            "TABLE\n"
+            "    " + changes_table + "\n"
+            "    AS\n" + select + ";";
+        lg->detail(sql);
+        conn.exec(sql);
+    });
+}
+
+// Adds a number of rows affected to a total.  If the number is not
+// known, the total is set to -1.
+static void add_row_count(int64_t rows, int64_t* total)
+{
+    if (rows < 0 || *total < 0)
+        *total = -1;
+    else
+        *total += rows;
 }
 
-void drop_latest_history_table(const ldp_options& opt, ldp_log* lg,
-                               const table_schema& table,
-                               etymon::odbc_conn* conn)
+static void apply_history_changes(ldp_log* lg, const table_schema& table,
+                                  etymon::odbc_conn* conn, const dbtype& dbt,
+                                  const string& history_changes_table,
+                                  int keyframe_interval,
+                                  int64_t* history_rows,
+                                  int64_t* history_inserted)
 {
-    string latest_history_table;
-    latest_history_table_name(table.name, &latest_history_table);
+    string history_table;
+    history_table_name(table.name, &history_table);
+
+    int64_t rows;
+    string sql =
+        "UPDATE " + history_table + " AS h\n"
+        "    SET data_hash = c.data_hash\n"
+        "    FROM " + history_changes_table + " AS c\n"
+        "    WHERE h.tenant_id = c.tenant_id AND\n"
+        "          h.id = c.id AND\n"
+        "          h.latest AND\n"
+        "          NOT c.changed;";
+    lg->write(log_level::detail, "", "", sql, -1);
+    conn->exec(sql, &rows);
+    add_row_count(rows, history_rows);
 
-    string sql = "DROP TABLE IF EXISTS " + latest_history_table + ";";
+    // With delta encoding, the data of the previous latest version are
+    // removed unless it is a keyframe, as they can be reconstructed from
+    // the preceding keyframe and deltas.
+    sql =
+        "UPDATE " + history_table + " AS h\n"
+        "    SET latest = FALSE,\n"
+        "        valid_to = " + dbt.current_timestamp() +
+        ( keyframe_interval > 0 ?
+          ",\n"
+          "        data = CASE WHEN h.delta_seq > 0 THEN NULL\n"
+          "                    ELSE h.data END\n" : "\n" ) +
+        "    FROM " + history_changes_table + " AS c\n"
+        "    WHERE h.tenant_id = c.tenant_id AND\n"
+        "          h.id = c.id AND\n"
+        "          h.latest AND\n"
+        "          c.changed;";
+    lg->write(log_level::detail, "", "", sql, -1);
+    conn->exec(sql, &rows);
+    add_row_count(rows, history_rows);
+
+    if (keyframe_interval > 0) {
+        sql =
+            "INSERT INTO " + history_table + "\n"
+            "    (id, data, updated, tenant_id, latest, data_hash,\n"
+            "     valid_from, delta, changed_fields, delta_seq)\n"
+            "SELECT id,\n"
+            "       data,\n" +
+            "       " + dbt.current_timestamp() + ",\n"
+            "       tenant_id,\n"
+            "       TRUE,\n"
+            "       data_hash,\n"
+            "       " + dbt.current_timestamp() + ",\n"
+            "       delta,\n"
+            "       dbsystem.jsonb_patch_fields(delta),\n"
+            "       delta_seq\n"
+            "    FROM " + history_changes_table + "\n"
+            "    WHERE changed;";
+    } else {
+        sql =
+            "INSERT INTO " + history_table + "\n"
+            "    (id, data, updated, tenant_id, latest, data_hash,\n"
+            "     valid_from)\n"
+            "SELECT id,\n"
+            "       data,\n" +
+            "       " + dbt.current_timestamp() + ",\n"
+            "       tenant_id,\n"
+            "       TRUE,\n"
+            "       data_hash,\n"
+            "       " + dbt.current_timestamp() + "\n"
+            "    FROM " + history_changes_table + "\n"
+            "    WHERE changed;";
+    }
+    lg->write(log_level::detail, "", "", sql, -1);
+    conn->exec(sql, &rows);
+    add_row_count(rows, history_rows);
+    add_row_count(rows, history_inserted);
+
+    sql = "DROP TABLE " + history_changes_table + ";";
     lg->detail(sql);
     conn->exec(sql);
 }
 
+// If parts is greater than 1, the comparison is expected to have been
+// done by compare_history_parallel() with the same number of parts.  If
+// keyframe_interval is greater than 0, history data are delta encoded
+// with every keyframe_interval-th version of a record stored in full;
+// this is supported only in PostgreSQL.  The number of history rows
+// inserted or updated is returned in history_rows, and the number
+// inserted in history_inserted, or -1 if the number is not known.
 void merge_table(const ldp_options& opt, ldp_log* lg,
                  const table_schema& table,
                  etymon::odbc_env* odbc, etymon::odbc_conn* conn,
-                 const dbtype& dbt)
+                 const dbtype& dbt, int parts, int keyframe_interval,
+                 int64_t* history_rows, int64_t* history_inserted)
 {
-    // Update history tables.
+    // Update history tables.  Only the latest version of each record is
+    // compared with the new data, and the latest flag is moved from the
+    // old version to the new version of each changed record.  The cost
+    // of the comparison depends on the size of the current data rather
+    // than the size of the history.
+    //
+    // Records are compared by the hash of their canonical JSON, which
+    // is computed during staging.  Versions that were added before
+    // hashes were introduced have no hash; these are compared as text
+    // once, and if unchanged they are assigned the new hash.
 
-    string history_table;
-    history_table_name(table.name, &history_table);
-
-    string latest_history_table;
-    latest_history_table_name(table.name, &latest_history_table);
+    *history_rows = 0;
+    *history_inserted = 0;
+    if (parts > 1) {
+        for (int part = 0; part < parts; part++) {
+            string changes_table;
+            history_changes_part_name(table.name, part, &changes_table);
+            apply_history_changes(lg, table, conn, dbt, changes_table,
+                                  keyframe_interval, history_rows,
+                                  history_inserted);
+        }
+        return;
+    }
 
-    string loading_table;
-    loading_table_name(table.name, &loading_table);
+    string history_changes_table;
+    history_changes_table_name(table.name, &history_changes_table);
 
+    string select;
+    select_history_changes_sql(table, "", keyframe_interval, &select);
     string sql =
-        "INSERT INTO " + history_table + "\n"
-        "    (id, data, updated, tenant_id)\n"
-        "SELECT s.id,\n"
-        "       s.data,\n" +
-        "       " + dbt.current_timestamp() + ",\n"
-        "       s.tenant_id\n"
-        "    FROM " + loading_table + " AS s\n"
-        "        LEFT JOIN " + latest_history_table + "\n"
-        "            AS h\n"
-        "            ON s.tenant_id = h.tenant_id AND\n"
-        "               s.id = h.id\n"
-        "    WHERE s.data IS NOT NULL AND\n"
-        "          ( h.id IS NULL OR\n"
-        "            (s.data)::VARCHAR <> (h.data)::VARCHAR );";
+        "CREATE TEMPORARY TABLE\n"
+        "    " + history_changes_table + "\n"
+        "    AS\n" + select + ";";
     lg->write(log_level::detail, "", "", sql, -1);
     conn->exec(sql);
+
+    apply_history_changes(lg, table, conn, dbt, history_changes_table,
+                          keyframe_interval, history_rows, history_inserted);
 }
 
 void drop_table(const ldp_options& opt, ldp_log* lg, const string& tableName,
@@ -90,6 +266,77 @@ void drop_table(const ldp_options& opt, ldp_log* lg, const string& tableName,
     conn->exec(sql);
 }
 
+// Moves the loading table into the shadow schema, where it remains
+// until publish_tables() is called.
+void shadow_table(const ldp_options& opt, ldp_log* lg,
+                  const table_schema& table, etymon::odbc_conn* conn)
+{
+    string loading_table;
+    loading_table_name(table.name, &loading_table);
+    string shadow_loading_table;
+    shadow_table_name(loading_table, &shadow_loading_table);
+    string shadow_table;
+    shadow_table_name(table.name, &shadow_table);
+    string sql = "DROP TABLE IF EXISTS " + shadow_table + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+    sql =
+        "ALTER TABLE " + loading_table + "\n"
+        "    SET SCHEMA ldp_shadow;";
+    lg->detail(sql);
+    conn->exec(sql);
+    sql =
+        "ALTER TABLE " + shadow_loading_table + "\n"
+        "    RENAME TO " + table.name + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+}
+
+// Replaces the tables in the public schema with those in the shadow
+// schema.  This should be called within a transaction so that all of
+// the tables are published at once.
+void publish_tables(const ldp_options& opt, ldp_log* lg,
+                    const vector<string>& tables, etymon::odbc_conn* conn)
+{
+    for (auto& table : tables) {
+        drop_table(opt, lg, table, conn);
+        string shadow_table;
+        shadow_table_name(table, &shadow_table);
+        string sql =
+            "ALTER TABLE " + shadow_table + "\n"
+            "    SET SCHEMA public;";
+        lg->detail(sql);
+        conn->exec(sql);
+    }
+}
+
+// Drops any tables left in the shadow schema by an incomplete update.
+void clear_shadow_tables(ldp_log* lg, etymon::odbc_conn* conn)
+{
+    string sql =
+        "SELECT table_name\n"
+        "    FROM information_schema.tables\n"
+        "    WHERE table_schema = 'ldp_shadow';";
+    lg->detail(sql);
+    vector<string> tables;
+    {
+        etymon::odbc_stmt stmt(conn);
+        conn->exec_direct(&stmt, sql);
+        while (conn->fetch(&stmt)) {
+            string table;
+            conn->get_data(&stmt, 1, &table);
+            tables.push_back(table);
+        }
+    }
+    for (auto& table : tables) {
+        string shadow_table;
+        shadow_table_name(table, &shadow_table);
+        sql = "DROP TABLE IF EXISTS " + shadow_table + " CASCADE;";
+        lg->detail(sql);
+        conn->exec(sql);
+    }
+}
+
 void place_table(const ldp_options& opt, ldp_log* lg, const table_schema& table,
         etymon::odbc_conn* conn)
 {
@@ -102,3 +349,115 @@ void place_table(const ldp_options& opt, ldp_log* lg, const table_schema& table,
     conn->exec(sql);
 }
 
+
+// Merges the loading table into the current table in place, leaving
+// its indexes, statistics, and constraints intact.  If unchanged
+// records were skipped during staging, cidx contains the change
+// indexes, and the loading table contains only new and changed
+// records while deleted records are listed in the deleted records
+// table.  Otherwise the loading table contains all records.  Returns
+// false if the table could not be upserted, in which case all changes
+// made by this function are rolled back.  The number of rows deleted,
+// inserted, or updated is returned in rows, or -1 if it is not known.
+bool upsert_table(const ldp_options& opt, ldp_log* lg,
+                  const table_schema& table, etymon::odbc_conn* conn,
+                  change_index_map* cidx, int64_t* rows)
+{
+    string loading_table;
+    loading_table_name(table.name, &loading_table);
+    string deleted_table;
+    deleted_records_table_name(table.name, &deleted_table);
+
+    string column_list = "id";
+    string update_list;
+    for (const auto& column : table.columns) {
+        if (column.name == "id")
+            continue;
+        column_list += ", \"" + column.name + "\"";
+        update_list += "\"" + column.name + "\" = EXCLUDED.\"" +
+            column.name + "\",\n"
+            "        ";
+    }
+    column_list += ", data, tenant_id, data_hash";
+    update_list +=
+        "data = EXCLUDED.data,\n"
+        "        tenant_id = EXCLUDED.tenant_id,\n"
+        "        data_hash = EXCLUDED.data_hash";
+
+    *rows = 0;
+    int64_t n;
+    string sql = "SAVEPOINT upsert_table;";
+    lg->detail(sql);
+    conn->exec(sql);
+    try {
+        if (cidx != nullptr) {
+            sql =
+                "DELETE FROM " + table.name + " AS m\n"
+                "    USING " + deleted_table + " AS d\n"
+                "    WHERE m.id = d.id AND\n"
+                "          m.tenant_id = d.tenant_id;";
+            lg->detail(sql);
+            conn->exec(sql, &n);
+            add_row_count(n, rows);
+            // Records that are not covered by the change indexes are
+            // deleted if they were not staged.
+            string tenants;
+            for (auto& [tenant_id, index] : *cidx) {
+                if (tenants != "")
+                    tenants += ",";
+                tenants += to_string(tenant_id);
+            }
+            sql =
+                "DELETE FROM " + table.name + " AS m\n"
+                "    WHERE ( m.tenant_id NOT IN (" + tenants + ") OR\n"
+                "            m.id !~ '" + canonical_uuid_pattern + "' ) AND\n"
+                "          NOT EXISTS (SELECT 1\n"
+                "                          FROM " + loading_table + " AS s\n"
+                "                          WHERE s.id = m.id);";
+            lg->detail(sql);
+            conn->exec(sql, &n);
+            add_row_count(n, rows);
+        } else {
+            sql =
+                "DELETE FROM " + table.name + " AS m\n"
+                "    WHERE NOT EXISTS (SELECT 1\n"
+                "                          FROM " + loading_table + " AS s\n"
+                "                          WHERE s.id = m.id);";
+            lg->detail(sql);
+            conn->exec(sql, &n);
+            add_row_count(n, rows);
+        }
+        sql =
+            "INSERT INTO " + table.name + " AS m\n"
+            "    (" + column_list + ")\n"
+            "SELECT " + column_list + "\n"
+            "    FROM " + loading_table + "\n"
+            "    ON CONFLICT (id) DO UPDATE\n"
+            "    SET " + update_list + "\n"
+            "    WHERE m.data_hash IS DISTINCT FROM EXCLUDED.data_hash;";
+        lg->detail(sql);
+        conn->exec(sql, &n);
+        add_row_count(n, rows);
+        if (cidx != nullptr) {
+            sql = "DROP TABLE " + deleted_table + ";";
+            lg->detail(sql);
+            conn->exec(sql);
+        }
+        sql = "DROP TABLE " + loading_table + ";";
+        lg->detail(sql);
+        conn->exec(sql);
+    } catch (runtime_error& e) {
+        string s = e.what();
+        if ( !(s.empty()) && s.back() == '\n' )
+            s.pop_back();
+        lg->detail(s);
+        sql = "ROLLBACK TO SAVEPOINT upsert_table;";
+        lg->detail(sql);
+        conn->exec(sql);
+        return false;
+    }
+    sql = "RELEASE SAVEPOINT upsert_table;";
+    lg->detail(sql);
+    conn->exec(sql);
+    return true;
+}
@@ -2,26 +2,36 @@
 #define LDP_MERGE_H
 
 #include <string>
+#include <vector>
 
 #include "../etymoncpp/include/postgres.h"
+#include "changeidx.h"
 #include "options.h"
 #include "schema.h"
 
 using namespace std;
 
-void create_latest_history_table(const ldp_options& opt, ldp_log* lg,
-                                 const table_schema& table,
-                                 etymon::odbc_conn* conn);
-void drop_latest_history_table(const ldp_options& opt, ldp_log* lg,
-                                 const table_schema& table,
-                                 etymon::odbc_conn* conn);
-
+void id_range_condition(const string& column, int part, int parts,
+                        string* where);
+void compare_history_parallel(const ldp_options& opt, ldp_log* lg,
+                              const table_schema& table,
+                              etymon::odbc_env* odbc, const dbtype& dbt,
+                              int parts, int keyframe_interval);
 void merge_table(const ldp_options& opt, ldp_log* lg, const table_schema& table,
                  etymon::odbc_env* odbc, etymon::odbc_conn* conn,
-                 const dbtype& dbt);
+                 const dbtype& dbt, int parts, int keyframe_interval,
+                 int64_t* history_rows, int64_t* history_inserted);
 void drop_table(const ldp_options& opt, ldp_log* lg, const string& tableName,
                 etymon::odbc_conn* conn);
 void place_table(const ldp_options& opt, ldp_log* lg, const table_schema& table,
                  etymon::odbc_conn* conn);
+void shadow_table(const ldp_options& opt, ldp_log* lg,
+                  const table_schema& table, etymon::odbc_conn* conn);
+void publish_tables(const ldp_options& opt, ldp_log* lg,
+                    const vector<string>& tables, etymon::odbc_conn* conn);
+void clear_shadow_tables(ldp_log* lg, etymon::odbc_conn* conn);
+bool upsert_table(const ldp_options& opt, ldp_log* lg,
+                  const table_schema& table, etymon::odbc_conn* conn,
+                  change_index_map* cidx, int64_t* rows);
 
 #endif
@@ -0,0 +1,399 @@
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <netinet/in.h>
+#include <new>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+static_assert(atomic<uint64_t>::is_always_lock_free,
+              "Metrics in shared memory require lock-free atomics");
+
+static const char* phase_names[] = {
+    "idle", "queued", "extract", "extracted", "stage", "staged", "merge"
+};
+
+static int64_t to_microseconds(double seconds)
+{
+    return seconds < 0 ? -1 : (int64_t) (seconds * 1000000);
+}
+
+void update_metrics::record_http_request(double seconds)
+{
+    size_t b = 0;
+    while (b < http_duration_bucket_count &&
+           seconds > http_duration_buckets[b])
+        b++;
+    http_durations[b].fetch_add(1, memory_order_relaxed);
+    http_duration_sum.fetch_add(to_microseconds(seconds),
+                                memory_order_relaxed);
+    pages_fetched.fetch_add(1, memory_order_relaxed);
+}
+
+void update_metrics::record_staged(uint64_t records, uint64_t bytes)
+{
+    records_staged.fetch_add(records, memory_order_relaxed);
+    bytes_loaded.fetch_add(bytes, memory_order_relaxed);
+}
+
+table_metrics* update_metrics::find_table(const string& table)
+{
+    for (size_t x = 0; x < table_count; x++)
+        if (table == tables[x].name)
+            return &(tables[x]);
+    return nullptr;
+}
+
+void update_metrics::set_phase(const string& table, table_phase phase)
+{
+    table_metrics* t = find_table(table);
+    if (t != nullptr)
+        t->phase.store((uint32_t) phase, memory_order_relaxed);
+}
+
+// Records the durations of the phases of a table that has been
+// updated, in seconds or -1 if not known.
+void update_metrics::record_table(const string& table, double extract_time,
+                                  double stage_time, double merge_time)
+{
+    tables_updated.fetch_add(1, memory_order_relaxed);
+    table_metrics* t = find_table(table);
+    if (t == nullptr)
+        return;
+    t->extract_time.store(to_microseconds(extract_time),
+                          memory_order_relaxed);
+    t->stage_time.store(to_microseconds(stage_time), memory_order_relaxed);
+    t->merge_time.store(to_microseconds(merge_time), memory_order_relaxed);
+    t->updated.store(time(nullptr), memory_order_relaxed);
+}
+
+void update_metrics::begin_update()
+{
+    update_running.store(1, memory_order_relaxed);
+}
+
+// Records the end of an update process.  Tables left in a phase by a
+// process that did not finish normally are reset.
+void update_metrics::end_update(double seconds, bool ok)
+{
+    for (size_t x = 0; x < table_count; x++)
+        tables[x].phase.store((uint32_t) table_phase::idle,
+                              memory_order_relaxed);
+    updates.fetch_add(1, memory_order_relaxed);
+    if (!ok)
+        update_failures.fetch_add(1, memory_order_relaxed);
+    last_update_time.store(to_microseconds(seconds), memory_order_relaxed);
+    last_update_end.store(time(nullptr), memory_order_relaxed);
+    update_running.store(0, memory_order_relaxed);
+}
+
+static void add_metric(const char* name, const char* type, const char* help,
+                       string* text)
+{
+    *text += string("# HELP ") + name + " " + help + "\n" +
+        "# TYPE " + name + " " + type + "\n";
+}
+
+static void add_sample(const string& name, double value, string* text)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof buffer, " %.15g\n", value);
+    *text += name + buffer;
+}
+
+static void add_sample(const string& name, uint64_t value, string* text)
+{
+    *text += name + " " + to_string(value) + "\n";
+}
+
+// Writes the metrics in the Prometheus text exposition format.
+void update_metrics::format(string* text) const
+{
+    text->clear();
+    add_metric("ldp_pages_fetched_total", "counter",
+               "Pages of data retrieved from sources.", text);
+    add_sample("ldp_pages_fetched_total",
+               pages_fetched.load(memory_order_relaxed), text);
+
+    add_metric("ldp_http_request_duration_seconds", "histogram",
+               "Duration of HTTP requests for pages of data.", text);
+    uint64_t count = 0;
+    for (size_t b = 0; b <= http_duration_bucket_count; b++) {
+        count += http_durations[b].load(memory_order_relaxed);
+        string le = "+Inf";
+        if (b < http_duration_bucket_count) {
+            char buffer[32];
+            snprintf(buffer, sizeof buffer, "%g", http_duration_buckets[b]);
+            le = buffer;
+        }
+        add_sample("ldp_http_request_duration_seconds_bucket{le=\"" + le +
+                   "\"}", count, text);
+    }
+    add_sample("ldp_http_request_duration_seconds_sum",
+               http_duration_sum.load(memory_order_relaxed) / 1e6, text);
+    add_sample("ldp_http_request_duration_seconds_count", count, text);
+
+    add_metric("ldp_records_staged_total", "counter",
+               "Records loaded into the database.", text);
+    add_sample("ldp_records_staged_total",
+               records_staged.load(memory_order_relaxed), text);
+
+    add_metric("ldp_bytes_loaded_total", "counter",
+               "Bytes of data loaded into the database.", text);
+    add_sample("ldp_bytes_loaded_total",
+               bytes_loaded.load(memory_order_relaxed), text);
+
+    add_metric("ldp_tables_updated_total", "counter",
+               "Tables that have been updated.", text);
+    add_sample("ldp_tables_updated_total",
+               tables_updated.load(memory_order_relaxed), text);
+
+    // Tables in each phase, including those waiting for the next phase,
+    // which are the queue depths.
+    uint64_t phase_counts[sizeof phase_names / sizeof phase_names[0]] = {};
+    for (size_t x = 0; x < table_count; x++) {
+        uint32_t p = tables[x].phase.load(memory_order_relaxed);
+        if (p < sizeof phase_names / sizeof phase_names[0])
+            phase_counts[p]++;
+    }
+    add_metric("ldp_tables_in_phase", "gauge",
+               "Tables in each phase of the running update.", text);
+    for (size_t p = 1; p < sizeof phase_names / sizeof phase_names[0]; p++)
+        add_sample(string("ldp_tables_in_phase{phase=\"") + phase_names[p] +
+                   "\"}", phase_counts[p], text);
+
+    add_metric("ldp_queue_depth", "gauge",
+               "Tables waiting for each phase of the running update.", text);
+    add_sample("ldp_queue_depth{queue=\"extract\"}",
+               phase_counts[(size_t) table_phase::queued], text);
+    add_sample("ldp_queue_depth{queue=\"stage\"}",
+               phase_counts[(size_t) table_phase::extracted], text);
+    add_sample("ldp_queue_depth{queue=\"merge\"}",
+               phase_counts[(size_t) table_phase::staged], text);
+
+    add_metric("ldp_table_phase", "gauge",
+               "Tables currently being extracted, staged, or merged.", text);
+    for (size_t x = 0; x < table_count; x++) {
+        table_phase p = (table_phase) tables[x].phase.load(
+                memory_order_relaxed);
+        if (p == table_phase::extract || p == table_phase::stage ||
+                p == table_phase::merge)
+            add_sample(string("ldp_table_phase{table=\"") + tables[x].name +
+                       "\",phase=\"" + phase_names[(size_t) p] + "\"}",
+                       (uint64_t) 1, text);
+    }
+
+    add_metric("ldp_table_last_update_duration_seconds", "gauge",
+               "Duration of each phase of the last update of a table.",
+               text);
+    for (size_t x = 0; x < table_count; x++) {
+        const table_metrics& t = tables[x];
+        const pair<const char*, int64_t> times[] = {
+            {"extract", t.extract_time.load(memory_order_relaxed)},
+            {"stage", t.stage_time.load(memory_order_relaxed)},
+            {"merge", t.merge_time.load(memory_order_relaxed)}
+        };
+        if (t.updated.load(memory_order_relaxed) == 0)
+            continue;
+        for (auto& [phase, us] : times)
+            if (us >= 0)
+                add_sample(string("ldp_table_last_update_duration_seconds"
+                                  "{table=\"") + t.name + "\",phase=\"" +
+                           phase + "\"}", us / 1e6, text);
+    }
+
+    add_metric("ldp_table_last_update_timestamp_seconds", "gauge",
+               "Time of the last update of a table.", text);
+    for (size_t x = 0; x < table_count; x++) {
+        int64_t updated = tables[x].updated.load(memory_order_relaxed);
+        if (updated != 0)
+            add_sample(string("ldp_table_last_update_timestamp_seconds"
+                              "{table=\"") + tables[x].name + "\"}",
+                       (uint64_t) updated, text);
+    }
+
+    add_metric("ldp_update_running", "gauge",
+               "Whether an update process is running.", text);
+    add_sample("ldp_update_running",
+               (uint64_t) update_running.load(memory_order_relaxed), text);
+
+    add_metric("ldp_updates_total", "counter",
+               "Update processes that have finished.", text);
+    add_sample("ldp_updates_total", updates.load(memory_order_relaxed),
+               text);
+
+    add_metric("ldp_update_failures_total", "counter",
+               "Update processes that did not finish normally.", text);
+    add_sample("ldp_update_failures_total",
+               update_failures.load(memory_order_relaxed), text);
+
+    int64_t end = last_update_end.load(memory_order_relaxed);
+    if (end != 0) {
+        add_metric("ldp_last_update_duration_seconds", "gauge",
+                   "Duration of the last update process.", text);
+        add_sample("ldp_last_update_duration_seconds",
+                   last_update_time.load(memory_order_relaxed) / 1e6, text);
+        add_metric("ldp_last_update_timestamp_seconds", "gauge",
+                   "Time at which the last update process finished.", text);
+        add_sample("ldp_last_update_timestamp_seconds", (uint64_t) end,
+                   text);
+    }
+}
+
+shared_metrics::shared_metrics(const vector<string>& tables)
+{
+    void* p = mmap(nullptr, sizeof(update_metrics), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        throw runtime_error(string("Unable to map shared memory: ") +
+                            strerror(errno));
+    // The mapping is zero-filled, which is the initial value of every
+    // member except the phase durations.
+    m = new (p) update_metrics();
+    m->table_count = 0;
+    for (auto& name : tables) {
+        if (m->table_count == metrics_max_tables)
+            break;
+        table_metrics& t = m->tables[m->table_count++];
+        snprintf(t.name, sizeof t.name, "%s", name.c_str());
+        t.extract_time = -1;
+        t.stage_time = -1;
+        t.merge_time = -1;
+    }
+}
+
+shared_metrics::~shared_metrics()
+{
+    m->~update_metrics();
+    munmap(m, sizeof(update_metrics));
+}
+
+update_metrics* shared_metrics::get()
+{
+    return m;
+}
+
+metrics_server::metrics_server(int port, const update_metrics* metrics) :
+    metrics(metrics)
+{
+    sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        throw runtime_error(string("Unable to create socket: ") +
+                            strerror(errno));
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr*) &addr, sizeof addr) == -1 ||
+            listen(sock, 16) == -1 || pipe(stop_pipe) == -1) {
+        string err = strerror(errno);
+        close(sock);
+        throw runtime_error("Unable to listen on port " + to_string(port) +
+                            ": " + err);
+    }
+    listener = thread(&metrics_server::run, this);
+}
+
+metrics_server::~metrics_server()
+{
+    char c = 0;
+    if (::write(stop_pipe[1], &c, 1) == 1)
+        listener.join();
+    else
+        listener.detach();
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    close(sock);
+}
+
+void metrics_server::run()
+{
+    while (true) {
+        struct pollfd fds[2];
+        fds[0].fd = sock;
+        fds[0].events = POLLIN;
+        fds[1].fd = stop_pipe[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[1].revents != 0)
+            return;
+        if ((fds[0].revents & POLLIN) == 0)
+            continue;
+        int fd = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1)
+            continue;
+        respond(fd);
+        close(fd);
+    }
+}
+
+static void write_all(int fd, const string& data)
+{
+    const char* p = data.data();
+    size_t remaining = data.size();
+    while (remaining > 0) {
+        ssize_t n = send(fd, p, remaining, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        p += n;
+        remaining -= n;
+    }
+}
+
+// Reads the request line and headers, and responds with the metrics if
+// the request is for /metrics.  A client that sends nothing is dropped
+// after a timeout, so that it cannot block other clients for long.
+void metrics_server::respond(int fd)
+{
+    struct timeval tv;
+    tv.tv_sec = 2;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+    string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == string::npos &&
+           request.size() < 8192) {
+        ssize_t n = recv(fd, buffer, sizeof buffer, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        request.append(buffer, n);
+    }
+    string status, type, body;
+    if (request.compare(0, 13, "GET /metrics ") == 0) {
+        status = "200 OK";
+        type = "text/plain; version=0.0.4";
+        metrics->format(&body);
+    } else if (request.compare(0, 4, "GET ") == 0) {
+        status = "404 Not Found";
+        type = "text/plain";
+        body = "Not found\n";
+    } else {
+        status = "405 Method Not Allowed";
+        type = "text/plain";
+        body = "Method not allowed\n";
+    }
+    write_all(fd, "HTTP/1.1 " + status + "\r\n"
+              "Content-Type: " + type + "\r\n"
+              "Content-Length: " + to_string(body.size()) + "\r\n"
+              "Connection: close\r\n"
+              "\r\n" + body);
+}
@@ -0,0 +1,118 @@
+#ifndef LDP_METRICS_H
+#define LDP_METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Live metrics of the server and its update processes are kept in a
+// shared memory segment, which is mapped by the server before it forks
+// an update process, and served in the Prometheus text format.
+
+// Phases in which a table can be during an update.  The phases
+// between extract, stage, and merge are waiting for the next one.
+enum class table_phase : uint32_t {
+    idle,
+    queued,
+    extract,
+    extracted,
+    stage,
+    staged,
+    merge
+};
+
+// Maximum number of tables and length of their names in the metrics.
+const size_t metrics_max_tables = 256;
+const size_t metrics_name_size = 64;
+
+// Upper bounds of the buckets of the HTTP request duration histogram,
+// in seconds.
+const double http_duration_buckets[] = {
+    0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60
+};
+const size_t http_duration_bucket_count =
+    sizeof http_duration_buckets / sizeof http_duration_buckets[0];
+
+class table_metrics {
+public:
+    char name[metrics_name_size];
+    atomic<uint32_t> phase;
+    // Durations of the phases of the last update in microseconds, or -1
+    // if not known.
+    atomic<int64_t> extract_time;
+    atomic<int64_t> stage_time;
+    atomic<int64_t> merge_time;
+    // Time of the last update, in seconds since the epoch, or 0.
+    atomic<int64_t> updated;
+};
+
+// Counters and gauges that are updated by any process sharing the
+// segment.  All members are lock-free atomics, so that a process that
+// stops while updating them cannot block the others.
+class update_metrics {
+public:
+    atomic<uint64_t> pages_fetched;
+    // HTTP request durations, counted in the first bucket that they
+    // fit, or in the last which has no upper bound.
+    atomic<uint64_t> http_durations[http_duration_bucket_count + 1];
+    atomic<uint64_t> http_duration_sum;  // Microseconds.
+    atomic<uint64_t> records_staged;
+    atomic<uint64_t> bytes_loaded;
+    atomic<uint64_t> tables_updated;
+    atomic<uint32_t> update_running;
+    atomic<uint64_t> updates;
+    atomic<uint64_t> update_failures;
+    // Duration in microseconds and end time in seconds since the epoch
+    // of the last update, or 0.
+    atomic<int64_t> last_update_time;
+    atomic<int64_t> last_update_end;
+    size_t table_count;
+    table_metrics tables[metrics_max_tables];
+    void record_http_request(double seconds);
+    void record_staged(uint64_t records, uint64_t bytes);
+    void set_phase(const string& table, table_phase phase);
+    void record_table(const string& table, double extract_time,
+                      double stage_time, double merge_time);
+    void begin_update();
+    void end_update(double seconds, bool ok);
+    void format(string* text) const;
+private:
+    table_metrics* find_table(const string& table);
+};
+
+// Owns a shared memory segment containing metrics for the named tables.
+// The segment remains mapped in processes forked while it exists.
+class shared_metrics {
+public:
+    explicit shared_metrics(const vector<string>& tables);
+    ~shared_metrics();
+    shared_metrics(const shared_metrics&) = delete;
+    shared_metrics& operator=(const shared_metrics&) = delete;
+    update_metrics* get();
+private:
+    update_metrics* m;
+};
+
+// Serves the metrics over HTTP on a local port, at the path /metrics,
+// from a background thread.
+class metrics_server {
+public:
+    metrics_server(int port, const update_metrics* metrics);
+    ~metrics_server();
+    metrics_server(const metrics_server&) = delete;
+    metrics_server& operator=(const metrics_server&) = delete;
+private:
+    const update_metrics* metrics;
+    int sock = -1;
+    int stop_pipe[2] = {-1, -1};
+    thread listener;
+    void run();
+    void respond(int fd);
+};
+
+#endif
@@ -5,9 +5,19 @@ void loading_table_name(const string& table, string* newtable)
     *newtable = "ldp_" + table;
 }
 
-void latest_history_table_name(const string& table, string* newtable)
+void history_changes_table_name(const string& table, string* newtable)
 {
-    *newtable = "history_latest_" + table;
+    *newtable = "history_changes_" + table;
+}
+
+void history_compact_table_name(const string& table, string* newtable)
+{
+    *newtable = "history_compact_" + table;
+}
+
+void deleted_records_table_name(const string& table, string* newtable)
+{
+    *newtable = "ldp_deleted_" + table;
 }
 
 void history_table_name(const string& table, string* newtable)
@@ -15,4 +25,9 @@ void history_table_name(const string& table, string* newtable)
     *newtable = "history." + table;
 }
 
+void shadow_table_name(const string& table, string* newtable)
+{
+    *newtable = "ldp_shadow." + table;
+}
+
 
@@ -6,8 +6,11 @@
 using namespace std;
 
 void loading_table_name(const string& table, string* newtable);
-void latest_history_table_name(const string& table, string* newtable);
+void history_changes_table_name(const string& table, string* newtable);
+void history_compact_table_name(const string& table, string* newtable);
+void deleted_records_table_name(const string& table, string* newtable);
 void history_table_name(const string& table, string* newtable);
+void shadow_table_name(const string& table, string* newtable);
 
 #endif
 
@@ -1,8 +1,11 @@
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <getopt.h>
 #include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "options.h"
 #include "err.h"
@@ -20,6 +23,22 @@ void config_set_profile(const string& profile_str, profile* prof)
     throw runtime_error("Unknown profile: " + profile_str);
 }
 
+// Checks that a trace file can be written.  The trace is written to a
+// temporary file in the same directory and then renamed, and so the
+// directory must be writable.
+static void check_trace_file(const string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+        throw runtime_error("Trace file is a directory: " + path);
+    size_t slash = path.rfind('/');
+    string dir = (slash == string::npos) ? "." :
+        (slash == 0 ? "/" : path.substr(0, slash));
+    if (access(dir.c_str(), W_OK) != 0)
+        throw runtime_error("Unable to write trace file: " + path + ": " +
+                            string(strerror(errno)));
+}
+
 static void evaloptlong(char* name, char* arg, ldp_options* opt)
 {
     if (!strcmp(name, "extract-only")) {
@@ -38,6 +57,10 @@ static void evaloptlong(char* name, char* arg, ldp_options* opt)
         config_set_profile(arg, &(opt->set_profile));
         return;
     }
+    if (!strcmp(name, "resume")) {
+        opt->resume = true;
+        return;
+    }
     if (!strcmp(name, "no-update")) {
         opt->no_update = true;
         return;
@@ -54,6 +77,11 @@ static void evaloptlong(char* name, char* arg, ldp_options* opt)
         opt->lg_level = log_level::trace;
         return;
     }
+    if (!strcmp(name, "trace-file")) {
+        check_trace_file(arg);
+        opt->trace_file = arg;
+        return;
+    }
     if (!strcmp(name, "detail")) {
         opt->lg_level = log_level::detail;
         return;
@@ -86,6 +114,10 @@ void config_set_command(const string& command_str, ldp_command* command)
         *command = ldp_command::update;
         return;
     }
+    if (command_str == "worker") {
+        *command = ldp_command::worker;
+        return;
+    }
     if (command_str == "help" || command_str == "") {
         *command = ldp_command::help;
         return;
@@ -103,10 +135,12 @@ int evalopt(const etymon::command_args& cargs, ldp_options *opt)
         { "no-update",    no_argument,       NULL, 0   },
         { "profile",      required_argument, NULL, 0   },
         { "quiet",        no_argument,       NULL, 0   },
+        { "resume",       no_argument,       NULL, 0   },
         { "sourcedir",    required_argument, NULL, 0   },
         { "savetemps",    no_argument,       NULL, 0   },
         { "table",        required_argument, NULL, 0   },
         { "trace",        no_argument,       NULL, 0   },
+        { "trace-file",   required_argument, NULL, 0   },
         { "verbose",      no_argument,       NULL, 'v' },
         { 0,              0,                 0,    0   }
     };
@@ -176,3 +210,12 @@ void config_set_environment(const string& env_str, deployment_environment* env)
     throw runtime_error("Unknown deployment environment: " + env_str);
 }
 
+
+// Returns true if a table is to be updated, which is limited by the
+// --table option and, in a refresh, by the tables requested.
+bool table_selected(const ldp_options& opt, const string& table)
+{
+    if (opt.table != "" && opt.table != table)
+        return false;
+    return opt.refresh_tables.empty() || opt.refresh_tables.count(table) > 0;
+}
@@ -2,6 +2,7 @@
 #define LDP_OPTIONS_H
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -11,11 +12,14 @@
 
 using namespace std;
 
+class update_metrics;
+
 enum class ldp_command {
     server,
     upgrade_database,
     init_database,
     update,
+    worker,
     help
 };
 
@@ -31,6 +35,11 @@ enum class deployment_environment {
     development
 };
 
+enum class merge_mode {
+    replace,
+    upsert
+};
+
 class direct_extraction {
 public:
     vector<string> table_names;
@@ -78,14 +87,27 @@ public:
     string db;
     string ldp_user = "ldp";
     string ldpconfig_user = "ldpconfig";
+    string listen_database_name;
+    string listen_database_host;
+    string listen_database_port = "5432";
+    string listen_database_user;
+    string listen_database_password;
     //bool unsafe = false;
     string table;
+    // Tables to refresh, or empty for a full update.
+    set<string> refresh_tables;
+    // Resume the last full update if it did not complete.
+    bool resume = false;
     bool anonymize = true;
     bool savetemps = false;
     FILE* err = stderr;
     bool verbose = false;  // Deprecated.
     bool debug = false;  // Deprecated.
     log_level lg_level = log_level::debug;
+    // File to which log messages are also written as JSON, or empty.
+    string log_file;
+    // File to which a trace of each update is written, or empty.
+    string trace_file;
     bool console = false;
     bool quiet = false;
     size_t page_size = 1000;
@@ -93,10 +115,26 @@ public:
     char **nargv = nullptr;
     const char* prog = "ldp";
     bool allow_destructive_tests = false;
+    bool change_index = false;
+    merge_mode merge = merge_mode::replace;
+    bool atomic_publish = false;
+    int publish_lock_timeout = 10;
+    bool distributed_update = false;
+    int merge_connections = 1;
+    int foreign_key_connections = 1;
+    int maintenance_connections = 1;
+    int extract_concurrency = 1;
+    int stage_concurrency = 1;
+    int merge_concurrency = 1;
+    // Local port on which the server serves live metrics, or 0.
+    int metrics_port = 0;
+    // Live metrics shared with the server, or null.
+    update_metrics* metrics = nullptr;
 };
 
 int evalopt(const etymon::command_args& cargs, ldp_options* opt);
 void debug_options(const ldp_options& o);
 void config_set_environment(const string& env_str, deployment_environment* env);
+bool table_selected(const ldp_options& opt, const string& table);
 
 #endif
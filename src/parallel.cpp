@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "taskpool.h"
+
+static mutex shared_pool_mutex;
+static task_pool* shared_pool = nullptr;
+static pid_t shared_pool_pid = 0;
+static size_t shared_pool_size = 0;
+
+// Sets the number of workers in the shared pool, which should be the
+// largest number of threads that will be requested by parallel_for().
+// It has no effect once the pool has been created.  If it is not
+// called, the pool has one worker per hardware thread.
+void parallel_init(size_t workers)
+{
+    lock_guard<mutex> lock(shared_pool_mutex);
+    if (shared_pool == nullptr)
+        shared_pool_size = workers;
+}
+
+// Returns the pool shared by all calls to parallel_for() in this
+// process.  The pool is created when first needed, and again in a
+// forked process, which does not inherit its workers.  The pool is
+// never destroyed, so that exiting the process does not wait for the
+// workers.
+static task_pool* parallel_pool()
+{
+    lock_guard<mutex> lock(shared_pool_mutex);
+    if (shared_pool == nullptr || shared_pool_pid != getpid()) {
+        size_t workers = shared_pool_size;
+        if (workers == 0)
+            workers = max(thread::hardware_concurrency(), 1u);
+        shared_pool = new task_pool(workers);
+        shared_pool_pid = getpid();
+    }
+    return shared_pool;
+}
+
+// Calls f(0), f(1), ..., f(count - 1) in the shared task pool, with at
+// most the specified number of calls, or the number of workers in the
+// pool, running at a time.  If any call throws an exception, the
+// remaining calls that have not started are skipped, and the first
+// exception is rethrown after the running calls have finished.
+void parallel_for(size_t count, size_t threads,
+                  const function<void(size_t)>& f)
+{
+    if (threads > count)
+        threads = count;
+    if (threads <= 1) {
+        for (size_t x = 0; x < count; x++)
+            f(x);
+        return;
+    }
+    task_pool* pool = parallel_pool();
+    if (threads > pool->size())
+        threads = pool->size();
+    task_group group(pool);
+    atomic<size_t> next(0);
+    for (size_t t = 0; t < threads; t++) {
+        group.run([&]() {
+            for (size_t x = next++; x < count && !group.cancelled();
+                 x = next++)
+                f(x);
+        });
+    }
+    group.wait();
+}
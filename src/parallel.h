@@ -0,0 +1,13 @@
+#ifndef LDP_PARALLEL_H
+#define LDP_PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+using namespace std;
+
+void parallel_init(size_t workers);
+void parallel_for(size_t count, size_t threads,
+                  const function<void(size_t)>& f);
+
+#endif
@@ -0,0 +1,106 @@
+#include <stdexcept>
+
+#include "partition.h"
+
+// History tables in PostgreSQL are partitioned by range on the updated
+// column.  Each partition covers one interval, which can be a day,
+// week, month, or year.  Partitions are named after the history table
+// and the start of the interval, e.g. history.circulation_loans_p20201001.
+
+bool valid_partition_interval(const string& interval)
+{
+    return (interval == "day" || interval == "week" || interval == "month" ||
+            interval == "year");
+}
+
+static void select_value(etymon::odbc_conn* conn, const string& sql,
+                         string* value)
+{
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    if (conn->fetch(&stmt))
+        conn->get_data(&stmt, 1, value);
+    else
+        *value = "NULL";
+}
+
+// Creates any missing partitions of a history table, through the end of
+// the interval following the current one.  Partitions are added after
+// the last existing partition.  If there are no partitions, the first
+// partition begins with the interval containing start, which is an SQL
+// timestamp expression, or with the current interval if start is empty
+// or evaluates to NULL.  The statements that create partitions are
+// returned in statements.  Nothing is done if the history table is not
+// partitioned.
+void ensure_history_partitions(etymon::odbc_conn* conn, const string& table,
+                               const string& interval, const string& start,
+                               vector<string>* statements)
+{
+    statements->clear();
+    if (!valid_partition_interval(interval))
+        throw runtime_error("Invalid history partition interval: " +
+                            interval);
+    string history_table = "history." + table;
+
+    string relkind;
+    string sql =
+        "SELECT c.relkind\n"
+        "    FROM pg_class AS c\n"
+        "        JOIN pg_namespace AS n ON n.oid = c.relnamespace\n"
+        "    WHERE n.nspname = 'history' AND\n"
+        "          c.relname = '" + table + "';";
+    select_value(conn, sql, &relkind);
+    if (relkind != "p")
+        return;
+
+    // Find the end of the last partition.
+    string from;
+    sql =
+        "SELECT max((regexp_match(pg_get_expr(c.relpartbound, c.oid),\n"
+        "                         'TO \\(''([^'']+)''\\)'))[1]::TIMESTAMPTZ)\n"
+        "    FROM pg_inherits AS i\n"
+        "        JOIN pg_class AS c ON c.oid = i.inhrelid\n"
+        "    WHERE i.inhparent = '" + history_table + "'::regclass;";
+    select_value(conn, sql, &from);
+    if (from == "NULL") {
+        string start_expr = "CURRENT_TIMESTAMP";
+        if (start != "")
+            start_expr = "coalesce(" + start + ", CURRENT_TIMESTAMP)";
+        sql = "SELECT date_trunc('" + interval + "', " + start_expr + ");";
+        select_value(conn, sql, &from);
+    }
+
+    string until;
+    sql =
+        "SELECT date_trunc('" + interval + "', CURRENT_TIMESTAMP) +\n"
+        "       INTERVAL '2 " + interval + "';";
+    select_value(conn, sql, &until);
+
+    while (true) {
+        sql =
+            "SELECT date_trunc('" + interval + "', TIMESTAMPTZ '" + from +
+            "') +\n"
+            "           INTERVAL '1 " + interval + "',\n"
+            "       to_char(TIMESTAMPTZ '" + from + "', 'YYYYMMDD'),\n"
+            "       TIMESTAMPTZ '" + from + "' < TIMESTAMPTZ '" + until + "';";
+        string to, suffix, more;
+        {
+            etymon::odbc_stmt stmt(conn);
+            conn->exec_direct(&stmt, sql);
+            conn->fetch(&stmt);
+            conn->get_data(&stmt, 1, &to);
+            conn->get_data(&stmt, 2, &suffix);
+            conn->get_data(&stmt, 3, &more);
+        }
+        if (more != "1")
+            break;
+        sql =
+            "CREATE TABLE IF NOT EXISTS\n"
+            "    " + history_table + "_p" + suffix + "\n"
+            "    PARTITION OF " + history_table + "\n"
+            "    FOR VALUES FROM ('" + from + "') TO ('" + to + "');";
+        conn->exec(sql);
+        statements->push_back(sql);
+        from = to;
+    }
+}
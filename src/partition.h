@@ -0,0 +1,17 @@
+#ifndef LDP_PARTITION_H
+#define LDP_PARTITION_H
+
+#include <string>
+#include <vector>
+
+#include "../etymoncpp/include/odbc.h"
+
+using namespace std;
+
+bool valid_partition_interval(const string& interval);
+
+void ensure_history_partitions(etymon::odbc_conn* conn, const string& table,
+                               const string& interval, const string& start,
+                               vector<string>* statements);
+
+#endif
@@ -0,0 +1,226 @@
+#include <ctime>
+
+#include "perf.h"
+
+// Maximum number of rows inserted into dbsystem.perf by one statement.
+static const size_t perf_batch_size = 500;
+
+static thread_local perf_context* current_context = nullptr;
+static thread_local perf_scope* current_scope = nullptr;
+
+void perf_counters::add(const perf_counters& c)
+{
+    wall_time += c.wall_time;
+    cpu_time += c.cpu_time;
+    records += c.records;
+    bytes_in += c.bytes_in;
+    bytes_out += c.bytes_out;
+    round_trips += c.round_trips;
+}
+
+void perf_counters::subtract(const perf_counters& c)
+{
+    wall_time -= c.wall_time;
+    cpu_time -= c.cpu_time;
+    records -= c.records;
+    bytes_in -= c.bytes_in;
+    bytes_out -= c.bytes_out;
+    round_trips -= c.round_trips;
+}
+
+// Reads the clocks and database counters of the calling thread.
+static void sample(perf_counters* c)
+{
+    c->wall_time = chrono::duration<double>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    c->cpu_time = ts.tv_sec + ts.tv_nsec / 1e9;
+    c->records = 0;
+    const etymon::odbc_counters& oc = etymon::odbc_thread_counters();
+    c->bytes_in = oc.bytes_received;
+    c->bytes_out = oc.bytes_sent;
+    c->round_trips = oc.round_trips;
+}
+
+// Returns the counters accumulated since a sample was taken.
+static void elapsed(const perf_counters& start, perf_counters* c)
+{
+    sample(c);
+    c->subtract(start);
+}
+
+void perf_log::add(const perf_record& r)
+{
+    lock_guard<mutex> lock(m);
+    for (auto& e : records) {
+        if (e.run_id == r.run_id && e.table == r.table &&
+                e.phase == r.phase) {
+            e.counters.add(r.counters);
+            if (r.started < e.started)
+                e.started = r.started;
+            return;
+        }
+    }
+    records.push_back(r);
+}
+
+void perf_log::take(vector<perf_record>* rs)
+{
+    rs->clear();
+    lock_guard<mutex> lock(m);
+    rs->swap(records);
+}
+
+static void format_time(chrono::system_clock::time_point tp, string* str)
+{
+    time_t t = chrono::system_clock::to_time_t(tp);
+    long usec = (long) (chrono::duration_cast<chrono::microseconds>(
+            tp.time_since_epoch()).count() % 1000000);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buffer[64];
+    size_t n = strftime(buffer, sizeof buffer, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buffer + n, sizeof buffer - n, ".%06ld+00", usec);
+    *str = buffer;
+}
+
+// Inserts the collected records into dbsystem.perf, several rows per
+// statement, and clears them.
+void perf_log::write(etymon::odbc_conn* conn, ldp_log* lg)
+{
+    vector<perf_record> rs;
+    take(&rs);
+    string sql;
+    size_t rows = 0;
+    for (size_t x = 0; x < rs.size(); x++) {
+        const perf_record& r = rs[x];
+        const perf_counters& c = r.counters;
+        string started;
+        format_time(r.started, &started);
+        if (rows == 0)
+            sql =
+                "INSERT INTO dbsystem.perf\n"
+                "    (run_id, table_name, phase, started, wall_time, "
+                "cpu_time,\n"
+                "        records, bytes_in, bytes_out, round_trips)\n"
+                "VALUES\n";
+        else
+            sql += ",\n";
+        sql += "    (" + to_string(r.run_id) + ", '" + r.table + "', '" +
+            r.phase + "', '" + started + "', " + to_string(c.wall_time) +
+            ", " + to_string(c.cpu_time) + ", " + to_string(c.records) +
+            ", " + to_string(c.bytes_in) + ", " + to_string(c.bytes_out) +
+            ", " + to_string(c.round_trips) + ")";
+        rows++;
+        if (rows == perf_batch_size || x == rs.size() - 1) {
+            sql += ";";
+            lg->detail(sql);
+            conn->exec(sql);
+            rows = 0;
+        }
+    }
+}
+
+perf_context::perf_context(perf_log* log, int64_t run_id,
+                           const string& table) :
+    log(log), run_id(run_id), table(table), prev(current_context)
+{
+    current_context = this;
+}
+
+perf_context::perf_context(const perf_context* parent, const string& table) :
+    log(parent != nullptr ? parent->log : nullptr),
+    run_id(parent != nullptr ? parent->run_id : 0), table(table),
+    prev(current_context)
+{
+    current_context = this;
+}
+
+perf_context::~perf_context()
+{
+    current_context = prev;
+}
+
+perf_context* perf_context::current()
+{
+    return current_context;
+}
+
+perf_scope::perf_scope(const char* phase) :
+    phase(phase), ctx(current_context), parent(current_scope),
+    started(chrono::system_clock::now())
+{
+    sample(&start);
+    current_scope = this;
+}
+
+// Records the scope, excluding the time and database calls of nested
+// scopes, which are recorded separately, and adds its totals to those
+// of the enclosing scope.
+perf_scope::~perf_scope()
+{
+    current_scope = parent;
+    perf_counters total;
+    elapsed(start, &total);
+    if (parent != nullptr)
+        parent->children.add(total);
+    if (ctx == nullptr || ctx->log == nullptr)
+        return;
+    perf_record r;
+    r.run_id = ctx->run_id;
+    r.table = ctx->table;
+    r.phase = phase;
+    r.started = started;
+    r.counters = total;
+    r.counters.subtract(children);
+    r.counters.add(own);
+    {
+        lock_guard<mutex> lock(shared_mutex);
+        r.counters.add(shared);
+    }
+    ctx->log->add(r);
+}
+
+void perf_scope::count(uint64_t records, uint64_t bytes_in,
+                       uint64_t bytes_out)
+{
+    own.records += records;
+    own.bytes_in += bytes_in;
+    own.bytes_out += bytes_out;
+}
+
+// The wall time of work done by other threads overlaps with that of the
+// scope, and so only its CPU time and database calls are added.
+void perf_scope::add_shared(const perf_counters& c)
+{
+    perf_counters s = c;
+    s.wall_time = 0;
+    lock_guard<mutex> lock(shared_mutex);
+    shared.add(s);
+}
+
+perf_scope* perf_scope::current()
+{
+    return current_scope;
+}
+
+perf_share::perf_share(perf_scope* scope) : scope(scope)
+{
+    sample(&start);
+}
+
+perf_share::~perf_share()
+{
+    if (scope == nullptr)
+        return;
+    perf_counters c;
+    elapsed(start, &c);
+    scope->add_shared(c);
+}
+
+void perf_count(uint64_t records, uint64_t bytes_in, uint64_t bytes_out)
+{
+    if (current_scope != nullptr)
+        current_scope->count(records, bytes_in, bytes_out);
+}
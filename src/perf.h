@@ -0,0 +1,132 @@
+#ifndef LDP_PERF_H
+#define LDP_PERF_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../etymoncpp/include/odbc.h"
+#include "log.h"
+
+using namespace std;
+
+// The work done in each phase of an update is measured by perf_scope
+// objects and written to dbsystem.perf, with one row per run, table,
+// and phase.  A scope is attributed to the run and table set by the
+// innermost perf_context in the same thread.  Scopes can be nested, in
+// which case the time and database calls of an inner scope are not
+// counted in the outer one.
+
+// Phases recorded in dbsystem.perf.
+const char perf_extract[] = "extract";
+const char perf_pass1[] = "pass1";
+const char perf_pass2[] = "pass2";
+const char perf_index[] = "index";
+const char perf_merge[] = "merge";
+const char perf_publish[] = "publish";
+const char perf_vacuum[] = "vacuum";
+const char perf_fk[] = "fk";
+
+// Measurements of a phase.  Times are in seconds.  Bytes in are read
+// from the source, from data files, or from the database, and bytes
+// out are written to data files or sent to the database.  Round trips
+// are database statements executed and transactions ended.
+class perf_counters {
+public:
+    double wall_time = 0;
+    double cpu_time = 0;
+    uint64_t records = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t round_trips = 0;
+    void add(const perf_counters& c);
+    void subtract(const perf_counters& c);
+};
+
+class perf_record {
+public:
+    int64_t run_id;
+    string table;
+    string phase;
+    chrono::system_clock::time_point started;
+    perf_counters counters;
+};
+
+// Collects the measurements of a process until they are written.
+// Records with the same run, table, and phase are combined.
+class perf_log {
+public:
+    void add(const perf_record& r);
+    // Removes and returns the collected records.
+    void take(vector<perf_record>* rs);
+    void write(etymon::odbc_conn* conn, ldp_log* lg);
+private:
+    mutex m;
+    vector<perf_record> records;
+};
+
+// Sets the run and table to which scopes in the calling thread are
+// attributed, while the object exists.  If the log is null, nothing is
+// recorded.
+class perf_context {
+public:
+    perf_context(perf_log* log, int64_t run_id, const string& table);
+    // Context for the same run as another, which may belong to
+    // another thread, e.g. for a task that works on one table.
+    perf_context(const perf_context* parent, const string& table);
+    ~perf_context();
+    perf_context(const perf_context&) = delete;
+    perf_context& operator=(const perf_context&) = delete;
+    // Returns the innermost context in the calling thread, or null.
+    static perf_context* current();
+    perf_log* log;
+    int64_t run_id;
+    string table;
+private:
+    perf_context* prev;
+};
+
+// Measures a phase from construction to destruction.
+class perf_scope {
+public:
+    explicit perf_scope(const char* phase);
+    ~perf_scope();
+    perf_scope(const perf_scope&) = delete;
+    perf_scope& operator=(const perf_scope&) = delete;
+    // Adds records processed and bytes read or written that are not
+    // counted automatically, such as data files.
+    void count(uint64_t records, uint64_t bytes_in, uint64_t bytes_out);
+    // Adds work done for this scope by another thread.
+    void add_shared(const perf_counters& c);
+    // Returns the innermost scope in the calling thread, or null.
+    static perf_scope* current();
+private:
+    const char* phase;
+    perf_context* ctx;
+    perf_scope* parent;
+    chrono::system_clock::time_point started;
+    perf_counters start;
+    perf_counters own;
+    perf_counters children;
+    mutex shared_mutex;
+    perf_counters shared;
+};
+
+// Measures work done by the calling thread on behalf of a scope in
+// another thread, e.g. by a task in a pool, and adds it to that scope
+// when destroyed.  The scope may be null.
+class perf_share {
+public:
+    explicit perf_share(perf_scope* scope);
+    ~perf_share();
+private:
+    perf_scope* scope;
+    perf_counters start;
+};
+
+// Adds to the innermost scope in the calling thread, if there is one.
+void perf_count(uint64_t records, uint64_t bytes_in, uint64_t bytes_out);
+
+#endif
@@ -0,0 +1,111 @@
+#include <mutex>
+#include <stdexcept>
+
+#include "scheduler.h"
+
+size_t task_scheduler::add_resource(size_t limit)
+{
+    resource r;
+    r.limit = (limit > 0 ? limit : 1);
+    resources.push_back(r);
+    return resources.size() - 1;
+}
+
+size_t task_scheduler::add_task(size_t resource, double priority,
+                                const function<void()>& f)
+{
+    task t;
+    t.resource = resource;
+    t.priority = priority;
+    t.f = f;
+    tasks.push_back(t);
+    return tasks.size() - 1;
+}
+
+void task_scheduler::add_dependency(size_t task, size_t prerequisite)
+{
+    tasks[prerequisite].dependents.push_back(task);
+    tasks[task].waiting++;
+}
+
+void task_scheduler::run(task_pool* pool)
+{
+    mutex m;
+    vector<size_t> ready;
+    for (size_t x = 0; x < tasks.size(); x++)
+        if (tasks[x].waiting == 0)
+            ready.push_back(x);
+    size_t remaining = tasks.size();
+    task_group group(pool);
+
+    // Selects the next task to start, or returns false if none can be
+    // started now.  The caller must hold the lock.
+    auto next_task = [&](size_t* next) {
+        bool found = false;
+        size_t found_pos = 0;
+        for (size_t p = 0; p < ready.size(); p++) {
+            const task& t = tasks[ready[p]];
+            const resource& r = resources[t.resource];
+            if (r.running >= r.limit)
+                continue;
+            if (!found || t.priority > tasks[ready[found_pos]].priority ||
+                    (t.priority == tasks[ready[found_pos]].priority &&
+                     ready[p] < ready[found_pos])) {
+                found = true;
+                found_pos = p;
+            }
+        }
+        if (found) {
+            *next = ready[found_pos];
+            ready.erase(ready.begin() + found_pos);
+        }
+        return found;
+    };
+
+    // Submits to the pool the ready tasks that can start now.  Tasks
+    // are submitted after the lock is released, because the pool may
+    // run a task in the submitting thread.
+    function<void(size_t)> run_task;
+    auto dispatch = [&]() {
+        vector<size_t> start;
+        {
+            lock_guard<mutex> lock(m);
+            size_t x;
+            while (!group.cancelled() && next_task(&x)) {
+                resources[tasks[x].resource].running++;
+                start.push_back(x);
+            }
+        }
+        for (size_t x : start)
+            group.run([&run_task, x]() { run_task(x); });
+    };
+
+    // Releases the resource and dependents of a finished task.
+    auto finish_task = [&](size_t x) {
+        lock_guard<mutex> lock(m);
+        task& t = tasks[x];
+        resources[t.resource].running--;
+        remaining--;
+        for (size_t d : t.dependents)
+            if (--(tasks[d].waiting) == 0)
+                ready.push_back(d);
+    };
+
+    run_task = [&](size_t x) {
+        try {
+            tasks[x].f();
+        } catch (...) {
+            finish_task(x);
+            throw;
+        }
+        finish_task(x);
+        dispatch();
+    };
+
+    dispatch();
+    group.wait();
+    // If no task failed and some did not run, the remaining tasks
+    // depend on each other and cannot start.
+    if (remaining > 0)
+        throw runtime_error("Task dependencies contain a cycle");
+}
@@ -0,0 +1,47 @@
+#ifndef LDP_SCHEDULER_H
+#define LDP_SCHEDULER_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "taskpool.h"
+
+using namespace std;
+
+// Runs a set of tasks with dependencies between them.  Each task uses
+// one resource class, and each resource class has a limit on the
+// number of its tasks that run at the same time.  When a resource is
+// available, the ready task with the highest priority is started, or
+// if priorities are equal the task that was added first.
+class task_scheduler {
+public:
+    size_t add_resource(size_t limit);
+    size_t add_task(size_t resource, double priority,
+                    const function<void()>& f);
+    // The task will not start until the prerequisite has finished.
+    void add_dependency(size_t task, size_t prerequisite);
+    // Runs all tasks in the pool.  If a task throws an exception, no
+    // more tasks are started, and the first exception is rethrown after
+    // the running tasks have finished.  The pool should have at least as
+    // many workers as the sum of the resource limits.
+    void run(task_pool* pool);
+private:
+    class resource {
+    public:
+        size_t limit;
+        size_t running = 0;
+    };
+    class task {
+    public:
+        size_t resource;
+        double priority;
+        function<void()> f;
+        vector<size_t> dependents;
+        size_t waiting = 0;
+    };
+    vector<resource> resources;
+    vector<task> tasks;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <experimental/filesystem>
 #include <map>
@@ -7,11 +8,16 @@
 
 #include "../etymoncpp/include/mallocptr.h"
 #include "../etymoncpp/include/postgres.h"
+#include "../etymoncpp/include/trace.h"
 #include "../etymoncpp/include/util.h"
 #include "anonymize.h"
 #include "camelcase.h"
+#include "changeidx.h"
 #include "dbtype.h"
+#include "hash.h"
+#include "metrics.h"
 #include "names.h"
+#include "perf.h"
 #include "rapidjson/document.h"
 #include "rapidjson/filereadstream.h"
 #include "rapidjson/pointer.h"
@@ -196,13 +202,19 @@ public:
     size_t record_count = 0;
     size_t total_record_count = 0;
     string insert_buffer;
+    // Change detection
+    change_index* cidx;
+    // Foreign key detection
+    table_ids* tids;
     JSONHandler(int pass, const ldp_options& options, ldp_log* lg,
                 const table_schema& table, etymon::odbc_conn* conn,
                 const dbtype& dbt, bool anonymize_fields, int16_t tenant_id,
-                map<string,type_counts>* statistics) :
+                map<string,type_counts>* statistics, change_index* cidx,
+                table_ids* tids) :
         pass(pass), opt(options), lg(lg), table(table),
         stats(statistics), conn(conn), dbt(dbt),
-        anonymize_fields(anonymize_fields), tenant_id(tenant_id) {}
+        anonymize_fields(anonymize_fields), tenant_id(tenant_id),
+        cidx(cidx), tids(tids) {}
     bool StartObject();
     bool EndObject(json::SizeType memberCount);
     bool StartArray();
@@ -242,14 +254,16 @@ static void end_inserts(const ldp_options& opt, ldp_log* lg,
                         etymon::odbc_conn* conn)
 {
     *buffer += ";\n";
-    lg->write(log_level::detail, "", "", "Loading data for table: " + table,
-              -1);
+    if (lg->enabled(log_level::detail))
+        lg->write(log_level::detail, "", "",
+                  "Loading data for table: " + table, -1);
     conn->exec(*buffer);
     buffer->clear();
 }
 
 static void writeTuple(const ldp_options& opt, ldp_log* lg, const dbtype& dbt,
         const table_schema& table, const json::Document& doc,
+        const json::StringBuffer& compact_text, const string& hash,
         size_t* record_count, size_t* total_record_count, string* insert_buffer,
         int16_t tenant_id)
 {
@@ -330,10 +344,7 @@ static void writeTuple(const ldp_options& opt, ldp_log* lg, const dbtype& dbt,
     if (data.length() > 65535) {
         // Formatted JSON object size exceeds database limit.  Try
         // compact-printed JSON.
-        json::StringBuffer json_text;
-        json::Writer<json::StringBuffer> writer(json_text);
-        doc.Accept(writer);
-        dbt.encode_string_const(json_text.GetString(), &data);
+        dbt.encode_string_const(compact_text.GetString(), &data);
         if (data.length() > 65535) {
             lg->write(log_level::warning, "", "",
                     "JSON object size exceeds database limit:\n"
@@ -347,7 +358,7 @@ static void writeTuple(const ldp_options& opt, ldp_log* lg, const dbtype& dbt,
     //print(Print::warning, opt, "storing record as:\n" + data + "\n");
 
     *insert_buffer += data;
-    *insert_buffer += "," + to_string(tenant_id) + ")";
+    *insert_buffer += "," + to_string(tenant_id) + ",'" + hash + "')";
     (*record_count)++;
     (*total_record_count)++;
     //if (*total_record_count % 100000 == 0)
@@ -360,8 +371,9 @@ bool JSONHandler::EndObject(json::SizeType memberCount)
 
         record += '}';
 
-        lg->detail("New record parsed for table: " + table.name +
-                ":\n" + record);
+        if (lg->enabled(log_level::detail))
+            lg->detail("New record parsed for table: " + table.name +
+                       ":\n" + record);
 
         char* buffer = strdup(record.c_str());
         etymon::malloc_ptr bufferptr(buffer);
@@ -378,6 +390,41 @@ bool JSONHandler::EndObject(json::SizeType memberCount)
 
         if (pass == 2) {
 
+            // Hash the compact-printed JSON.  The members of each object
+            // have been sorted by process_json_record(), which makes the
+            // text canonical for the purpose of detecting changes.
+            json::StringBuffer compact_text;
+            json::Writer<json::StringBuffer> compact_writer(compact_text);
+            doc.Accept(compact_writer);
+            string hash;
+            data_hash(compact_text.GetString(), compact_text.GetSize(),
+                      &hash);
+
+            // Collect the id of the record and sample the values of
+            // id-typed columns, for detecting foreign keys.
+            if (tids != nullptr && doc.HasMember("id") &&
+                    doc["id"].IsString()) {
+                tids->ids.add(doc["id"].GetString());
+                for (const auto& column : table.columns) {
+                    if (column.type != column_type::id || column.name == "id")
+                        continue;
+                    const char* name = column.source_name.c_str();
+                    if (doc.HasMember(name) && doc[name].IsString())
+                        tids->samples[column.name].add(doc[name].GetString());
+                }
+            }
+
+            // Skip the record if it is unchanged since the last update.
+            if (cidx != nullptr && doc.HasMember("id") &&
+                    doc["id"].IsString()) {
+                bool unchanged = cidx->record(doc["id"].GetString(), hash);
+                if (unchanged && cidx->filter) {
+                    cidx->skipped++;
+                    level--;
+                    return true;
+                }
+            }
+
             if (insert_buffer.length() > 16500000) {
             //if (insert_buffer.length() > 10000000) {
                 end_inserts(opt, lg, table.name, &insert_buffer,
@@ -386,8 +433,9 @@ bool JSONHandler::EndObject(json::SizeType memberCount)
                 record_count = 0;
             }
 
-            writeTuple(opt, lg, dbt, table, doc, &record_count,
-                       &total_record_count, &insert_buffer, tenant_id);
+            writeTuple(opt, lg, dbt, table, doc, compact_text, hash,
+                       &record_count, &total_record_count, &insert_buffer,
+                       tenant_id);
         }
 
     } else {
@@ -567,19 +615,32 @@ size_t read_page_count(const data_source& source, ldp_log* lg,
     return count;
 }
 
-static void stage_page(const ldp_options& opt, ldp_log* lg, int pass,
-                       const table_schema& table, etymon::odbc_env* odbc,
-                       etymon::odbc_conn* conn, const dbtype &dbt,
-                       map<string,type_counts>* stats, const string& filename,
-                       char* read_buffer, size_t read_buffer_size,
-                       bool anonymize_fields, int16_t tenant_id)
+// Returns the number of records written to the loading table.
+// Number of records staged by this process, shown in traces.
+static atomic<int64_t> records_staged(0);
+
+static size_t stage_page(const ldp_options& opt, ldp_log* lg, int pass,
+                         const table_schema& table, etymon::odbc_env* odbc,
+                         etymon::odbc_conn* conn, const dbtype &dbt,
+                         map<string,type_counts>* stats,
+                         const string& filename,
+                         char* read_buffer, size_t read_buffer_size,
+                         bool anonymize_fields, int16_t tenant_id,
+                         change_index* cidx, table_ids* tids)
 {
     json::Reader reader;
     etymon::file f(filename, "r");
     json::FileReadStream is(f.fp, read_buffer, read_buffer_size);
     JSONHandler handler(pass, opt, lg, table, conn, dbt,
-                        anonymize_fields, tenant_id, stats);
+                        anonymize_fields, tenant_id, stats, cidx, tids);
     reader.Parse(is, handler);
+    perf_count(handler.total_record_count, is.Tell(), 0);
+    if (pass == 2 && opt.metrics != nullptr)
+        opt.metrics->record_staged(handler.total_record_count, is.Tell());
+    if (pass == 2)
+        etymon::trace_counter("records_staged",
+                              records_staged += handler.total_record_count);
+    return handler.total_record_count;
 }
 
 static void compose_data_file_path(const string& load_dir,
@@ -597,6 +658,8 @@ static void compose_data_file_path(const string& load_dir,
 static void index_loading_table(ldp_log* lg, const table_schema& table,
                                 etymon::odbc_conn* conn, dbtype* dbt)
 {
+    perf_scope ps(perf_index);
+    etymon::trace_span span("phase", "index", "table", table.name);
     lg->trace("Creating indexes on table: " + table.name);
     string loading_table;
     loading_table_name(table.name, &loading_table);
@@ -639,6 +702,17 @@ static void create_loading_table(const ldp_options& opt, ldp_log* lg,
     loading_table_name(table.name, &loading_table);
     string sql;
 
+    // Drop any loading and deleted records tables left by an incomplete
+    // update.
+    sql = "DROP TABLE IF EXISTS " + loading_table + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+    string deleted_table;
+    deleted_records_table_name(table.name, &deleted_table);
+    sql = "DROP TABLE IF EXISTS " + deleted_table + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+
     string rskeys;
     dbt.redshift_keys("id", "id", &rskeys);
     sql = "CREATE TABLE ";
@@ -660,7 +734,8 @@ static void create_loading_table(const ldp_options& opt, ldp_log* lg,
         }
     }
     sql += string("    data ") + dbt.json_type() + ",\n"
-        "    tenant_id SMALLINT NOT NULL\n"
+        "    tenant_id SMALLINT NOT NULL,\n"
+        "    data_hash " + dbt.hash_type() + "\n"
         ")" + rskeys + ";";
     lg->write(log_level::detail, "", "", sql, -1);
     conn->exec(sql);
@@ -694,6 +769,186 @@ static void create_loading_table(const ldp_options& opt, ldp_log* lg,
     conn->exec(sql);
 }
 
+static change_index* find_change_index(change_index_map* cidx,
+                                       int16_t tenant_id)
+{
+    if (cidx == nullptr)
+        return nullptr;
+    auto it = cidx->find(tenant_id);
+    return (it == cidx->end()) ? nullptr : it->second.get();
+}
+
+class loading_column {
+public:
+    string name;
+    string type;
+    int64_t length = 0;
+    bool operator==(const loading_column& c) const {
+        return name == c.name && type == c.type;
+    }
+    bool operator!=(const loading_column& c) const { return !(*this == c); }
+};
+
+static void select_columns(etymon::odbc_conn* conn, ldp_log* lg,
+                           const string& table, vector<loading_column>* columns)
+{
+    columns->clear();
+    string sql =
+        "SELECT column_name,\n"
+        "       data_type,\n"
+        "       character_maximum_length\n"
+        "    FROM information_schema.columns\n"
+        "    WHERE table_schema = 'public' AND\n"
+        "          table_name = '" + table + "'\n"
+        "    ORDER BY column_name;";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    while (conn->fetch(&stmt)) {
+        loading_column column;
+        string length;
+        conn->get_data(&stmt, 1, &column.name);
+        conn->get_data(&stmt, 2, &column.type);
+        conn->get_data(&stmt, 3, &length);
+        if (length != "NULL")
+            column.length = stoll(length);
+        columns->push_back(column);
+    }
+}
+
+// Checks whether the columns of the loading table match those of the
+// current table, in which case records in the current table can be
+// copied to the loading table.  If fits is not null, it is set to true
+// if in addition every value in the loading table fits in the
+// corresponding column of the current table, in which case records can
+// be copied from the loading table to the current table.
+static bool loading_table_matches(etymon::odbc_conn* conn, ldp_log* lg,
+                                  const table_schema& table, bool* fits)
+{
+    string loading_table;
+    loading_table_name(table.name, &loading_table);
+    vector<loading_column> loading_columns, current_columns;
+    select_columns(conn, lg, loading_table, &loading_columns);
+    select_columns(conn, lg, table.name, &current_columns);
+    if (fits != nullptr)
+        *fits = false;
+    if (current_columns.empty() || loading_columns != current_columns)
+        return false;
+    bool found_data_hash = false;
+    bool f = true;
+    for (size_t x = 0; x < current_columns.size(); x++) {
+        if (current_columns[x].name == "data_hash")
+            found_data_hash = true;
+        if (current_columns[x].length < loading_columns[x].length)
+            f = false;
+    }
+    if (fits != nullptr)
+        *fits = found_data_hash && f;
+    return found_data_hash;
+}
+
+// Records the ids of records that have been deleted since the last
+// update, as determined from the change indexes, in the deleted records
+// table.  Like the loading table, it is not temporary because the merge
+// reads it on another connection; it is dropped by the merge.
+static void stage_deleted_records(ldp_log* lg, const table_schema& table,
+                                  etymon::odbc_conn* conn, const dbtype& dbt,
+                                  change_index_map* cidx)
+{
+    string deleted_table;
+    deleted_records_table_name(table.name, &deleted_table);
+
+    string sql = "DROP TABLE IF EXISTS " + deleted_table + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+    string rskeys;
+    dbt.redshift_keys("id", "id", &rskeys);
+    sql =
+        "CREATE " +
+        string(dbt.type() == dbsys::postgresql ? "UNLOGGED " : "") +
+        "TABLE " + deleted_table + " (\n"
+        "    id VARCHAR(36) NOT NULL,\n"
+        "    tenant_id SMALLINT NOT NULL\n"
+        ")" + rskeys + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+
+    size_t deleted_count = 0;
+    for (auto& [tenant_id, index] : *cidx) {
+        vector<string> ids;
+        index->deleted_ids(&ids);
+        deleted_count += ids.size();
+        string buffer;
+        size_t n = 0;
+        for (auto& id : ids) {
+            buffer += (n == 0) ?
+                "INSERT INTO " + deleted_table + " VALUES\n    " : ",\n    ";
+            buffer += "('" + id + "'," + to_string(tenant_id) + ")";
+            if (++n == 1000) {
+                buffer += ";";
+                conn->exec(buffer);
+                buffer.clear();
+                n = 0;
+            }
+        }
+        if (n > 0) {
+            buffer += ";";
+            conn->exec(buffer);
+        }
+    }
+    lg->trace("Deleted records: " + table.name + ": " +
+              to_string(deleted_count));
+}
+
+// Completes the loading table when unchanged records have been skipped
+// during staging.  The skipped records, other than those listed in the
+// deleted records table, are copied from the current table.
+void copy_unchanged_records(ldp_log* lg, const table_schema& table,
+                            etymon::odbc_conn* conn, change_index_map* cidx)
+{
+    string loading_table;
+    loading_table_name(table.name, &loading_table);
+    string deleted_table;
+    deleted_records_table_name(table.name, &deleted_table);
+
+    vector<loading_column> columns;
+    select_columns(conn, lg, table.name, &columns);
+    string column_list;
+    for (auto& c : columns) {
+        if (column_list != "")
+            column_list += ", ";
+        column_list += "\"" + c.name + "\"";
+    }
+    string tenants;
+    for (auto& [tenant_id, index] : *cidx) {
+        if (tenants != "")
+            tenants += ",";
+        tenants += to_string(tenant_id);
+    }
+    // Only records with a canonical UUID are indexed; others are always
+    // staged and so are not copied.
+    string sql =
+        "INSERT INTO " + loading_table + "\n"
+        "    (" + column_list + ")\n"
+        "SELECT " + column_list + "\n"
+        "    FROM " + table.name + " AS m\n"
+        "    WHERE m.tenant_id IN (" + tenants + ") AND\n"
+        "          m.id ~ '" + canonical_uuid_pattern + "' AND\n"
+        "          NOT EXISTS (SELECT 1\n"
+        "                          FROM " + loading_table + " AS s\n"
+        "                          WHERE s.id = m.id) AND\n"
+        "          NOT EXISTS (SELECT 1\n"
+        "                          FROM " + deleted_table + " AS d\n"
+        "                          WHERE d.tenant_id = m.tenant_id AND\n"
+        "                                d.id = m.id);";
+    lg->detail(sql);
+    conn->exec(sql);
+
+    sql = "DROP TABLE " + deleted_table + ";";
+    lg->detail(sql);
+    conn->exec(sql);
+}
+
 /*
 bool stage_table(const ldp_options& opt,
                  ldp_log* lg, table_schema* table, etymon::odbc_env* odbc,
@@ -808,6 +1063,8 @@ bool stage_table_1(const ldp_options& opt,
     // pass 1
     //createStagingTable(opt, table->name, db);
 
+    perf_scope ps(perf_pass1);
+    etymon::trace_span span("phase", "pass1", "table", table->name);
     map<string,type_counts> stats;
     char read_buffer[65536];
 
@@ -830,12 +1087,14 @@ bool stage_table_1(const ldp_options& opt,
             compose_data_file_path(load_dir, *table, state.source.source_name,
                                    // "_" + state.source.source_name +
                                    "_" + to_string(page) + ".json", &path);
-            lg->write(log_level::detail, "", "",
-                      "Staging: " + table->name +
-                      (pass == 1 ?  ": analyze" : ": load") + ": page: " +
-                      to_string(page), -1);
+            if (lg->enabled(log_level::detail))
+                lg->write(log_level::detail, "", "",
+                          "Staging: " + table->name +
+                          (pass == 1 ?  ": analyze" : ": load") + ": page: " +
+                          to_string(page), -1);
             stage_page(opt, lg, pass, *table, odbc, conn, *dbt, &stats, path,
-                       read_buffer, sizeof read_buffer, anonymize_fields, -1);
+                       read_buffer, sizeof read_buffer, anonymize_fields, -1,
+                       nullptr, nullptr);
         }
     }
 
@@ -849,11 +1108,11 @@ bool stage_table_1(const ldp_options& opt,
                       ": test file", -1);
             stage_page(opt, lg, pass, *table, odbc, conn, *dbt, &stats,
                        path, read_buffer, sizeof read_buffer,
-                       anonymize_fields, -1);
+                       anonymize_fields, -1, nullptr, nullptr);
         }
     }
 
-    if (pass == 1) {
+    if (pass == 1 && lg->enabled(log_level::detail)) {
         for (const auto& [field, counts] : stats) {
             lg->write(log_level::detail, "", "",
                       "Stats: in field: " + field, -1);
@@ -909,16 +1168,40 @@ bool stage_table_2(const ldp_options& opt,
                    const vector<source_state>& source_states,
                  ldp_log* lg, table_schema* table, etymon::odbc_env* odbc,
                  etymon::odbc_conn* conn, dbtype* dbt, const string& load_dir,
-                 bool anonymize_fields)
+                 bool anonymize_fields, change_index_map* cidx,
+                 merge_mode* mode, table_ids* tids, size_t* record_count)
 {
     // TODO remove this and create the load table from merge.cpp after
     // pass 1
     //createStagingTable(opt, table->name, db);
 
+    perf_scope ps(perf_pass2);
+    etymon::trace_span span("phase", "pass2", "table", table->name);
     map<string,type_counts> stats;
     char read_buffer[65536];
 
     int pass = 2;
+    *record_count = 0;
+
+    // Unchanged records can be skipped only if they can be copied from
+    // the current table, which requires that the columns have not
+    // changed.  The same requirement applies to upserting the loading
+    // table into the current table, in which case the column lengths
+    // also have to fit.
+    bool fits = false;
+    bool matches = loading_table_matches(conn, lg, *table, &fits);
+    if (*mode == merge_mode::upsert &&
+            (dbt->type() != dbsys::postgresql || !fits)) {
+        lg->trace("Table cannot be upserted: " + table->name);
+        *mode = merge_mode::replace;
+    }
+    bool filter = (cidx != nullptr && !cidx->empty() && matches);
+    if (cidx != nullptr) {
+        for (auto& [tenant_id, index] : *cidx) {
+            index->filter = filter;
+            index->skipped = 0;
+        }
+    }
 
     //lg->write(log_level::detail, "", "",
     //          "Staging: " + table->name +
@@ -937,13 +1220,17 @@ bool stage_table_2(const ldp_options& opt,
             compose_data_file_path(load_dir, *table, state.source.source_name,
                                    // "_" + state.source.source_name +
                                    "_" + to_string(page) + ".json", &path);
-            lg->write(log_level::detail, "", "",
-                      "Staging: " + table->name +
-                      (pass == 1 ?  ": analyze" : ": load") + ": page: " +
-                      to_string(page), -1);
-            stage_page(opt, lg, pass, *table, odbc, conn, *dbt, &stats, path,
-                       read_buffer, sizeof read_buffer, anonymize_fields,
-                       state.source.tenant_id);
+            if (lg->enabled(log_level::detail))
+                lg->write(log_level::detail, "", "",
+                          "Staging: " + table->name +
+                          (pass == 1 ?  ": analyze" : ": load") + ": page: " +
+                          to_string(page), -1);
+            *record_count +=
+                stage_page(opt, lg, pass, *table, odbc, conn, *dbt, &stats,
+                           path, read_buffer, sizeof read_buffer,
+                           anonymize_fields, state.source.tenant_id,
+                           find_change_index(cidx, state.source.tenant_id),
+                           tids);
         }
     }
 
@@ -955,12 +1242,29 @@ bool stage_table_2(const ldp_options& opt,
                       "Staging: " + table->name +
                       (pass == 1 ?  ": analyze" : ": load") +
                       ": test file", -1);
-            stage_page(opt, lg, pass, *table, odbc, conn, *dbt, &stats,
-                       path, read_buffer, sizeof read_buffer,
-                       anonymize_fields, 1);
+            *record_count +=
+                stage_page(opt, lg, pass, *table, odbc, conn, *dbt, &stats,
+                           path, read_buffer, sizeof read_buffer,
+                           anonymize_fields, 1, find_change_index(cidx, 1),
+                           tids);
         }
     }
 
+    if (filter) {
+        size_t skipped = 0;
+        for (auto& [tenant_id, index] : *cidx)
+            skipped += index->skipped;
+        lg->trace("Unchanged records: " + table->name + ": " +
+                  to_string(skipped));
+        // Unchanged records remain in the table, whether they are
+        // copied to the loading table or left in place by an upsert.
+        *record_count += skipped;
+        stage_deleted_records(lg, *table, conn, *dbt, cidx);
+        // In upsert mode, only the changed records are merged.
+        if (*mode == merge_mode::replace)
+            copy_unchanged_records(lg, *table, conn, cidx);
+    }
+
     if (pass == 2)
         index_loading_table(lg, *table, conn, dbt);
 
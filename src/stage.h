@@ -1,6 +1,8 @@
 #ifndef LDP_STAGE_H
 #define LDP_STAGE_H
 
+#include "changeidx.h"
+#include "fkey.h"
 #include "options.h"
 #include "util.h"
 
@@ -19,7 +21,11 @@ bool stage_table_2(const ldp_options& opt,
                    const vector<source_state>& source_states,
                  ldp_log* lg, table_schema* table, etymon::odbc_env* odbc,
                  etymon::odbc_conn* conn, dbtype* dbt, const string& loadDir,
-                 bool anonymize_fields);
+                 bool anonymize_fields, change_index_map* cidx,
+                 merge_mode* mode, table_ids* tids, size_t* record_count);
+
+void copy_unchanged_records(ldp_log* lg, const table_schema& table,
+                            etymon::odbc_conn* conn, change_index_map* cidx);
 
 #endif
 
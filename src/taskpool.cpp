@@ -0,0 +1,215 @@
+#include <chrono>
+
+#include "../etymoncpp/include/trace.h"
+#include "taskpool.h"
+
+static thread_local const task_pool* current_pool = nullptr;
+static thread_local int current_worker = -1;
+
+task_pool::task_pool(size_t workers, size_t queue_capacity) :
+    capacity(queue_capacity > 0 ? queue_capacity : 1)
+{
+    if (workers < 1)
+        workers = 1;
+    for (size_t w = 0; w < workers; w++)
+        queues.push_back(unique_ptr<worker_queue>(new worker_queue()));
+    for (size_t w = 0; w < workers; w++)
+        threads.emplace_back([this, w]() { worker_main(w); });
+}
+
+task_pool::~task_pool()
+{
+    {
+        lock_guard<mutex> lock(idle_mutex);
+        stopping = true;
+    }
+    idle_cv.notify_all();
+    space_cv.notify_all();
+    for (auto& t : threads)
+        t.join();
+}
+
+size_t task_pool::size() const
+{
+    return queues.size();
+}
+
+int task_pool::worker_index() const
+{
+    return current_pool == this ? current_worker : -1;
+}
+
+void task_pool::submit(task_group* group, const function<void()>& f)
+{
+    item it = {group, f};
+    int self = worker_index();
+    if (self >= 0) {
+        worker_queue& q = *(queues[self]);
+        unique_lock<mutex> lock(q.m);
+        if (q.tasks.size() >= capacity) {
+            lock.unlock();
+            run_item(&it);
+            return;
+        }
+        q.tasks.push_back(move(it));
+    } else {
+        unique_lock<mutex> lock(shared_mutex);
+        space_cv.wait(lock, [this]() { return shared.size() < capacity; });
+        shared.push_back(move(it));
+    }
+    {
+        lock_guard<mutex> lock(idle_mutex);
+        pending++;
+    }
+    idle_cv.notify_one();
+}
+
+// Takes the next task for a worker (or for a thread outside the pool
+// if self is -1): from the back of its own queue, then from the shared
+// queue, then from the front of the other workers' queues.
+bool task_pool::take(int self, item* it)
+{
+    bool found = false;
+    if (self >= 0) {
+        worker_queue& q = *(queues[self]);
+        lock_guard<mutex> lock(q.m);
+        if (!q.tasks.empty()) {
+            *it = move(q.tasks.back());
+            q.tasks.pop_back();
+            found = true;
+        }
+    }
+    if (!found) {
+        lock_guard<mutex> lock(shared_mutex);
+        if (!shared.empty()) {
+            *it = move(shared.front());
+            shared.pop_front();
+            found = true;
+            space_cv.notify_one();
+        }
+    }
+    size_t n = queues.size();
+    size_t start = (self >= 0 ? self + 1 : 0);
+    for (size_t x = 0; !found && x < n; x++) {
+        size_t v = (start + x) % n;
+        if ((int) v == self)
+            continue;
+        worker_queue& q = *(queues[v]);
+        lock_guard<mutex> lock(q.m);
+        if (!q.tasks.empty()) {
+            *it = move(q.tasks.front());
+            q.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (found) {
+        lock_guard<mutex> lock(idle_mutex);
+        pending--;
+    }
+    return found;
+}
+
+bool task_pool::run_one(int self)
+{
+    item it;
+    if (!take(self, &it))
+        return false;
+    run_item(&it);
+    return true;
+}
+
+void task_pool::run_item(item* it)
+{
+    exception_ptr e;
+    if (!it->group->cancelled()) {
+        try {
+            etymon::trace_span span("pool", "task");
+            it->f();
+        } catch (...) {
+            e = current_exception();
+        }
+    }
+    it->group->finish(e);
+}
+
+void task_pool::worker_main(int index)
+{
+    current_pool = this;
+    current_worker = index;
+    while (true) {
+        if (run_one(index))
+            continue;
+        unique_lock<mutex> lock(idle_mutex);
+        if (stopping && pending == 0)
+            return;
+        idle_cv.wait(lock, [this]() { return stopping || pending > 0; });
+        if (stopping && pending == 0)
+            return;
+    }
+}
+
+task_group::task_group(task_pool* pool) : pool(pool), cancel_flag(false)
+{
+}
+
+task_group::~task_group()
+{
+    try {
+        wait();
+    } catch (...) {
+    }
+}
+
+void task_group::run(const function<void()>& f)
+{
+    {
+        lock_guard<mutex> lock(m);
+        active++;
+    }
+    pool->submit(this, f);
+}
+
+void task_group::cancel()
+{
+    cancel_flag = true;
+}
+
+bool task_group::cancelled() const
+{
+    return cancel_flag;
+}
+
+void task_group::finish(exception_ptr e)
+{
+    lock_guard<mutex> lock(m);
+    if (e && !error) {
+        error = e;
+        cancel_flag = true;
+    }
+    active--;
+    if (active == 0)
+        cv.notify_all();
+}
+
+void task_group::wait()
+{
+    int self = pool->worker_index();
+    unique_lock<mutex> lock(m);
+    while (active > 0) {
+        if (self >= 0) {
+            // Help with other tasks rather than blocking the worker.
+            lock.unlock();
+            bool ran = pool->run_one(self);
+            lock.lock();
+            if (!ran && active > 0)
+                cv.wait_for(lock, chrono::milliseconds(1));
+        } else {
+            cv.wait(lock);
+        }
+    }
+    if (error) {
+        exception_ptr e = error;
+        error = nullptr;
+        rethrow_exception(e);
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef LDP_TASKPOOL_H
+#define LDP_TASKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class task_group;
+
+// Pool of worker threads with work stealing.  Each worker has its own
+// queue of tasks: it runs tasks from the back of its own queue, and
+// when that is empty it takes tasks from the shared queue or steals
+// from the front of another worker's queue.  Tasks submitted by a
+// thread outside the pool are added to the shared queue.  Both kinds
+// of queue are bounded: submitting to a full shared queue blocks until
+// there is space, and a task submitted by a worker whose queue is full
+// is run immediately by that worker.  Tasks are submitted through a
+// task_group.
+class task_pool {
+public:
+    task_pool(size_t workers, size_t queue_capacity = 1024);
+    ~task_pool();
+    size_t size() const;
+    // Returns the index of the calling thread among the workers of
+    // this pool, or -1 if it is not one of them.
+    int worker_index() const;
+private:
+    friend class task_group;
+    class item {
+    public:
+        task_group* group;
+        function<void()> f;
+    };
+    class worker_queue {
+    public:
+        mutex m;
+        deque<item> tasks;
+    };
+    void submit(task_group* group, const function<void()>& f);
+    bool take(int self, item* it);
+    bool run_one(int self);
+    void run_item(item* it);
+    void worker_main(int index);
+    vector<unique_ptr<worker_queue>> queues;
+    deque<item> shared;
+    mutex shared_mutex;
+    condition_variable space_cv;
+    size_t capacity;
+    // Number of tasks in all queues, used to put idle workers to sleep.
+    size_t pending = 0;
+    mutex idle_mutex;
+    condition_variable idle_cv;
+    bool stopping = false;
+    vector<thread> threads;
+};
+
+// Set of tasks that run in a pool and can be waited for together.  If a
+// task throws an exception, the group is cancelled: tasks in the group
+// that have not started are skipped, and the first exception is
+// rethrown by wait().  Running tasks can check cancelled() to stop
+// early.
+class task_group {
+public:
+    explicit task_group(task_pool* pool);
+    // Waits for the tasks to finish, ignoring any exception.
+    ~task_group();
+    void run(const function<void()>& f);
+    void cancel();
+    bool cancelled() const;
+    // Waits for the tasks to finish.  If called by a worker of the
+    // pool, the worker runs other tasks while it waits, which allows
+    // tasks to wait for groups of their own subtasks.
+    void wait();
+private:
+    friend class task_pool;
+    void finish(exception_ptr e);
+    task_pool* pool;
+    mutex m;
+    condition_variable cv;
+    size_t active = 0;
+    atomic<bool> cancel_flag;
+    exception_ptr error;
+};
+
+// Object of which each worker of a pool has its own instance, created
+// by the make function the first time the worker uses it.  This gives
+// each worker affinity to a resource such as a database connection or
+// a curl handle.  Threads outside the pool share one more instance,
+// which they must not use at the same time.
+template <class T>
+class worker_local {
+public:
+    worker_local(const task_pool& pool,
+                 const function<unique_ptr<T>()>& make) :
+        pool(pool), make(make), values(pool.size() + 1) {}
+    T* get()
+    {
+        unique_ptr<T>& v = slot();
+        if (!v)
+            v = make();
+        return v.get();
+    }
+    // Discards the calling worker's instance, for example after a
+    // connection has failed, so that a new one is made when needed.
+    void reset()
+    {
+        slot().reset();
+    }
+private:
+    unique_ptr<T>& slot()
+    {
+        int w = pool.worker_index();
+        return values[w < 0 ? values.size() - 1 : w];
+    }
+    const task_pool& pool;
+    function<unique_ptr<T>()> make;
+    vector<unique_ptr<T>> values;
+};
+
+#endif
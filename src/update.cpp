@@ -1,102 +1,62 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <curl/curl.h>
 #include <experimental/filesystem>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <stdexcept>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 
 #include "../etymoncpp/include/curl.h"
+#include "../etymoncpp/include/trace.h"
+#include "changeidx.h"
+#include "compact.h"
 #include "extract.h"
+#include "fkey.h"
+#include "freshness.h"
 #include "init.h"
+#include "initutil.h"
+#include "jobqueue.h"
+#include "journal.h"
 #include "log.h"
+#include "maintain.h"
 #include "merge.h"
+#include "metrics.h"
+#include "names.h"
+#include "parallel.h"
+#include "partition.h"
+#include "perf.h"
+#include "scheduler.h"
 #include "stage.h"
+#include "taskpool.h"
 #include "timer.h"
 #include "update.h"
 
 namespace fs = std::experimental::filesystem;
 
-void make_update_tmp_dir(const ldp_options& opt, string* loaddir)
+// Creates the directory for extracted data, tmp/<name> in the data
+// directory.  Any files left in it are removed, unless keep is set so
+// that a resumed update can reuse them.
+void make_update_tmp_dir(const ldp_options& opt, const string& name,
+                         bool keep, string* loaddir)
 {
     fs::path datadir = opt.datadir;
     fs::path tmp = datadir / "tmp";
-    fs::path tmppath = tmp / "update";
-    fs::remove_all(tmppath);
+    fs::path tmppath = tmp / name;
+    if (!keep)
+        fs::remove_all(tmppath);
     fs::create_directories(tmppath);
     *loaddir = tmppath;
 }
 
-bool is_foreign_key(etymon::odbc_conn* conn, ldp_log* lg,
-        const table_schema& table2, const column_schema& column2,
-        const table_schema& table1)
-{
-    string sql =
-        "SELECT 1\n"
-        "    FROM " + table2.name + " AS r2\n"
-        "        JOIN " + table1.name + " AS r1\n"
-        "            ON r2." + column2.name + " = r1.id\n"
-        "    LIMIT 1;";
-    lg->detail(sql);
-    etymon::odbc_stmt stmt(conn);
-    try {
-        conn->exec_direct(&stmt, sql);
-    } catch (runtime_error& e) {
-        return false;
-    }
-    return conn->fetch(&stmt);
-}
-
-class reference {
-public:
-    string referencing_table;
-    string referencing_column;
-    string referenced_table;
-    string referenced_column;
-    string constraint_name;
-};
-
-void search_table_foreign_keys(etymon::odbc_env* odbc, const string& dbName,
-                               etymon::odbc_conn* conn, ldp_log* lg,
-                               const ldp_schema& schema,
-                               const table_schema& table,
-                               bool detectForeignKeys,
-                               map<string, vector<reference>>* refs)
-{
-    etymon::odbc_conn query_conn(odbc, dbName);
-    lg->detail("Searching for foreign keys in table: " + table.name);
-    //printf("Table: %s\n", table.name.c_str());
-    for (auto& column : table.columns) {
-        if (column.type != column_type::id)
-            continue;
-        if (column.name == "id")
-            continue;
-        //printf("    Column: %s\n", column.name.c_str());
-        for (auto& table1 : schema.tables) {
-            if (is_foreign_key(&query_conn, lg, table, column, table1)) {
-
-                string key = table.name + "." + column.name;
-                reference ref = {
-                    table.name,
-                    column.name,
-                    table1.name,
-                    "id"
-                };
-
-                //fprintf(stderr, "%s(%s) -> %s(%s)\n",
-                //        ref.referencing_table.c_str(),
-                //        ref.referencing_column.c_str(),
-                //        ref.referenced_table.c_str(),
-                //        ref.referenced_column.c_str());
-
-                (*refs)[key].push_back(ref);
-
-            }
-        }
-    }
-}
-
 void select_foreign_key_constraints(etymon::odbc_conn* conn, ldp_log* lg,
         vector<reference>* refs)
 {
@@ -122,22 +82,29 @@ void select_foreign_key_constraints(etymon::odbc_conn* conn, ldp_log* lg,
     }
 }
 
-void remove_foreign_key_constraints(etymon::odbc_conn* conn, ldp_log* lg)
+// Drops the foreign key constraints that reference or are referenced by
+// any of the specified tables.  This should be called before the tables
+// are replaced, or within the transaction that publishes them.
+void remove_foreign_key_constraints(etymon::odbc_conn* conn, ldp_log* lg,
+                                    const set<string>& tables)
 {
-    etymon::odbc_tx tx(conn);
     vector<reference> refs;
     select_foreign_key_constraints(conn, lg, &refs);
     for (auto& ref : refs) {
+        if (tables.count(ref.referencing_table) == 0 &&
+                tables.count(ref.referenced_table) == 0)
+            continue;
         string sql =
             "ALTER TABLE " + ref.referencing_table + "\n"
             "    DROP CONSTRAINT " + ref.constraint_name + " CASCADE;";
         lg->detail(sql);
         conn->exec(sql);
+        sql =
+            "DELETE FROM dbsystem.foreign_key_constraints\n"
+            "    WHERE constraint_name = '" + ref.constraint_name + "';";
+        lg->detail(sql);
+        conn->exec(sql);
     }
-    string sql = "DELETE FROM dbsystem.foreign_key_constraints;";
-    lg->detail(sql);
-    conn->exec(sql);
-    tx.commit();
 }
 
 void select_enabled_foreign_keys(etymon::odbc_conn* conn, ldp_log* lg,
@@ -175,36 +142,62 @@ void make_foreign_key_constraint_name(const string& referencing_table,
     *constraint_name = string(p) + "_" + referencing_column + "_fk";
 }
 
+// Returns the condition that is true for rows in the referencing table
+// whose foreign key is not present in the referenced table.  This is
+// written as an anti-join so that nulls in the referenced column do
+// not hide missing keys, as they would with NOT IN.
+static void missing_foreign_key_condition(const reference& ref,
+                                          string* cond)
+{
+    *cond =
+        ref.referencing_table + ".\"" + ref.referencing_column + "\"\n"
+        "        IS NOT NULL AND\n"
+        "    NOT EXISTS (\n"
+        "        SELECT 1\n"
+        "            FROM " + ref.referenced_table + " AS r\n"
+        "            WHERE r.\"" + ref.referenced_column + "\" =\n"
+        "                  " + ref.referencing_table + ".\"" +
+        ref.referencing_column + "\"\n"
+        "    )";
+}
+
 void log_foreign_key_warnings(const reference& ref,
                               bool force_foreign_key_constraints,
                               etymon::odbc_conn* conn, ldp_log* lg)
 {
     string sql;
     try {
+        string cond;
+        missing_foreign_key_condition(ref, &cond);
         sql =
-            "SELECT referencing_pkey,\n"
-            "       referencing_fkey\n"
-            "    FROM temp_foreign_key_exceptions;";
+            "SELECT id,\n"
+            "       \"" + ref.referencing_column + "\"\n"
+            "    FROM " + ref.referencing_table + "\n"
+            "    WHERE " + cond + ";";
         lg->detail(sql);
         etymon::odbc_stmt stmt(conn);
         conn->exec_direct(&stmt, sql);
-        while (conn->fetch(&stmt)) {
-            string pkey, fkey;
-            conn->get_data(&stmt, 1, &pkey);
-            conn->get_data(&stmt, 2, &fkey);
-            lg->write(log_level::warning, "foreign_key", ref.referenced_table,
-                "Foreign key is not present in referenced table:\n"
-                "    Referencing table: " + ref.referencing_table + "\n"
-                "    Referencing table primary key: " + pkey + "\n"
-                "    Referencing column: " + ref.referencing_column + "\n"
-                "    Referencing column foreign key: " + fkey + "\n"
-                "    Referenced table: " + ref.referenced_table + "\n"
-                "    Referenced column: " + ref.referenced_column + "\n"
-                "    Action: " +
-                ( force_foreign_key_constraints ?
-                  "Deleting row in referencing table" : "None" ), -1 );
-        }
-        
+        etymon::odbc_rowset rows(2, 1000, 256);
+        while (conn->fetch(&stmt, &rows)) {
+            for (size_t r = 0; r < rows.size(); r++) {
+                string pkey, fkey;
+                rows.get_data(r, 1, &pkey);
+                rows.get_data(r, 2, &fkey);
+                lg->write(log_level::warning, "foreign_key",
+                    ref.referenced_table,
+                    "Foreign key is not present in referenced table:\n"
+                    "    Referencing table: " + ref.referencing_table + "\n"
+                    "    Referencing table primary key: " + pkey + "\n"
+                    "    Referencing column: " + ref.referencing_column +
+                    "\n"
+                    "    Referencing column foreign key: " + fkey + "\n"
+                    "    Referenced table: " + ref.referenced_table + "\n"
+                    "    Referenced column: " + ref.referenced_column + "\n"
+                    "    Action: " +
+                    ( force_foreign_key_constraints ?
+                      "Deleting row in referencing table" : "None" ), -1 );
+            }
+        }
     } catch (runtime_error& e) {
         string s = e.what();
         if ( !(s.empty()) && s.back() == '\n' )
@@ -213,109 +206,277 @@ void log_foreign_key_warnings(const reference& ref,
     }
 }
 
-void process_foreign_keys(bool enable_foreign_key_warnings,
-                          bool force_foreign_key_constraints,
-                          etymon::odbc_conn* conn, ldp_log* lg)
+static void delete_missing_foreign_keys(const reference& ref,
+                                        etymon::odbc_conn* conn,
+                                        ldp_log* lg)
 {
-    vector<reference> refs;
-    select_enabled_foreign_keys(conn, lg, &refs);
-    for (auto& ref : refs) {
-        try {
-            string sql =
-                "CREATE TEMPORARY TABLE temp_foreign_key_exceptions AS\n"
-                "SELECT id AS referencing_pkey,\n"
-                "       \"" + ref.referencing_column + "\"\n"
-                "               AS referencing_fkey\n"
-                "    FROM " + ref.referencing_table + "\n"
-                "    WHERE \"" + ref.referencing_column + "\"\n"
-                "    NOT IN (\n"
-                "        SELECT \"" + ref.referenced_column + "\"\n"
-                "            FROM " + ref.referenced_table + "\n"
-                "    );";
-            lg->detail(sql);
-            conn->exec(sql);
+    try {
+        string cond;
+        missing_foreign_key_condition(ref, &cond);
+        string sql =
+            "DELETE FROM " + ref.referencing_table + "\n"
+            "    WHERE " + cond + ";";
+        lg->detail(sql);
+        conn->exec(sql);
+    } catch (runtime_error& e) {
+        string s = e.what();
+        if ( !(s.empty()) && s.back() == '\n' )
+            s.pop_back();
+        lg->detail(s);
+    }
+}
+
+// Creates a foreign key constraint.  In PostgreSQL the constraint is
+// added as NOT VALID and then validated, because validation takes a
+// weaker lock that does not block constraints being added to other
+// tables that reference the same table.
+static void add_foreign_key_constraint(const reference& ref,
+                                       const dbtype& dbt,
+                                       etymon::odbc_conn* conn,
+                                       ldp_log* lg)
+{
+    string constraint_name;
+    make_foreign_key_constraint_name(ref.referencing_table,
+            ref.referencing_column, &constraint_name);
+    try {
+        bool pg = (dbt.type() == dbsys::postgresql);
+        string sql =
+            "ALTER TABLE " + ref.referencing_table + "\n"
+            "    ADD CONSTRAINT\n"
+            "    " + constraint_name + "\n"
+            "    FOREIGN KEY (\"" + ref.referencing_column + "\")\n"
+            "    REFERENCES " + ref.referenced_table + " (" +
+            ref.referenced_column + ")" + (pg ? "\n    NOT VALID" : "") +
+            ";";
+        lg->detail(sql);
+        conn->exec(sql);
+        if (pg) {
             sql =
-                "CREATE INDEX ON temp_foreign_key_exceptions\n"
-                "    (referencing_fkey);";
-            lg->detail(sql);
-            conn->exec(sql);
-            sql = "VACUUM temp_foreign_key_exceptions;";
-            lg->detail(sql);
-            conn->exec(sql);
-            sql = "ANALYZE temp_foreign_key_exceptions;";
+                "ALTER TABLE " + ref.referencing_table + "\n"
+                "    VALIDATE CONSTRAINT " + constraint_name + ";";
             lg->detail(sql);
             conn->exec(sql);
-        } catch (runtime_error& e) {
-            string s = e.what();
-            if ( !(s.empty()) && s.back() == '\n' )
-                s.pop_back();
-            lg->detail(s);
         }
+        sql =
+            "INSERT INTO dbsystem.foreign_key_constraints\n"
+            "    (referencing_table, referencing_column,\n"
+            "     referenced_table, referenced_column, constraint_name)\n"
+            "    VALUES\n"
+            "    ('" + ref.referencing_table + "',\n"
+            "     '" + ref.referencing_column + "',\n"
+            "     '" + ref.referenced_table + "',\n"
+            "     '" + ref.referenced_column + "',\n"
+            "     '" + constraint_name + "');";
+        lg->detail(sql);
+        conn->exec(sql);
+    } catch (runtime_error& e) {
+        string s = e.what();
+        if ( !(s.empty()) && s.back() == '\n' )
+            s.pop_back();
+        lg->detail(s);
+    }
+}
 
-        if (enable_foreign_key_warnings)
-            log_foreign_key_warnings(ref, force_foreign_key_constraints, conn,
-                                     lg);
+// Groups the foreign keys by referencing table, and orders the groups
+// into levels such that a table's rows are deleted only after the
+// tables it references have been processed.  Tables in the same level
+// do not depend on each other and can be processed concurrently,
+// except for the last level when the references contain a cycle.
+static void foreign_key_levels(const vector<reference>& refs,
+                               vector<vector<vector<reference>>>* levels,
+                               bool* cycle)
+{
+    levels->clear();
+    *cycle = false;
+    map<string, vector<reference>> pending;
+    for (auto& ref : refs)
+        pending[ref.referencing_table].push_back(ref);
+    while (!pending.empty()) {
+        vector<vector<reference>> level;
+        for (auto& [table, trefs] : pending) {
+            bool ready = true;
+            for (auto& ref : trefs)
+                if (ref.referenced_table != table &&
+                        pending.find(ref.referenced_table) != pending.end())
+                    ready = false;
+            if (ready)
+                level.push_back(trefs);
+        }
+        if (level.empty()) {
+            for (auto& [table, trefs] : pending)
+                level.push_back(trefs);
+            *cycle = true;
+        }
+        for (auto& trefs : level)
+            pending.erase(trefs[0].referencing_table);
+        levels->push_back(level);
+    }
+}
 
-        if (force_foreign_key_constraints) {
-            string sql;
-            try {
-                sql =
-                    "DELETE\n"
-                    "    FROM " + ref.referencing_table + "\n"
-                    "    WHERE \"" + ref.referencing_column + "\"\n"
-                    "    IN (\n"
-                    "        SELECT referencing_fkey\n"
-                    "            FROM temp_foreign_key_exceptions\n"
-                    "    );";
-                lg->detail(sql);
-                conn->exec(sql);
-            } catch (runtime_error& e) {
-                string s = e.what();
-                if ( !(s.empty()) && s.back() == '\n' )
-                    s.pop_back();
-                lg->detail(s);
+// Enforces the enabled foreign keys.  Foreign keys whose constraints
+// remain in place from a previous update are skipped, since their data
+// cannot have changed.  Referencing tables that do not depend on each
+// other are processed concurrently, each on a separate connection,
+// using up to opt.foreign_key_connections connections.
+void process_foreign_keys(const ldp_options& opt, etymon::odbc_env* odbc,
+                          bool enable_foreign_key_warnings,
+                          bool force_foreign_key_constraints,
+                          etymon::odbc_conn* conn, ldp_log* lg)
+{
+    vector<reference> enabled;
+    select_enabled_foreign_keys(conn, lg, &enabled);
+    vector<reference> constraints;
+    select_foreign_key_constraints(conn, lg, &constraints);
+    auto key = [](const reference& ref) {
+        return ref.referencing_table + "." + ref.referencing_column + " " +
+            ref.referenced_table + "." + ref.referenced_column;
+    };
+    set<string> constrained;
+    for (auto& ref : constraints)
+        constrained.insert(key(ref));
+    vector<reference> refs;
+    for (auto& ref : enabled)
+        if (constrained.count(key(ref)) == 0)
+            refs.push_back(ref);
+    dbtype dbt(conn);
+    vector<vector<vector<reference>>> levels;
+    bool cycle;
+    foreign_key_levels(refs, &levels, &cycle);
+    for (size_t l = 0; l < levels.size(); l++) {
+        auto& level = levels[l];
+        // Tables in a cycle are processed serially to avoid deadlocks.
+        size_t threads = (cycle && l == levels.size() - 1) ?
+            1 : opt.foreign_key_connections;
+        perf_context* run_perf = perf_context::current();
+        parallel_for(level.size(), threads, [&](size_t t) {
+            perf_context pc(run_perf, level[t].empty() ? "" :
+                            level[t][0].referencing_table);
+            perf_scope ps(perf_fk);
+            etymon::odbc_conn tconn(odbc, opt.db);
+            for (auto& ref : level[t]) {
+                if (enable_foreign_key_warnings)
+                    log_foreign_key_warnings(ref,
+                            force_foreign_key_constraints, &tconn, lg);
+                if (force_foreign_key_constraints) {
+                    delete_missing_foreign_keys(ref, &tconn, lg);
+                    add_foreign_key_constraint(ref, dbt, &tconn, lg);
+                }
             }
-        }
+        });
+    }
+}
 
-        string sql = "DROP TABLE IF EXISTS temp_foreign_key_exceptions;";
-        lg->detail(sql);
-        conn->exec(sql);
+// Serializes dropping the foreign key constraints of tables that are
+// replaced instead of upserted, which may share constraints.
+static mutex replace_constraints_mutex;
 
-        if (!force_foreign_key_constraints)
-            continue;
-        
-        string constraint_name;
-        make_foreign_key_constraint_name(ref.referencing_table,
-                ref.referencing_column, &constraint_name);
-        try {
-            string sql =
-                "ALTER TABLE " + ref.referencing_table + "\n"
-                "    ADD CONSTRAINT\n"
-                "    " + constraint_name + "\n"
-                "    FOREIGN KEY (\"" + ref.referencing_column + "\")\n"
-                "    REFERENCES " + ref.referenced_table + " (" +
-                ref.referenced_column + ");";
-            lg->detail(sql);
-            conn->exec(sql);
-            sql =
-                "INSERT INTO dbsystem.foreign_key_constraints\n"
-                "    (referencing_table, referencing_column,\n"
-                "     referenced_table, referenced_column, constraint_name)\n"
-                "    VALUES\n"
-                "    ('" + ref.referencing_table + "',\n"
-                "     '" + ref.referencing_column + "',\n"
-                "     '" + ref.referenced_table + "',\n"
-                "     '" + ref.referenced_column + "',\n"
-                "     '" + constraint_name + "');";
-            lg->detail(sql);
-            conn->exec(sql);
-        } catch (runtime_error& e) {
-            string s = e.what();
-            if ( !(s.empty()) && s.back() == '\n' )
-                s.pop_back();
-            lg->detail(s);
-        }
+// Settings and data shared by the phases of a table update.
+class update_context {
+public:
+    const ldp_options& opt;
+    ldp_log* lg;
+    etymon::odbc_env* odbc;
+    const vector<source_state>& source_states;
+    string load_dir;
+    bool atomic_publish;
+    bool collect_table_ids;
+    int keyframe_interval;
+    // Run in dbsystem.update_runs whose phases are journaled, or 0.
+    int64_t run_id = 0;
+    // Log of measurements for dbsystem.perf, and the run they belong
+    // to.
+    perf_log* perf = nullptr;
+    int64_t perf_run_id = 0;
+    update_context(const ldp_options& opt, ldp_log* lg,
+                   etymon::odbc_env* odbc,
+                   const vector<source_state>& source_states) :
+        opt(opt), lg(lg), odbc(odbc), source_states(source_states) {}
+};
+
+// State of a table that is passed from one phase of its update to the
+// next.  Durations of phases are in seconds, or -1 if not known.
+class table_update {
+public:
+    table_schema* table;
+    bool anonymize_fields;
+    // Set if a phase did not complete, in which case the following
+    // phases are skipped.
+    bool failed = false;
+    bool merged = false;
+    // Set when the extraction or stage has been recorded in the journal.
+    bool extracted = false;
+    bool staged = false;
+    // Phases completed before the update was resumed, or null.
+    const journal_entry* resume = nullptr;
+    timer update_timer;
+    unique_ptr<extraction_files> ext_files;
+    change_index_map cidx;
+    merge_mode mode = merge_mode::replace;
+    size_t record_count = 0;
+    table_ids tids;
+    table_changes changes;
+    double extract_time = -1;
+    double stage_time = -1;
+    double merge_time = -1;
+    table_update(const ldp_options& opt, table_schema* table,
+                 bool anonymize_fields) :
+        table(table), anonymize_fields(anonymize_fields),
+        update_timer(opt) {}
+};
+
+// Updates the status of a table in dbsystem.tables.  The row count of
+// the table is the number of records staged, and the row count of the
+// history table is updated by the number of rows inserted, so that
+// neither table has to be counted.  The history table is counted only
+// if its row count is not already known.  The durations of the phases
+// are recorded for scheduling the next update, and the staleness of the
+// table before the update is recorded in dbsystem.table_freshness.
+static void update_table_status(ldp_log* lg, const table_update& tu,
+                                etymon::odbc_conn* conn, const dbtype& dbt,
+                                int64_t history_inserted)
+{
+    const table_schema& table = *(tu.table);
+    string sql =
+        "SELECT history_row_count\n"
+        "    FROM dbsystem.tables\n"
+        "    WHERE table_name = '" + table.name + "';";
+    lg->detail(sql);
+    string history_row_count = "NULL";
+    {
+        etymon::odbc_stmt stmt(conn);
+        conn->exec_direct(&stmt, sql);
+        if (conn->fetch(&stmt))
+            conn->get_data(&stmt, 1, &history_row_count);
     }
+    if (history_row_count == "NULL" || history_inserted < 0) {
+        sql =
+            "SELECT count(*)\n"
+            "    FROM history." + table.name + ";";
+        lg->detail(sql);
+        etymon::odbc_stmt stmt(conn);
+        conn->exec_direct(&stmt, sql);
+        conn->fetch(&stmt);
+        conn->get_data(&stmt, 1, &history_row_count);
+    } else {
+        history_row_count = to_string(stoll(history_row_count) +
+                                      history_inserted);
+    }
+    record_table_freshness(conn, lg, dbt, table.name);
+    sql =
+        "UPDATE dbsystem.tables\n"
+        "    SET updated = " + string(dbt.current_timestamp()) + ",\n"
+        "        row_count = " + to_string(tu.record_count) + ",\n"
+        "        history_row_count = " + history_row_count + ",\n"
+        "        extract_time = " + to_string(tu.extract_time) + ",\n"
+        "        stage_time = " + to_string(tu.stage_time) + ",\n"
+        "        merge_time = " + to_string(tu.merge_time) + ",\n"
+        "        documentation = '" + table.source_spec + " in "
+        + table.module_name + "',\n"
+        "        documentation_url = 'https://dev.folio.org/reference/api/#"
+        + table.module_name + "'\n"
+        "    WHERE table_name = '" + table.name + "';";
+    lg->detail(sql);
+    conn->exec(sql);
 }
 
 void select_config_general(etymon::odbc_conn* conn, ldp_log* lg,
@@ -341,217 +502,1037 @@ void select_config_general(etymon::odbc_conn* conn, ldp_log* lg,
     *enable_foreign_key_warnings = (s3 == "1");
 }
 
-void run_update(const ldp_options& opt)
+// Creates any partitions of the history tables that will be needed
+// during the current and next partition intervals.  This is done
+// outside of the table updates, because creating a partition locks the
+// history table.
+static void create_history_partitions(const ldp_options& opt, ldp_log* lg,
+                                      etymon::odbc_env* odbc,
+                                      const ldp_schema& schema)
 {
-    CURLcode cc;
-    etymon::curl_global curl_env(CURL_GLOBAL_ALL, &cc);
-    if (cc) {
-        throw runtime_error(string("Error initializing curl: ") +
-                            curl_easy_strerror(cc));
+    etymon::odbc_conn conn(odbc, opt.db);
+    dbtype dbt(&conn);
+    if (dbt.type() != dbsys::postgresql)
+        return;
+    string sql =
+        "SELECT history_partition_interval\n"
+        "    FROM dbconfig.general;";
+    lg->detail(sql);
+    string interval;
+    {
+        etymon::odbc_stmt stmt(&conn);
+        conn.exec_direct(&stmt, sql);
+        conn.fetch(&stmt);
+        conn.get_data(&stmt, 1, &interval);
+    }
+    if (!valid_partition_interval(interval)) {
+        lg->write(log_level::warning, "server", "",
+                  "Invalid history partition interval: " + interval + "\n"
+                  "    Action: Using interval \"month\"", -1);
+        interval = "month";
+    }
+    for (auto& table : schema.tables) {
+        if (!table_selected(opt, table.name))
+            continue;
+        try {
+            vector<string> statements;
+            ensure_history_partitions(&conn, table.name, interval, "",
+                                      &statements);
+            for (auto& s : statements)
+                lg->detail(s);
+        } catch (runtime_error& e) {
+            string s = e.what();
+            if ( !(s.empty()) && s.back() == '\n' )
+                s.pop_back();
+            lg->write(log_level::warning, "update", table.name,
+                      "Unable to create history partitions:\n"
+                      "    Table: history." + table.name + "\n"
+                      "    Error: " + s, -1);
+        }
     }
+}
 
-    etymon::odbc_env odbc;
+// Creates any missing indexes and functions that support point-in-time
+// queries on the history tables.
+static void create_history_as_of_support(const ldp_options& opt,
+                                         ldp_log* lg,
+                                         etymon::odbc_env* odbc,
+                                         const ldp_schema& schema)
+{
+    etymon::odbc_conn conn(odbc, opt.db);
+    dbtype dbt(&conn);
+    if (dbt.type() != dbsys::postgresql)
+        return;
+    for (auto& table : schema.tables) {
+        if (!table_selected(opt, table.name))
+            continue;
+        try {
+            vector<string> sqls;
+            create_history_as_of_indexes_sql(table.name, &conn, dbt, &sqls);
+            for (auto& sql : sqls) {
+                lg->detail(sql);
+                conn.exec(sql);
+            }
+            string sql;
+            create_history_as_of_function_sql(table.name, &conn, dbt, &sql);
+            lg->detail(sql);
+            conn.exec(sql);
+        } catch (runtime_error& e) {
+            string s = e.what();
+            if ( !(s.empty()) && s.back() == '\n' )
+                s.pop_back();
+            lg->write(log_level::warning, "update", table.name,
+                      "Unable to create point-in-time support:\n"
+                      "    Table: history." + table.name + "\n"
+                      "    Error: " + s, -1);
+        }
+    }
+}
 
+// Returns the keyframe interval for delta encoding of history data, or
+// 0 if delta encoding is disabled.
+static int select_history_keyframe_interval(const ldp_options& opt,
+                                            ldp_log* lg,
+                                            etymon::odbc_env* odbc)
+{
+    etymon::odbc_conn conn(odbc, opt.db);
+    string sql =
+        "SELECT history_keyframe_interval\n"
+        "    FROM dbconfig.general;";
+    lg->detail(sql);
+    string interval;
+    {
+        etymon::odbc_stmt stmt(&conn);
+        conn.exec_direct(&stmt, sql);
+        conn.fetch(&stmt);
+        conn.get_data(&stmt, 1, &interval);
+    }
+    int keyframe_interval = stoi(interval);
+    if (keyframe_interval <= 0)
+        return 0;
+    dbtype dbt(&conn);
+    if (dbt.type() != dbsys::postgresql) {
+        lg->write(log_level::warning, "server", "",
+                  "Delta encoding of history is supported only with "
+                  "PostgreSQL", -1);
+        return 0;
+    }
+    return keyframe_interval;
+}
+
+static const int publish_attempts = 10;
+
+// Publishes all tables in the shadow schema in a single transaction.
+// The locks needed to replace the tables are limited by a lock timeout,
+// and if they cannot be acquired the transaction is retried.
+static void publish_all_tables(const ldp_options& opt, ldp_log* lg,
+                               etymon::odbc_env* odbc,
+                               const vector<string>& tables,
+                               map<string, change_index_map>* cidx)
+{
+    if (tables.empty())
+        return;
+    lg->write(log_level::debug, "server", "", "Starting publish", -1);
+    timer publish_timer(opt);
+    perf_scope ps(perf_publish);
+    ps.count(tables.size(), 0, 0);
+    etymon::odbc_conn conn(odbc, opt.db);
+    for (int attempt = 1; ; attempt++) {
+        try {
+            etymon::odbc_tx tx(&conn);
+            string sql =
+                "SET LOCAL lock_timeout = '" +
+                to_string(opt.publish_lock_timeout) + "s';";
+            lg->detail(sql);
+            conn.exec(sql);
+            remove_foreign_key_constraints(
+                    &conn, lg, set<string>(tables.begin(), tables.end()));
+            publish_tables(opt, lg, tables, &conn);
+            for (auto& [table, indexes] : *cidx)
+                for (auto& [tenant_id, index] : indexes)
+                    index->save_stamp(&conn, lg);
+            tx.commit();
+            break;
+        } catch (runtime_error& e) {
+            if (attempt == publish_attempts)
+                throw;
+            string s = e.what();
+            if ( !(s.empty()) && s.back() == '\n' )
+                s.pop_back();
+            lg->write(log_level::warning, "server", "",
+                      "Unable to publish tables:\n"
+                      "    Error: " + s + "\n"
+                      "    Action: Retrying in 60 seconds", -1);
+            std::this_thread::sleep_for(std::chrono::seconds(60));
+        }
+    }
+    for (auto& [table, indexes] : *cidx)
+        for (auto& [tenant_id, index] : indexes)
+            index->commit();
+    lg->write(log_level::debug, "server", "", "Completed publish",
+              publish_timer.elapsed_time());
+}
+
+// Shows the phase of a table in the live metrics, if enabled.
+static void show_phase(const ldp_options& opt, const table_update& tu,
+                       table_phase phase)
+{
+    if (opt.metrics != nullptr)
+        opt.metrics->set_phase(tu.table->name, phase);
+}
+
+static void log_table_error(const ldp_options& opt, const table_schema& table,
+                            const runtime_error& e)
+{
+    string s = table.name + ": " + e.what();
+    if ( !(s.empty()) && s.back() == '\n' )
+        s.pop_back();
+    etymon::odbc_env odbc;
     etymon::odbc_conn log_conn(&odbc, opt.db);
-    ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog);
+    ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog,
+               opt.log_file);
+    lg.write(log_level::error, "server", "", s, -1);
+}
 
-    lg.write(log_level::debug, "server", "", "Starting full update", -1);
-    timer full_update_timer(opt);
+// Retrieves the data for a table from each source.  The curl handle is
+// reused across tables so that connections to the server are kept open.
+static void extract_table(const update_context& ctx, table_update* tu,
+                          curl_wrapper* curlw)
+{
+    const ldp_options& opt = ctx.opt;
+    ldp_log& lg = *(ctx.lg);
+    table_schema& table = *(tu->table);
+    try {
+        lg.write(log_level::trace, "", "",
+                 "Updating table: " + table.name, -1);
+        show_phase(opt, *tu, table_phase::extract);
+
+        timer extract_timer(opt);
+        tu->ext_files.reset(new extraction_files(opt));
+
+        // A table that was staged before the update was resumed only
+        // has to be merged, and one that was extracted is staged from
+        // the files already on disk if they are all there.
+        if (tu->resume != nullptr && tu->resume->staged) {
+            tu->ext_files.reset();
+            tu->extract_time = tu->resume->extract_time;
+            return;
+        }
+        if (tu->resume != nullptr && tu->resume->extracted) {
+            bool found = true;
+            if (opt.load_from_dir == "")
+                for (auto& state : ctx.source_states)
+                    if (!find_extracted_files(state.source, ctx.load_dir,
+                                              table.name,
+                                              tu->ext_files.get()))
+                        found = false;
+            if (found) {
+                lg.write(log_level::trace, "", "",
+                         "Reusing extracted data: " + table.name, -1);
+                tu->extracted = true;
+                tu->extract_time = tu->resume->extract_time;
+                return;
+            }
+            tu->ext_files.reset(new extraction_files(opt));
+        }
 
-    ldp_schema schema;
-    ldp_schema::make_default_schema(&schema);
+        perf_context pc(ctx.perf, ctx.perf_run_id, table.name);
+        perf_scope ps(perf_extract);
+        etymon::trace_span span("phase", "extract", "table", table.name);
+        for (auto& state : ctx.source_states) {
+
+            curlw->reset();
+            string tenant_header = "X-Okapi-Tenant: ";
+            tenant_header + state.source.okapi_tenant;
+            string token_header = "X-Okapi-Token: ";
+            token_header += state.token;
+            curlw->headers = curl_slist_append(curlw->headers,
+                                               tenant_header.c_str());
+            curlw->headers = curl_slist_append(curlw->headers,
+                                               token_header.c_str());
+            curlw->headers = curl_slist_append(
+                curlw->headers, "Accept: application/json,text/plain");
+            curl_easy_setopt(curlw->curl, CURLOPT_HTTPHEADER,
+                             curlw->headers);
+
+            if (opt.load_from_dir == "") {
+                lg.write(log_level::trace, "", "",
+                         "Extracting: " + table.source_spec, -1);
+                bool found_data = direct_override(state.source, table.name) ?
+                    retrieve_direct(state.source, &lg, table, ctx.load_dir,
+                                    tu->ext_files.get()) :
+                    retrieve_pages(*curlw, opt, state.source, &lg,
+                                   state.token, table, ctx.load_dir,
+                                   tu->ext_files.get());
+                if (!found_data)
+                    table.skip = true;
+            }
+        } // for
+        uint64_t bytes = 0;
+        for (auto& file : tu->ext_files->files) {
+            error_code ec;
+            uintmax_t size = fs::file_size(file, ec);
+            if (!ec)
+                bytes += size;
+        }
+        ps.count(0, bytes, bytes);
+
+        tu->extract_time = extract_timer.elapsed_time();
+        if (table.skip || opt.extract_only) {
+            tu->failed = true;
+            tu->ext_files.reset();
+        } else if (ctx.run_id != 0) {
+            etymon::odbc_conn conn(ctx.odbc, opt.db);
+            journal_phase(&conn, &lg, ctx.run_id, table.name, phase_extract,
+                          tu->extract_time, nullptr);
+            tu->extracted = true;
+        }
+    } catch (runtime_error& e) {
+        log_table_error(opt, table, e);
+        tu->failed = true;
+        tu->ext_files.reset();
+    }
+    show_phase(opt, *tu, tu->failed ? table_phase::idle :
+               table_phase::extracted);
+}
 
-    extraction_files ext_dir(opt);
+// Removes the extracted files of a table, unless keep is set, in which
+// case they are left on disk for a resumed update to reuse.
+static void release_extracted_files(table_update* tu, bool keep)
+{
+    if (keep && tu->ext_files)
+        tu->ext_files->files.clear();
+    tu->ext_files.reset();
+}
 
-    string load_dir;
+// Stages the extracted data in the loading table, which is committed
+// so that it can be merged on another connection.  The extracted files
+// are removed after staging.  In a journaled update, the stage is
+// recorded unless the change index is used, because the change index
+// entries collected during staging are needed for the merge; in that
+// case the files are kept until the table is merged.
+static void stage_table(const update_context& ctx, table_update* tu)
+{
+    if (tu->failed)
+        return;
+    if (tu->resume != nullptr && tu->resume->staged) {
+        tu->staged = true;
+        tu->mode = tu->resume->mode;
+        tu->record_count = tu->resume->record_count;
+        tu->stage_time = tu->resume->stage_time;
+        show_phase(ctx.opt, *tu, table_phase::staged);
+        return;
+    }
+    const ldp_options& opt = ctx.opt;
+    ldp_log& lg = *(ctx.lg);
+    table_schema& table = *(tu->table);
+    show_phase(opt, *tu, table_phase::stage);
+    try {
+        perf_context pc(ctx.perf, ctx.perf_run_id, table.name);
+        etymon::trace_span span("phase", "stage", "table", table.name);
+        timer stage_timer(opt);
+        etymon::odbc_conn conn(ctx.odbc, opt.db);
+        //PQsetNoticeProcessor(db.conn, debugNoticeProcessor, (void*) &opt);
+        dbtype dbt(&conn);
+
+        // Load the change index for each tenant, which is used to
+        // skip unchanged records during staging.
+        if (opt.change_index) {
+            for (auto& state : ctx.source_states) {
+                int16_t tenant_id = state.source.tenant_id;
+                if (tu->cidx.count(tenant_id) > 0)
+                    continue;
+                tu->cidx[tenant_id] = unique_ptr<change_index>(
+                        new change_index(opt.datadir, table.name,
+                                         tenant_id));
+                tu->cidx[tenant_id]->open(&conn, &lg);
+            }
+        }
 
-    vector<source_state> source_states;
+        etymon::odbc_tx tx(&conn);
+
+        lg.write(log_level::trace, "", "",
+                 "Staging table: " + table.name, -1);
+        bool ok = stage_table_1(opt, ctx.source_states, &lg, &table,
+                                ctx.odbc, &conn, &dbt, ctx.load_dir,
+                                tu->anonymize_fields);
+        if (ok) {
+            tu->mode = ctx.atomic_publish ? merge_mode::replace : opt.merge;
+            ok = stage_table_2(opt, ctx.source_states, &lg, &table,
+                               ctx.odbc, &conn, &dbt, ctx.load_dir,
+                               tu->anonymize_fields,
+                               opt.change_index ? &(tu->cidx) : nullptr,
+                               &(tu->mode),
+                               ctx.collect_table_ids ? &(tu->tids) : nullptr,
+                               &(tu->record_count));
+        }
+        if (ok && ctx.run_id != 0 && tu->cidx.empty()) {
+            journal_entry e;
+            e.mode = tu->mode;
+            e.record_count = tu->record_count;
+            journal_phase(&conn, &lg, ctx.run_id, table.name, phase_stage,
+                          stage_timer.elapsed_time(), &e);
+        }
+        if (ok) {
+            tx.commit();
+            tu->staged = (ctx.run_id != 0 && tu->cidx.empty());
+        } else {
+            tu->failed = true;
+        }
+        tu->stage_time = stage_timer.elapsed_time();
+    } catch (runtime_error& e) {
+        log_table_error(opt, table, e);
+        tu->failed = true;
+    }
+    if (ctx.run_id == 0 || tu->staged)
+        tu->ext_files.reset();
+    else if (tu->failed)
+        release_extracted_files(tu, tu->extracted);
+    show_phase(opt, *tu, tu->failed ? table_phase::idle :
+               table_phase::staged);
+}
+
+// Removes the stage of a table from the journal after a resumed merge
+// has failed, in case its loading table was dropped or replaced after
+// it was staged.
+static void forget_staged_table(const update_context& ctx,
+                                const table_update& tu)
+{
+    try {
+        etymon::odbc_conn conn(ctx.odbc, ctx.opt.db);
+        forget_phase(&conn, ctx.lg, ctx.run_id, tu.table->name, phase_stage);
+    } catch (runtime_error& e) {
+        string s = e.what();
+        if ( !(s.empty()) && s.back() == '\n' )
+            s.pop_back();
+        ctx.lg->detail(s);
+    }
+}
+
+// Merges the loading table into the history table and replaces or
+// upserts the current table.
+static void merge_staged_table(const update_context& ctx, table_update* tu)
+{
+    if (tu->failed)
+        return;
+    const ldp_options& opt = ctx.opt;
+    ldp_log& lg = *(ctx.lg);
+    table_schema& table = *(tu->table);
+    show_phase(opt, *tu, table_phase::merge);
+    try {
+        perf_context pc(ctx.perf, ctx.perf_run_id, table.name);
+        perf_scope ps(perf_merge);
+        ps.count(tu->record_count, 0, 0);
+        etymon::trace_span span("phase", "merge", "table", table.name);
+        timer merge_timer(opt);
+        etymon::odbc_conn conn(ctx.odbc, opt.db);
+        dbtype dbt(&conn);
+
+        // For a parallel merge, the loading table is compared with the
+        // history table on several connections before the merge.
+        int parts = opt.merge_connections;
+        if (parts > 1) {
+            lg.write(log_level::trace, "", "",
+                     "Comparing table: " + table.name, -1);
+            compare_history_parallel(opt, &lg, table, ctx.odbc, dbt,
+                                     parts, ctx.keyframe_interval);
+        }
+
+        {
+            // Held until the transaction ends, if the constraints of the
+            // table are dropped in it.
+            unique_lock<mutex> constraint_lock(replace_constraints_mutex,
+                                               defer_lock);
+            etymon::odbc_tx tx(&conn);
+
+            lg.write(log_level::trace, "", "",
+                     "Merging table: " + table.name, -1);
+            table_changes& tc = tu->changes;
+            int64_t history_inserted;
+            merge_table(opt, &lg, table, ctx.odbc, &conn, dbt, parts,
+                        ctx.keyframe_interval, &tc.history_rows,
+                        &history_inserted);
+
+            change_index_map& cidx = tu->cidx;
+            bool filtered = !cidx.empty() && cidx.begin()->second->filter;
+            if (tu->mode == merge_mode::upsert) {
+                lg.write(log_level::trace, "", "",
+                         "Upserting table: " + table.name, -1);
+                if (!upsert_table(opt, &lg, table, &conn,
+                                  filtered ? &cidx : nullptr,
+                                  &tc.rows)) {
+                    lg.write(log_level::trace, "", "",
+                             "Unable to upsert table: " + table.name, -1);
+                    tu->mode = merge_mode::replace;
+                    if (filtered)
+                        copy_unchanged_records(&lg, table, &conn, &cidx);
+                }
+            }
+
+            if (tu->mode == merge_mode::replace && ctx.atomic_publish) {
+                lg.write(log_level::trace, "", "",
+                         "Shadowing table: " + table.name, -1);
+                shadow_table(opt, &lg, table, &conn);
+            } else if (tu->mode == merge_mode::replace) {
+                lg.write(log_level::trace, "", "",
+                         "Replacing table: " + table.name, -1);
+
+                // The constraints were not dropped before the update if
+                // the table was to be upserted.
+                if (opt.merge != merge_mode::replace) {
+                    constraint_lock.lock();
+                    remove_foreign_key_constraints(&conn, &lg,
+                                                   {table.name});
+                }
+                drop_table(opt, &lg, table.name, &conn);
+
+                place_table(opt, &lg, table, &conn);
+            }
+            tc.replaced = (tu->mode == merge_mode::replace);
+            //updateStatus(opt, table, &conn);
+
+            //updateDBPermissions(opt, &lg, &conn);
+
+            // With atomic publish, the change indexes take effect when
+            // the table is published.
+            for (auto& [tenant_id, index] : cidx) {
+                if (ctx.atomic_publish)
+                    index->write();
+                else
+                    index->save(&conn, &lg);
+            }
+
+            tu->merge_time = merge_timer.elapsed_time();
+            update_table_status(&lg, *tu, &conn, dbt, history_inserted);
+
+            if (ctx.run_id != 0) {
+                journal_entry e;
+                e.changes = tc;
+                journal_phase(&conn, &lg, ctx.run_id, table.name, phase_merge,
+                              tu->merge_time, &e);
+            }
+
+            tx.commit();
+        }
+
+        if (!ctx.atomic_publish) {
+            for (auto& [tenant_id, index] : tu->cidx)
+                index->commit();
+        }
+        tu->merged = true;
+        if (opt.metrics != nullptr)
+            opt.metrics->record_table(table.name, tu->extract_time,
+                                      tu->stage_time, tu->merge_time);
+
+        //vacuumAnalyzeTable(opt, table, &conn);
+
+        lg.write(log_level::debug, "update", table.name,
+                 "Updated table: " + table.name,
+                 tu->update_timer.elapsed_time());
+
+        //if (opt.logLevel == log_level::trace)
+        //    loadTimer.print("load time");
+
+    } catch (runtime_error& e) {
+        log_table_error(opt, table, e);
+        tu->failed = true;
+        if (tu->resume != nullptr && tu->resume->staged)
+            forget_staged_table(ctx, *tu);
+    }
+    release_extracted_files(tu, tu->failed && tu->extracted);
+    show_phase(opt, *tu, table_phase::idle);
+}
+
+// Reads the durations of the phases of each table's last update.
+static void select_table_durations(etymon::odbc_conn* conn, ldp_log* lg,
+                                   map<string, vector<double>>* durations)
+{
+    string sql =
+        "SELECT table_name,\n"
+        "       extract_time,\n"
+        "       stage_time,\n"
+        "       merge_time\n"
+        "    FROM dbsystem.tables;";
+    lg->detail(sql);
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    while (conn->fetch(&stmt)) {
+        string table_name, t;
+        conn->get_data(&stmt, 1, &table_name);
+        vector<double>& d = (*durations)[table_name];
+        for (uint16_t c = 2; c <= 4; c++) {
+            conn->get_data(&stmt, c, &t);
+            d.push_back(t == "NULL" ? -1 : stod(t));
+        }
+    }
+}
+
+// Priority of a table that is due for refresh to meet its target
+// staleness, which exceeds any duration.
+static const double overdue_priority = 1e12;
+
+// Assigns a priority to each table for scheduling, longest processing
+// time first.  The processing time of a table is its duration in the
+// previous update on the resource that had the most work in total.
+// Tables that have no previous duration are given the highest priority,
+// followed by tables that are due to meet their target staleness, the
+// most overdue first.
+static void prioritize_tables(const ldp_options& opt, ldp_log* lg,
+                              etymon::odbc_env* odbc,
+                              const vector<unique_ptr<table_update>>& tus,
+                              vector<double>* priorities)
+{
+    map<string, vector<double>> durations;
+    map<string, table_freshness> freshness;
+    try {
+        etymon::odbc_conn conn(odbc, opt.db);
+        select_table_durations(&conn, lg, &durations);
+        dbtype dbt(&conn);
+        select_table_freshness(&conn, lg, dbt, &freshness);
+    } catch (runtime_error& e) {
+        string s = e.what();
+        if ( !(s.empty()) && s.back() == '\n' )
+            s.pop_back();
+        lg->detail(s);
+    }
+    double totals[3] = {0, 0, 0};
+    for (auto& [table, d] : durations)
+        for (size_t r = 0; r < 3; r++)
+            if (d[r] > 0)
+                totals[r] += d[r];
+    size_t bottleneck = 0;
+    if (!opt.extract_only)
+        for (size_t r = 1; r < 3; r++)
+            if (totals[r] > totals[bottleneck])
+                bottleneck = r;
+    priorities->clear();
+    for (auto& tu : tus) {
+        auto it = durations.find(tu->table->name);
+        double p = (it == durations.end() || it->second[bottleneck] < 0) ?
+            numeric_limits<double>::infinity() : it->second[bottleneck];
+        auto f = freshness.find(tu->table->name);
+        if (!isinf(p) && f != freshness.end() && f->second.refresh_due())
+            p = overdue_priority * (1 + f->second.urgency());
+        priorities->push_back(p);
+    }
+}
+
+// Updates the tables in three phases: extract, stage, and merge.  The
+// phases of different tables run concurrently, with the number of
+// concurrent phases of each kind limited by extract_concurrency,
+// stage_concurrency, and merge_concurrency.  These correspond to the
+// network, the client, and the database.  Tables are started longest
+// first, and extraction runs ahead of staging by a limited number of
+// tables so that extracted data do not accumulate on disk.  Each
+// worker thread keeps its own curl handle.
+static void schedule_table_updates(const update_context& ctx,
+                                   const vector<unique_ptr<table_update>>& tus)
+{
+    const ldp_options& opt = ctx.opt;
+    vector<double> priorities;
+    prioritize_tables(opt, ctx.lg, ctx.odbc, tus, &priorities);
+    vector<size_t> order(tus.size());
+    for (size_t x = 0; x < order.size(); x++)
+        order[x] = x;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return priorities[a] > priorities[b];
+    });
+
+    task_pool pool(opt.extract_concurrency + opt.stage_concurrency +
+                   opt.merge_concurrency);
+    worker_local<curl_wrapper> curl_handles(pool, []() {
+        return unique_ptr<curl_wrapper>(new curl_wrapper());
+    });
+    task_scheduler sched;
+    size_t network = sched.add_resource(opt.extract_concurrency);
+    size_t client = sched.add_resource(opt.stage_concurrency);
+    size_t database = sched.add_resource(opt.merge_concurrency);
+    size_t window = opt.extract_concurrency + opt.stage_concurrency;
+    vector<size_t> stage_tasks;
+    for (size_t x : order) {
+        table_update* tu = tus[x].get();
+        double p = priorities[x];
+        size_t e = sched.add_task(network, p, [&ctx, tu, &curl_handles]() {
+            extract_table(ctx, tu, curl_handles.get());
+        });
+        if (opt.extract_only)
+            continue;
+        if (stage_tasks.size() >= window)
+            sched.add_dependency(e, stage_tasks[stage_tasks.size() - window]);
+        size_t s = sched.add_task(client, p, [&ctx, tu]() {
+            stage_table(ctx, tu);
+        });
+        sched.add_dependency(s, e);
+        size_t m = sched.add_task(database, p, [&ctx, tu]() {
+            merge_staged_table(ctx, tu);
+        });
+        sched.add_dependency(m, s);
+        stage_tasks.push_back(s);
+    }
+    sched.run(&pool);
+}
+
+// Logs in to each source and creates the directory for extracted data,
+// or uses the directory specified by the --sourcedir option.  Full
+// updates, refreshes, and jobs extract data into separate directories,
+// so that a refresh does not remove files that a resumed full update
+// would reuse.
+static void prepare_sources(const ldp_options& opt, ldp_log* lg,
+                            const string& dir_name, bool keep_files,
+                            extraction_files* ext_dir, string* load_dir,
+                            vector<source_state>* source_states)
+{
     //string token, tenant_header, token_header;
 
     if (opt.load_from_dir != "") {
         //if (opt.logLevel == log_level::trace)
         //    fprintf(opt.err, "%s: Reading data from directory: %s\n",
         //            opt.prog, opt.loadFromDir.c_str());
-        load_dir = opt.load_from_dir;
+        *load_dir = opt.load_from_dir;
         data_source source;
         source_state state(source);
-        source_states.push_back(state);
+        source_states->push_back(state);
     } else {
 
         for (auto& source : opt.enable_sources) {
 
             source_state state(source);
 
-            lg.write(log_level::trace, "", "", "Logging in to Okapi service",
-                     -1);
+            lg->write(log_level::trace, "", "", "Logging in to Okapi service",
+                      -1);
 
-            okapi_login(opt, source, &lg, &state.token);
+            okapi_login(opt, source, lg, &state.token);
 
-            make_update_tmp_dir(opt, &load_dir);
-            ext_dir.dir = load_dir;
+            make_update_tmp_dir(opt, dir_name, keep_files, load_dir);
+            ext_dir->dir = *load_dir;
 
-            source_states.push_back(state);
+            source_states->push_back(state);
         }
     }
+}
 
-    for (auto& table : schema.tables) {
-
-        try {
+// Claims and runs table update jobs until no queued jobs remain.  Each
+// job extracts, stages, and merges one table.  A job that fails is
+// requeued, and it may then be attempted by another worker.
+static void process_jobs(const update_context& ctx, const ldp_schema& schema,
+                         const string& worker)
+{
+    const ldp_options& opt = ctx.opt;
+    ldp_log& lg = *(ctx.lg);
+    etymon::odbc_conn conn(ctx.odbc, opt.db);
+    curl_wrapper curlw;
+    job j;
+    while (claim_job(&conn, &lg, worker, &j)) {
+        lg.write(log_level::trace, "", "", "Claimed job: " + j.table_name, -1);
+        const table_schema* found = nullptr;
+        for (auto& t : schema.tables)
+            if (t.name == j.table_name)
+                found = &t;
+        if (found == nullptr) {
+            lg.write(log_level::error, "server", "",
+                     "Unknown table in job: " + j.table_name, -1);
+            finish_job(&conn, &lg, worker, j, "failed", nullptr);
+            continue;
+        }
+        table_schema table = *found;
+        table_update tu(opt, &table, opt.anonymize);
+        update_context jctx = ctx;
+        jctx.perf_run_id = j.run_id;
+        {
+            job_heartbeat heartbeat(ctx.odbc, opt.db, &lg, worker, j);
+            extract_table(jctx, &tu, &curlw);
+            stage_table(jctx, &tu);
+            merge_staged_table(jctx, &tu);
+        }
+        bool held;
+        if (tu.merged)
+            held = finish_job(&conn, &lg, worker, j, "done", &(tu.changes));
+        else if (table.skip)
+            held = finish_job(&conn, &lg, worker, j, "skipped", nullptr);
+        else
+            held = retry_job(&conn, &lg, worker, j);
+        if (!held)
+            lg.write(log_level::warning, "server", "",
+                     "Job was requeued before it finished: " + j.table_name,
+                     -1);
+        if (ctx.perf != nullptr)
+            ctx.perf->write(&conn, &lg);
+    }
+}
 
-            // Skip this table if the --table option is specified and does not
-            // match this table.
-            if (opt.table != "" && opt.table != table.name)
-                continue;
+// Updates the tables through the job queue in dbsystem.jobs, so that
+// worker processes on this or other hosts can update tables at the same
+// time.  This process also works on the queue, and then waits for the
+// jobs claimed by other workers, requeueing any whose worker stops
+// sending heartbeats.  The jobs belong to the run of ctx.perf_run_id.
+// The changes made by the jobs are returned for maintenance.
+static void distribute_table_updates(
+        const update_context& ctx, const ldp_schema& schema,
+        const vector<unique_ptr<table_update>>& tus,
+        map<string, table_changes>* changes)
+{
+    const ldp_options& opt = ctx.opt;
+    vector<double> priorities;
+    prioritize_tables(opt, ctx.lg, ctx.odbc, tus, &priorities);
+    vector<pair<string, double>> tables;
+    for (size_t x = 0; x < tus.size(); x++)
+        tables.push_back(make_pair(tus[x]->table->name, priorities[x]));
+    int64_t run_id = ctx.perf_run_id;
+    etymon::odbc_conn conn(ctx.odbc, opt.db);
+    enqueue_jobs(&conn, ctx.lg, run_id, tables);
+    string worker = job_worker_name();
+    while (true) {
+        process_jobs(ctx, schema, worker);
+        requeue_stale_jobs(&conn, ctx.lg, run_id);
+        job_counts counts;
+        count_jobs(&conn, ctx.lg, run_id, &counts);
+        if (counts.queued == 0 && counts.running == 0)
+            break;
+        if (counts.queued == 0)
+            std::this_thread::sleep_for(
+                std::chrono::seconds(job_heartbeat_interval));
+    }
+    select_job_changes(&conn, ctx.lg, run_id, changes);
+}
 
-            // Enable anonymization of the entire table.
-            bool anonymize_table = opt.anonymize && table.anonymize;
-            // Enable selective anonymization of fields.
-            bool anonymize_fields = opt.anonymize;
+void run_update(const ldp_options& opt)
+{
+    CURLcode cc;
+    etymon::curl_global curl_env(CURL_GLOBAL_ALL, &cc);
+    if (cc) {
+        throw runtime_error(string("Error initializing curl: ") +
+                            curl_easy_strerror(cc));
+    }
 
-            // Skip this table if the entire table should be anonymized.
-            if (anonymize_table)
-                continue;
+    etymon::odbc_env odbc;
 
-            lg.write(log_level::trace, "", "",
-                     "Updating table: " + table.name, -1);
-
-            timer update_timer(opt);
-
-            extraction_files ext_files(opt);
-
-            for (auto& state : source_states) {
-
-                curl_wrapper curlw;
-                //if (!c.curl) {
-                //    // throw?
-                //}
-                string tenant_header = "X-Okapi-Tenant: ";
-                tenant_header + state.source.okapi_tenant;
-                string token_header = "X-Okapi-Token: ";
-                token_header += state.token;
-                curlw.headers = curl_slist_append(curlw.headers,
-                                                  tenant_header.c_str());
-                curlw.headers = curl_slist_append(curlw.headers,
-                                                  token_header.c_str());
-                curlw.headers = curl_slist_append(
-                    curlw.headers, "Accept: application/json,text/plain");
-                curl_easy_setopt(curlw.curl, CURLOPT_HTTPHEADER,
-                                 curlw.headers);
-
-                if (opt.load_from_dir == "") {
-                    lg.write(log_level::trace, "", "",
-                             "Extracting: " + table.source_spec, -1);
-                    bool found_data = direct_override(state.source, table.name) ?
-                        retrieve_direct(state.source, &lg, table, load_dir,
-                                        &ext_files) :
-                        retrieve_pages(curlw, opt, state.source, &lg,
-                                       state.token, table, load_dir,
-                                       &ext_files);
-                    if (!found_data)
-                        table.skip = true;
-                }
-            } // for
+    etymon::odbc_conn log_conn(&odbc, opt.db);
+    ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog,
+               opt.log_file);
+
+    // A refresh updates only the requested tables.
+    bool refresh = !opt.refresh_tables.empty();
+    string update_name = refresh ? "refresh" : "full update";
+    if (refresh) {
+        string tables;
+        for (auto& table : opt.refresh_tables)
+            tables += (tables.empty() ? "" : ", ") + table;
+        lg.write(log_level::debug, "server", "", "Starting refresh: " + tables,
+                 -1);
+    } else {
+        lg.write(log_level::debug, "server", "", "Starting full update", -1);
+    }
+    timer full_update_timer(opt);
 
-            if (table.skip || opt.extract_only)
-                continue;
+    // If atomic publish is enabled, updated tables are kept in the shadow
+    // schema until all tables have been updated.
+    bool atomic_publish = opt.atomic_publish;
+
+    // With distributed updates, tables are updated by worker processes
+    // through the job queue.
+    bool distributed = opt.distributed_update && !opt.extract_only;
+    if (distributed) {
+        dbtype dbt(&log_conn);
+        if (dbt.type() != dbsys::postgresql) {
+            lg.write(log_level::warning, "server", "",
+                     "Distributed updates are supported only with "
+                     "PostgreSQL", -1);
+            distributed = false;
+        } else if (atomic_publish) {
+            lg.write(log_level::warning, "server", "",
+                     "Atomic publish is not supported with distributed "
+                     "updates", -1);
+            atomic_publish = false;
+        }
+    }
 
+    if (atomic_publish) {
+        dbtype dbt(&log_conn);
+        if (dbt.type() != dbsys::postgresql) {
+            lg.write(log_level::warning, "server", "",
+                     "Atomic publish is supported only with PostgreSQL", -1);
+            atomic_publish = false;
+        } else {
             etymon::odbc_conn conn(&odbc, opt.db);
-            //PQsetNoticeProcessor(db.conn, debugNoticeProcessor, (void*) &opt);
-            dbtype dbt(&conn);
+            clear_shadow_tables(&lg, &conn);
+        }
+    }
 
-            create_latest_history_table(opt, &lg, table, &conn);
+    // A full update records each completed phase in the journal, so
+    // that it can be resumed if it does not complete.  With atomic
+    // publish no table is complete until all are published, and
+    // distributed updates retry tables through the job queue.
+    bool journaled = !refresh && !distributed && !atomic_publish &&
+        !opt.extract_only;
+    update_run run;
+    if (journaled) {
+        begin_update_run(&log_conn, &lg, opt.table, opt.resume, &run);
+        if (run.resumed)
+            lg.write(log_level::debug, "server", "", "Resuming full update",
+                     -1);
+    }
 
-            {
-                etymon::odbc_tx tx(&conn);
+    // Measurements of the update are attributed to the journaled run,
+    // or otherwise to a new run id.  Those not specific to a table have
+    // an empty table name.
+    perf_log perf;
+    int64_t perf_run_id = journaled ? run.run_id :
+        chrono::duration_cast<chrono::microseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+    perf_context run_perf(&perf, perf_run_id, "");
+    vector<string> shadow_tables;
+    map<string, change_index_map> shadow_indexes;
 
-                lg.write(log_level::trace, "", "",
-                         "Staging table: " + table.name, -1);
-                bool ok = stage_table_1(opt, source_states, &lg, &table, &odbc,
-                                        &conn, &dbt, load_dir, anonymize_fields);
-                if (!ok)
-                    continue;
+    ldp_schema schema;
+    ldp_schema::make_default_schema(&schema);
+    for (auto& name : opt.refresh_tables) {
+        bool found = false;
+        for (auto& table : schema.tables)
+            if (table.name == name)
+                found = true;
+        if (!found)
+            lg.write(log_level::warning, "server", "",
+                     "Unknown table in refresh request: " + name, -1);
+    }
 
-                ok = stage_table_2(opt, source_states, &lg, &table, &odbc,
-                                   &conn, &dbt, load_dir,
-                                   anonymize_fields);
-                if (!ok)
-                    continue;
+    // If foreign key detection is enabled, the ids of each table are
+    // collected during staging.
+    bool collect_table_ids = false;
+    map<string, table_ids> table_ids_map;
 
-                lg.write(log_level::trace, "", "",
-                         "Merging table: " + table.name, -1);
-                merge_table(opt, &lg, table, &odbc, &conn, dbt);
+    // Changes made to each table, which determine the maintenance done
+    // after the update.
+    map<string, table_changes> changes;
 
-                lg.write(log_level::trace, "", "",
-                         "Replacing table: " + table.name, -1);
+    int keyframe_interval = 0;
+    if (!opt.extract_only) {
+        etymon::odbc_conn conn(&odbc, opt.db);
+        bool force_foreign_key_constraints, enable_foreign_key_warnings;
+        select_config_general(&conn, &lg, &collect_table_ids,
+                              &force_foreign_key_constraints,
+                              &enable_foreign_key_warnings);
+        // Ids are not collected by workers, and they are read from the
+        // database instead.
+        if (distributed || refresh)
+            collect_table_ids = false;
+        create_history_partitions(opt, &lg, &odbc, schema);
+        create_history_as_of_support(opt, &lg, &odbc, schema);
+        keyframe_interval = select_history_keyframe_interval(opt, &lg,
+                                                             &odbc);
+    }
 
-                remove_foreign_key_constraints(&conn, &lg);
-                drop_table(opt, &lg, table.name, &conn);
+    extraction_files ext_dir(opt);
+    string load_dir;
+    vector<source_state> source_states;
+    prepare_sources(opt, &lg, refresh ? "refresh" : "update", run.resumed,
+                    &ext_dir, &load_dir, &source_states);
+    // The directory of a journaled update is removed only if the update
+    // completes.
+    string ext_dir_path = ext_dir.dir;
+    if (journaled)
+        ext_dir.dir = "";
+
+    update_context ctx(opt, &lg, &odbc, source_states);
+    ctx.load_dir = load_dir;
+    ctx.atomic_publish = atomic_publish;
+    ctx.collect_table_ids = collect_table_ids;
+    ctx.keyframe_interval = keyframe_interval;
+    ctx.run_id = run.run_id;
+    ctx.perf = &perf;
+    ctx.perf_run_id = perf_run_id;
+
+    // In a full update, tables that have a target staleness are skipped
+    // if they will still meet it at the next full update.
+    map<string, table_freshness> freshness;
+    if (!refresh && opt.table == "" && !opt.extract_only) {
+        dbtype dbt(&log_conn);
+        select_table_freshness(&log_conn, &lg, dbt, &freshness);
+    }
 
-                place_table(opt, &lg, table, &conn);
-                //updateStatus(opt, table, &conn);
+    vector<unique_ptr<table_update>> tus;
+    for (auto& table : schema.tables) {
 
-                //updateDBPermissions(opt, &lg, &conn);
+        // Skip this table if the --table option is specified and does not
+        // match this table.
+        if (!table_selected(opt, table.name))
+            continue;
 
-                tx.commit();
-            }
+        auto f = freshness.find(table.name);
+        if (f != freshness.end() && f->second.skip_full_update()) {
+            lg.write(log_level::trace, "", "",
+                     "Skipping table within target staleness: " +
+                     table.name, -1);
+            continue;
+        }
 
-            drop_latest_history_table(opt, &lg, table, &conn);
+        // Enable anonymization of the entire table.
+        bool anonymize_table = opt.anonymize && table.anonymize;
+        // Enable selective anonymization of fields.
+        bool anonymize_fields = opt.anonymize;
 
-            //vacuumAnalyzeTable(opt, table, &conn);
+        // Skip this table if the entire table should be anonymized.
+        if (anonymize_table)
+            continue;
 
-            string sql =
-                "SELECT COUNT(*) FROM\n"
-                "    " + table.name + ";";
-            lg.detail(sql);
-            string rowCount;
-            {
-                etymon::odbc_stmt stmt(&conn);
-                conn.exec_direct(&stmt, sql);
-                conn.fetch(&stmt);
-                conn.get_data(&stmt, 1, &rowCount);
-            }
-            sql =
-                "SELECT COUNT(*) FROM\n"
-                "    history." + table.name + ";";
-            lg.detail(sql);
-            string history_row_count;
-            {
-                etymon::odbc_stmt stmt(&conn);
-                conn.exec_direct(&stmt, sql);
-                conn.fetch(&stmt);
-                conn.get_data(&stmt, 1, &history_row_count);
-            }
-            sql =
-                "UPDATE dbsystem.tables\n"
-                "    SET updated = " + string(dbt.current_timestamp()) + ",\n"
-                "        row_count = " + rowCount + ",\n"
-                "        history_row_count = " + history_row_count + ",\n"
-                "        documentation = '" + table.source_spec + " in "
-                + table.module_name + "',\n"
-                "        documentation_url = 'https://dev.folio.org/reference/api/#"
-                + table.module_name + "'\n"
-                "    WHERE table_name = '" + table.name + "';";
-            lg.detail(sql);
-            conn.exec(sql);
+        // Skip this table if it was updated before the update was
+        // resumed, keeping its changes for maintenance.
+        auto r = run.tables.find(table.name);
+        if (r != run.tables.end() && r->second.merged) {
+            lg.write(log_level::trace, "", "",
+                     "Skipping table updated before resume: " + table.name,
+                     -1);
+            changes[table.name] = r->second.changes;
+            continue;
+        }
 
-            lg.write(log_level::debug, "update", table.name,
-                     "Updated table: " + table.name,
-                     update_timer.elapsed_time());
+        tus.push_back(unique_ptr<table_update>(
+                new table_update(opt, &table, anonymize_fields)));
+        if (r != run.tables.end()) {
+            // A stage is not resumed with the change index, whose
+            // entries for the table were not kept.
+            if (opt.change_index)
+                r->second.staged = false;
+            tus.back()->resume = &(r->second);
+        }
+    }
 
-            //if (opt.logLevel == log_level::trace)
-            //    loadTimer.print("load time");
+    // In replace mode, the foreign key constraints of the tables to be
+    // updated are dropped once before any table is replaced, since
+    // merges may run concurrently.  Tables that are upserted keep their
+    // constraints, and with atomic publish the constraints are dropped
+    // when the tables are published.
+    if (!atomic_publish && !opt.extract_only &&
+            opt.merge == merge_mode::replace && !tus.empty()) {
+        set<string> tables;
+        for (auto& tu : tus)
+            tables.insert(tu->table->name);
+        etymon::odbc_conn conn(&odbc, opt.db);
+        etymon::odbc_tx tx(&conn);
+        remove_foreign_key_constraints(&conn, &lg, tables);
+        tx.commit();
+    }
 
-        } catch (runtime_error& e) {
-            string s = table.name + ": " + e.what();
-            if ( !(s.empty()) && s.back() == '\n' )
-                s.pop_back();
-            etymon::odbc_env odbc;
-            etymon::odbc_conn log_conn(&odbc, opt.db);
-            ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog);
-            lg.write(log_level::error, "server", "", s, -1);
+    if (distributed) {
+        distribute_table_updates(ctx, schema, tus, &changes);
+    } else {
+        for (auto& tu : tus)
+            show_phase(opt, *tu, table_phase::queued);
+        schedule_table_updates(ctx, tus);
+
+        for (auto& tu : tus) {
+            if (!tu->merged)
+                continue;
+            const string& table = tu->table->name;
+            changes[table] = tu->changes;
+            if (collect_table_ids)
+                table_ids_map[table] = move(tu->tids);
+            if (atomic_publish) {
+                shadow_tables.push_back(table);
+                shadow_indexes[table] = move(tu->cidx);
+            }
         }
-        
-    } // for
+        perf.write(&log_conn, &lg);
+    }
 
     //{
     //    etymon::odbc_conn conn(&odbc, opt.db);
@@ -562,31 +1543,38 @@ void run_update(const ldp_options& opt)
     //    }
     //}
 
-    lg.write(log_level::debug, "server", "", "Completed full update",
+    if (atomic_publish)
+        publish_all_tables(opt, &lg, &odbc, shadow_tables, &shadow_indexes);
+
+    if (!opt.extract_only)
+        compact_history(opt, &lg, &odbc, &changes);
+
+    // The run is complete if every table was updated or had no data,
+    // and otherwise it is left to be resumed.
+    if (journaled) {
+        size_t incomplete = 0;
+        for (auto& tu : tus)
+            if (!tu->merged && !tu->table->skip)
+                incomplete++;
+        if (incomplete == 0) {
+            complete_update_run(&log_conn, &lg, run.run_id);
+            ext_dir.dir = ext_dir_path;
+        } else {
+            lg.write(log_level::warning, "server", "",
+                     "Full update did not complete:\n"
+                     "    Tables not updated: " + to_string(incomplete), -1);
+        }
+    }
+
+    lg.write(log_level::debug, "server", "", "Completed " + update_name,
             full_update_timer.elapsed_time());
 
-    // Vacuum and analyze all updated tables
+    // Vacuum and analyze tables that were changed
     {
-        etymon::odbc_conn conn(&odbc, opt.db);
         lg.write(log_level::debug, "server", "",
                  "Starting vacuum/analyze", -1);
         timer vacuum_analyze_timer(opt);
-        for (auto& table : schema.tables) {
-            if (table.skip || opt.extract_only)
-                continue;
-            string sql = "VACUUM " + table.name + ";";
-            lg.detail(sql);
-            conn.exec(sql);
-            sql = "ANALYZE " + table.name + ";";
-            lg.detail(sql);
-            conn.exec(sql);
-            sql = "VACUUM history." + table.name + ";";
-            lg.detail(sql);
-            conn.exec(sql);
-            sql = "ANALYZE history." + table.name + ";";
-            lg.detail(sql);
-            conn.exec(sql);
-        }
+        vacuum_analyze_tables(opt, &lg, &odbc, changes);
         lg.write(log_level::debug, "server", "", "Completed vacuum/analyze",
                  vacuum_analyze_timer.elapsed_time());
     }
@@ -603,10 +1591,16 @@ void run_update(const ldp_options& opt)
                &force_foreign_key_constraints, &enable_foreign_key_warnings);
 
         // Always clear suggested_foreign_keys, even if foreign key detection
-        // is disabled.
-        string sql = "DELETE FROM dbsystem.suggested_foreign_keys;";
-        lg.detail(sql);
-        conn.exec(sql);
+        // is disabled.  Foreign keys are detected only in a full update,
+        // and a refresh leaves the suggestions unchanged.
+        string sql;
+        if (refresh) {
+            detect_foreign_keys = false;
+        } else {
+            sql = "DELETE FROM dbsystem.suggested_foreign_keys;";
+            lg.detail(sql);
+            conn.exec(sql);
+        }
 
         if (detect_foreign_keys) {
 
@@ -614,13 +1608,20 @@ void run_update(const ldp_options& opt)
                     "Starting foreign key detection", -1);
 
             timer ref_timer(opt);
+            perf_scope ps(perf_fk);
 
-            etymon::odbc_tx tx(&conn);
+            // Tables that were not staged during this update, including
+            // their id-typed columns, are read from the database.
+            for (auto& table : schema.tables)
+                if (table_ids_map.find(table.name) == table_ids_map.end())
+                    select_table_ids(&conn, &lg, table.name,
+                                     &(table_ids_map[table.name]));
 
             map<string, vector<reference>> refs;
-            for (auto& table : schema.tables)
-                search_table_foreign_keys(&odbc, opt.db, &conn, &lg, schema,
-                        table, detect_foreign_keys, &refs);
+            suggest_foreign_keys(&table_ids_map, &refs);
+            table_ids_map.clear();
+
+            etymon::odbc_tx tx(&conn);
 
             for (pair<string, vector<reference>> p : refs) {
                 bool enable = (p.second.size() == 1);
@@ -656,9 +1657,8 @@ void run_update(const ldp_options& opt)
 
             timer ref_timer(opt);
 
-            process_foreign_keys(enable_foreign_key_warnings,
-                                 force_foreign_key_constraints,
-                                 &conn, &lg);
+            process_foreign_keys(opt, &odbc, enable_foreign_key_warnings,
+                                 force_foreign_key_constraints, &conn, &lg);
 
             lg.write(log_level::debug, "server", "",
                     "Completed foreign key constraint processing",
@@ -667,6 +1667,7 @@ void run_update(const ldp_options& opt)
 
     }
 
+    perf.write(&log_conn, &lg);
 }
 
 //void run_update(const ldp_options& opt)
@@ -676,24 +1677,122 @@ void run_update(const ldp_options& opt)
 //    }
 //}
 
-void run_update_process(const ldp_options& opt)
+// Runs queued table update jobs as a worker, until none remain.
+static void run_jobs(const ldp_options& opt)
+{
+    CURLcode cc;
+    etymon::curl_global curl_env(CURL_GLOBAL_ALL, &cc);
+    if (cc) {
+        throw runtime_error(string("Error initializing curl: ") +
+                            curl_easy_strerror(cc));
+    }
+
+    etymon::odbc_env odbc;
+
+    etymon::odbc_conn log_conn(&odbc, opt.db);
+    ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog,
+               opt.log_file);
+
+    string worker = job_worker_name();
+    lg.write(log_level::debug, "server", "", "Starting jobs: " + worker, -1);
+    timer jobs_timer(opt);
+
+    ldp_schema schema;
+    ldp_schema::make_default_schema(&schema);
+
+    int keyframe_interval = select_history_keyframe_interval(opt, &lg, &odbc);
+
+    extraction_files ext_dir(opt);
+    string load_dir;
+    vector<source_state> source_states;
+    prepare_sources(opt, &lg, "jobs", false, &ext_dir, &load_dir,
+                    &source_states);
+
+    perf_log perf;
+
+    update_context ctx(opt, &lg, &odbc, source_states);
+    ctx.load_dir = load_dir;
+    ctx.atomic_publish = false;
+    ctx.collect_table_ids = false;
+    ctx.keyframe_interval = keyframe_interval;
+    ctx.perf = &perf;
+
+    process_jobs(ctx, schema, worker);
+
+    lg.write(log_level::debug, "server", "", "Completed jobs: " + worker,
+             jobs_timer.elapsed_time());
+}
+
+// Writes a message to the log from an update process, e.g. after the
+// update has ended.
+static void log_process_message(const ldp_options& opt, log_level level,
+                                const string& message)
+{
+    etymon::odbc_env odbc;
+    etymon::odbc_conn log_conn(&odbc, opt.db);
+    ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog,
+               opt.log_file);
+    lg.write(level, "server", "", message, -1);
+}
+
+// Writes the trace of the process if tracing was started.  An error is
+// logged only as a warning, since it does not affect the update.
+static void write_trace(const ldp_options& opt)
+{
+    if (!etymon::trace_enabled())
+        return;
+    string s;
+    try {
+        etymon::trace_write(opt.trace_file);
+        return;
+    } catch (runtime_error& e) {
+        s = e.what();
+    }
+    if ( !(s.empty()) && s.back() == '\n' )
+        s.pop_back();
+    s = "Unable to write trace file:\n"
+        "    File: " + opt.trace_file + "\n"
+        "    Error: " + s;
+    try {
+        log_process_message(opt, log_level::warning, s);
+    } catch (runtime_error& e) {
+        fprintf(stderr, "%s: Warning: %s\n", opt.prog, s.c_str());
+    }
+}
+
+static void run_process(const ldp_options& opt,
+                        void (*run)(const ldp_options& opt))
 {
 #ifdef GPROF
     string update_dir = "./update-gprof";
     fs::create_directories(update_dir);
     chdir(update_dir.c_str());
 #endif
+    if (opt.trace_file != "")
+        etymon::trace_start();
     try {
-        run_update(opt);
-        exit(0);
+        etymon::trace_span span("update", "update");
+        run(opt);
     } catch (runtime_error& e) {
         string s = e.what();
         if ( !(s.empty()) && s.back() == '\n' )
             s.pop_back();
-        etymon::odbc_env odbc;
-        etymon::odbc_conn log_conn(&odbc, opt.db);
-        ldp_log lg(&log_conn, opt.lg_level, opt.console, opt.quiet, opt.prog);
-        lg.write(log_level::error, "server", "", s, -1);
+        log_process_message(opt, log_level::error, s);
+        // Keep the trace of a failed update, which is likely to be the
+        // one of interest.
+        write_trace(opt);
         exit(1);
     }
+    write_trace(opt);
+    exit(0);
+}
+
+void run_update_process(const ldp_options& opt)
+{
+    run_process(opt, run_update);
+}
+
+void run_jobs_process(const ldp_options& opt)
+{
+    run_process(opt, run_jobs);
 }
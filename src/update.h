@@ -4,5 +4,6 @@
 #include "options.h"
 
 void run_update_process(const ldp_options& opt);
+void run_jobs_process(const ldp_options& opt);
 
 #endif
@@ -0,0 +1,82 @@
+#include <cstring>
+#include <experimental/filesystem>
+
+#include "test.h"
+#include "../src/changeidx.h"
+
+namespace fs = std::experimental::filesystem;
+
+TEST_CASE( "Test parsing of ids and hashes", "[changeidx]" ) {
+    uint8_t b[16];
+    string s;
+    CHECK( parse_uuid("2b94c631-fca9-4892-a730-03ee529ffe2a", b) );
+    format_uuid(b, &s);
+    CHECK( s == "2b94c631-fca9-4892-a730-03ee529ffe2a" );
+    CHECK( !parse_uuid("2B94C631-FCA9-4892-A730-03EE529FFE2A", b) );
+    CHECK( !parse_uuid("2b94c631-fca9-4892-a730-03ee529ffe2", b) );
+    CHECK( !parse_uuid("2b94c631-fca9-4892-a730-03ee529ffe2a0", b) );
+    CHECK( !parse_uuid("2b94c631fca94892a73003ee529ffe2a", b) );
+    CHECK( !parse_uuid("", b) );
+    CHECK( parse_hash("6145f501578671e2877dba2be487af7e", b) );
+    uint8_t b2[16];
+    CHECK( parse_hash("6145f501-5786-71e2-877d-ba2be487af7e", b2) );
+    CHECK( memcmp(b, b2, 16) == 0 );
+    CHECK( !parse_hash("6145f501578671e2877dba2be487af7", b) );
+    CHECK( !parse_hash("6145f501578671e2877dba2be487af7e0", b) );
+}
+
+TEST_CASE( "Test change index", "[changeidx]" ) {
+    fs::path dir = fs::temp_directory_path() / "ldp_changeidx_test";
+    fs::remove_all(dir);
+
+    string id1 = "00000000-0000-0000-0000-000000000001";
+    string id2 = "00000000-0000-0000-0000-000000000002";
+    string id3 = "00000000-0000-0000-0000-000000000003";
+    string h1 = "6145f501578671e2877dba2be487af7e";
+    string h2 = "6c1b07bc7bbc4be347939ac4a93c437a";
+
+    {
+        change_index cidx(dir, "test_table", 1);
+        CHECK( !cidx.load(1) );
+        CHECK( !cidx.record(id2.c_str(), h1) );
+        CHECK( !cidx.record(id1.c_str(), h1) );
+        CHECK( !cidx.record(id3.c_str(), h1) );
+        CHECK( !cidx.record("not-a-uuid", h1) );
+        cidx.write(100);
+        cidx.commit();
+    }
+
+    {
+        change_index cidx(dir, "test_table", 1);
+        CHECK( !cidx.load(101) );
+        CHECK( !cidx.load(100 + 0x100000000LL) );
+        REQUIRE( cidx.load(100) );
+        CHECK( cidx.size() == 3 );
+        CHECK( cidx.record(id1.c_str(), h1) );
+        CHECK( !cidx.record(id2.c_str(), h2) );
+        vector<string> ids;
+        cidx.deleted_ids(&ids);
+        REQUIRE( ids.size() == 1 );
+        CHECK( ids[0] == id3 );
+        cidx.write(200);
+        // The current index remains valid until commit().
+        change_index other(dir, "test_table", 1);
+        CHECK( other.load(100) );
+        cidx.commit();
+    }
+
+    {
+        change_index cidx(dir, "test_table", 2);
+        CHECK( !cidx.load(200) );
+    }
+
+    {
+        change_index cidx(dir, "test_table", 1);
+        REQUIRE( cidx.load(200) );
+        CHECK( cidx.size() == 2 );
+        CHECK( cidx.record(id2.c_str(), h2) );
+        CHECK( !cidx.record(id3.c_str(), h1) );
+    }
+
+    fs::remove_all(dir);
+}
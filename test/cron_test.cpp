@@ -0,0 +1,71 @@
+#include <stdexcept>
+
+#include "test.h"
+#include "../src/cron.h"
+
+static time_t local_time(int year, int month, int day, int hour, int minute)
+{
+    struct tm t = {};
+    t.tm_year = year - 1900;
+    t.tm_mon = month - 1;
+    t.tm_mday = day;
+    t.tm_hour = hour;
+    t.tm_min = minute;
+    t.tm_isdst = -1;
+    return mktime(&t);
+}
+
+TEST_CASE( "Test cron expression parsing", "[cron]" ) {
+    CHECK_NOTHROW( cron_schedule("* * * * *") );
+    CHECK_NOTHROW( cron_schedule("*/15 6-18 1,15 * 1-5") );
+    CHECK_NOTHROW( cron_schedule("0 0 * * 7") );
+    CHECK_THROWS_AS( cron_schedule(""), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("* * * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("* * * * * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("60 * * * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("* 24 * * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("* * 0 * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("* * * 13 *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("* * * * 8"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("5-1 * * * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("*/0 * * * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("5/2 * * * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("1,,2 * * * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("1, * * * *"), runtime_error );
+    CHECK_THROWS_AS( cron_schedule("a * * * *"), runtime_error );
+}
+
+TEST_CASE( "Test cron next time", "[cron]" ) {
+    // 2021-03-10 is a Wednesday.
+    time_t t = local_time(2021, 3, 10, 12, 34);
+    CHECK( cron_schedule("* * * * *").next(t) ==
+           local_time(2021, 3, 10, 12, 35) );
+    CHECK( cron_schedule("*/15 * * * *").next(t) ==
+           local_time(2021, 3, 10, 12, 45) );
+    CHECK( cron_schedule("0 2 * * *").next(t) ==
+           local_time(2021, 3, 11, 2, 0) );
+    CHECK( cron_schedule("30 12 * * *").next(t) ==
+           local_time(2021, 3, 11, 12, 30) );
+    CHECK( cron_schedule("0 9 1 * *").next(t) ==
+           local_time(2021, 4, 1, 9, 0) );
+    CHECK( cron_schedule("0 0 * * 0").next(t) ==
+           local_time(2021, 3, 14, 0, 0) );
+    CHECK( cron_schedule("0 0 * * 7").next(t) ==
+           local_time(2021, 3, 14, 0, 0) );
+    CHECK( cron_schedule("0 0 29 2 *").next(t) ==
+           local_time(2024, 2, 29, 0, 0) );
+    // If both day fields are restricted, either may match.
+    CHECK( cron_schedule("0 0 20 * 5").next(t) ==
+           local_time(2021, 3, 12, 0, 0) );
+    CHECK( cron_schedule("0 0 31 2 *").next(t) == -1 );
+}
+
+TEST_CASE( "Test cron matching", "[cron]" ) {
+    time_t t = local_time(2021, 3, 10, 12, 30);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    CHECK( cron_schedule("30 12 * * 3").matches(tm) );
+    CHECK( cron_schedule("*/10 10-14 * 3 *").matches(tm) );
+    CHECK( !cron_schedule("30 12 * * 4").matches(tm) );
+    CHECK( !cron_schedule("31 12 * * *").matches(tm) );
+}
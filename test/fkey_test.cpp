@@ -0,0 +1,51 @@
+#include "test.h"
+#include "../src/fkey.h"
+
+TEST_CASE( "Test id set", "[fkey]" ) {
+    id_set ids;
+    ids.add("00000000-0000-0000-0000-000000000002");
+    ids.add("00000000-0000-0000-0000-000000000001");
+    ids.add("00000000-0000-0000-0000-000000000002");
+    ids.add("not-a-uuid");
+    ids.finish();
+    CHECK( ids.size() == 2 );
+    id_sample s;
+    s.add("00000000-0000-0000-0000-000000000001");
+    s.add("00000000-0000-0000-0000-000000000003");
+    REQUIRE( s.values().size() == 2 );
+    CHECK( ids.contains(s.values()[0]) );
+    CHECK( !ids.contains(s.values()[1]) );
+}
+
+TEST_CASE( "Test id sample", "[fkey]" ) {
+    id_sample s(10);
+    char id[37];
+    for (int x = 0; x < 1000; x++) {
+        snprintf(id, sizeof id, "00000000-0000-0000-0000-%012d", x);
+        s.add(id);
+    }
+    CHECK( s.values().size() == 10 );
+}
+
+TEST_CASE( "Test foreign key detection", "[fkey]" ) {
+    map<string, table_ids> tables;
+    tables["loans"].ids.add("00000000-0000-0000-0000-000000000001");
+    tables["loans"].samples["item_id"].add(
+        "00000000-0000-0000-0000-00000000000a");
+    tables["loans"].samples["item_id"].add(
+        "00000000-0000-0000-0000-00000000000b");
+    tables["loans"].samples["user_id"].add(
+        "00000000-0000-0000-0000-0000000000ff");
+    tables["items"].ids.add("00000000-0000-0000-0000-00000000000b");
+    tables["items"].ids.add("00000000-0000-0000-0000-00000000000c");
+    tables["users"].ids.add("00000000-0000-0000-0000-000000000010");
+    map<string, vector<reference>> refs;
+    suggest_foreign_keys(&tables, &refs);
+    REQUIRE( refs.size() == 1 );
+    REQUIRE( refs["loans.item_id"].size() == 1 );
+    const reference& ref = refs["loans.item_id"][0];
+    CHECK( ref.referencing_table == "loans" );
+    CHECK( ref.referencing_column == "item_id" );
+    CHECK( ref.referenced_table == "items" );
+    CHECK( ref.referenced_column == "id" );
+}
@@ -0,0 +1,37 @@
+#include "test.h"
+#include "../src/freshness.h"
+
+static table_freshness freshness(double staleness, double target,
+                                 double duration)
+{
+    table_freshness f;
+    f.staleness = staleness;
+    f.target = target;
+    f.duration = duration;
+    return f;
+}
+
+TEST_CASE( "Test refresh due", "[freshness]" ) {
+    CHECK( !freshness(3600, -1, 60).refresh_due() );
+    CHECK( freshness(-1, 900, -1).refresh_due() );
+    CHECK( !freshness(600, 900, 60).refresh_due() );
+    CHECK( freshness(840, 900, 60).refresh_due() );
+    CHECK( freshness(900, 900, -1).refresh_due() );
+    CHECK( freshness(1000, 900, 60).refresh_due() );
+}
+
+TEST_CASE( "Test skipping full update", "[freshness]" ) {
+    double week = 7 * 86400;
+    CHECK( !freshness(3600, -1, 60).skip_full_update() );
+    CHECK( !freshness(-1, week, 60).skip_full_update() );
+    CHECK( freshness(86400, week, 60).skip_full_update() );
+    CHECK( !freshness(6 * 86400, week, 60).skip_full_update() );
+    CHECK( !freshness(600, 900, 60).skip_full_update() );
+}
+
+TEST_CASE( "Test urgency", "[freshness]" ) {
+    CHECK( freshness(3600, -1, 60).urgency() == 0 );
+    CHECK( freshness(-1, 900, 60).urgency() == 1 );
+    CHECK( freshness(450, 900, 60).urgency() == Approx(0.5) );
+    CHECK( freshness(1800, 900, 60).urgency() == Approx(2) );
+}
@@ -0,0 +1,26 @@
+#include "test.h"
+#include "../src/hash.h"
+
+TEST_CASE( "Test 128-bit data hash", "[hash]" ) {
+    vector<pair<string, string>> tests = {
+        {"", "00000000000000000000000000000000"},
+        {"foo", "6145f501578671e2877dba2be487af7e"},
+        {"The quick brown fox jumps over the lazy dog",
+            "6c1b07bc7bbc4be347939ac4a93c437a"}
+    };
+    for (auto& t : tests) {
+        string h;
+        data_hash(t.first.data(), t.first.length(), &h);
+        CHECK( h == t.second );
+    }
+}
+
+TEST_CASE( "Test data hash sensitivity", "[hash]" ) {
+    string h1, h2;
+    string s1 = "{\"id\":\"1\",\"dueDate\":\"2020-02-17\"}";
+    string s2 = "{\"id\":\"1\",\"dueDate\":\"2020-02-18\"}";
+    data_hash(s1.data(), s1.length(), &h1);
+    data_hash(s2.data(), s2.length(), &h2);
+    CHECK( h1 != h2 );
+    CHECK( h1.length() == 32 );
+}
@@ -0,0 +1,70 @@
+#include <experimental/filesystem>
+#include <fstream>
+
+#include "test.h"
+#include "../src/log.h"
+
+namespace fs = std::experimental::filesystem;
+
+TEST_CASE( "Test log levels", "[log]" ) {
+    ldp_log lg(nullptr, log_level::debug, false, true, "ldp_test");
+    CHECK( lg.enabled(log_level::fatal) );
+    CHECK( lg.enabled(log_level::error) );
+    CHECK( lg.enabled(log_level::warning) );
+    CHECK( lg.enabled(log_level::info) );
+    CHECK( lg.enabled(log_level::debug) );
+    CHECK( !lg.enabled(log_level::trace) );
+    CHECK( !lg.enabled(log_level::detail) );
+    ldp_log lg2(nullptr, log_level::info, false, true, "ldp_test");
+    CHECK( lg2.enabled(log_level::warning) );
+    CHECK( lg2.enabled(log_level::info) );
+    CHECK( !lg2.enabled(log_level::debug) );
+}
+
+TEST_CASE( "Test log file", "[log]" ) {
+    fs::path path = fs::temp_directory_path() / "ldp_log_test.json";
+    fs::remove(path);
+    {
+        ldp_log lg(nullptr, log_level::debug, false, true, "ldp_test",
+                   path.string());
+        lg.write(log_level::warning, "update", "circulation_loans",
+                 "Value \"x\"\nset to NULL", -1);
+        lg.write(log_level::trace, "", "", "Not logged", -1);
+        lg.flush();
+        lg.write(log_level::debug, "server", "", "Completed", 1.5);
+    }
+    ifstream f(path.string());
+    string line1, line2, line3;
+    REQUIRE( getline(f, line1) );
+    REQUIRE( getline(f, line2) );
+    CHECK( !getline(f, line3) );
+    CHECK( line1.find("\"level\":\"warning\",\"type\":\"update\","
+                      "\"table_name\":\"circulation_loans\","
+                      "\"message\":\"Warning: Value \\\"x\\\"\\nset to "
+                      "NULL\",\"elapsed_time\":null}") != string::npos );
+    CHECK( line2.find("\"message\":\"Completed\",\"elapsed_time\":1.5000}") !=
+           string::npos );
+    fs::remove(path);
+}
+
+// Compares a detail message that is built before the log level is
+// checked with one that is built only if detail logging is enabled, at
+// the default debug level.  This is the pattern used for each record
+// parsed during staging.  Run with: ldp_test "[benchmark]"
+TEST_CASE( "Benchmark disabled log messages", "[.][benchmark][log]" ) {
+    ldp_log lg(nullptr, log_level::debug, false, true, "ldp_test");
+    string table = "circulation_loans";
+    string record =
+        "{\"id\":\"2b94c631-fca9-4892-a730-03ee529ffe2a\","
+        "\"userId\":\"a23eac4b-955e-451c-b4ff-6ec2f5e63e23\","
+        "\"itemId\":\"c0e9f5c4-bb6a-4f1a-9e2f-4b6bd4c1c77e\","
+        "\"action\":\"checkedout\",\"loanDate\":\"2021-03-10T12:34:56Z\"}";
+    BENCHMARK( "Detail message built unconditionally" ) {
+        lg.detail("New record parsed for table: " + table + ":\n" + record);
+    };
+    BENCHMARK( "Detail message built if enabled" ) {
+        if (lg.enabled(log_level::detail))
+            lg.detail("New record parsed for table: " + table + ":\n" +
+                      record);
+    };
+}
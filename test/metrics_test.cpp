@@ -0,0 +1,96 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../src/metrics.h"
+
+static bool contains(const string& text, const string& line)
+{
+    return text.find(line + "\n") != string::npos;
+}
+
+TEST_CASE( "Test metrics format", "[metrics]" ) {
+    shared_metrics sm({"circulation_loans", "inventory_items"});
+    update_metrics* m = sm.get();
+    m->record_http_request(0.02);
+    m->record_http_request(0.3);
+    m->record_http_request(120);
+    m->record_staged(1000, 65536);
+    m->set_phase("circulation_loans", table_phase::stage);
+    m->set_phase("inventory_items", table_phase::extracted);
+    m->set_phase("unknown_table", table_phase::merge);
+    string text;
+    m->format(&text);
+    CHECK( contains(text, "# TYPE ldp_pages_fetched_total counter") );
+    CHECK( contains(text, "ldp_pages_fetched_total 3") );
+    CHECK( contains(text,
+                    "ldp_http_request_duration_seconds_bucket{le=\"0.05\"} 1") );
+    CHECK( contains(text,
+                    "ldp_http_request_duration_seconds_bucket{le=\"0.25\"} 1") );
+    CHECK( contains(text,
+                    "ldp_http_request_duration_seconds_bucket{le=\"0.5\"} 2") );
+    CHECK( contains(text,
+                    "ldp_http_request_duration_seconds_bucket{le=\"60\"} 2") );
+    CHECK( contains(text,
+                    "ldp_http_request_duration_seconds_bucket{le=\"+Inf\"} 3") );
+    CHECK( contains(text, "ldp_http_request_duration_seconds_sum 120.32") );
+    CHECK( contains(text, "ldp_http_request_duration_seconds_count 3") );
+    CHECK( contains(text, "ldp_records_staged_total 1000") );
+    CHECK( contains(text, "ldp_bytes_loaded_total 65536") );
+    CHECK( contains(text,
+                    "ldp_table_phase{table=\"circulation_loans\","
+                    "phase=\"stage\"} 1") );
+    CHECK( contains(text, "ldp_queue_depth{queue=\"stage\"} 1") );
+    CHECK( contains(text, "ldp_queue_depth{queue=\"merge\"} 0") );
+    CHECK( text.find("ldp_last_update_duration_seconds") == string::npos );
+    CHECK( text.find("ldp_table_last_update_duration_seconds{") ==
+           string::npos );
+}
+
+TEST_CASE( "Test metrics of updated tables", "[metrics]" ) {
+    shared_metrics sm({"circulation_loans", "inventory_items"});
+    update_metrics* m = sm.get();
+    m->begin_update();
+    m->set_phase("inventory_items", table_phase::merge);
+    m->record_table("circulation_loans", 1.5, -1, 0.25);
+    string text;
+    m->format(&text);
+    CHECK( contains(text, "ldp_update_running 1") );
+    CHECK( contains(text, "ldp_tables_updated_total 1") );
+    CHECK( contains(text,
+                    "ldp_table_last_update_duration_seconds"
+                    "{table=\"circulation_loans\",phase=\"extract\"} 1.5") );
+    CHECK( contains(text,
+                    "ldp_table_last_update_duration_seconds"
+                    "{table=\"circulation_loans\",phase=\"merge\"} 0.25") );
+    CHECK( text.find("circulation_loans\",phase=\"stage\"") ==
+           string::npos );
+    m->end_update(30, false);
+    m->format(&text);
+    CHECK( contains(text, "ldp_update_running 0") );
+    CHECK( contains(text, "ldp_updates_total 1") );
+    CHECK( contains(text, "ldp_update_failures_total 1") );
+    CHECK( contains(text, "ldp_last_update_duration_seconds 30") );
+    CHECK( text.find("ldp_table_phase{") == string::npos );
+}
+
+TEST_CASE( "Test metrics shared with a child process", "[metrics]" ) {
+    shared_metrics sm({"circulation_loans"});
+    update_metrics* m = sm.get();
+    pid_t pid = fork();
+    REQUIRE( pid >= 0 );
+    if (pid == 0) {
+        m->record_staged(42, 4200);
+        m->set_phase("circulation_loans", table_phase::merge);
+        _exit(0);
+    }
+    int stat;
+    waitpid(pid, &stat, 0);
+    string text;
+    m->format(&text);
+    CHECK( contains(text, "ldp_records_staged_total 42") );
+    CHECK( contains(text, "ldp_bytes_loaded_total 4200") );
+    CHECK( contains(text,
+                    "ldp_table_phase{table=\"circulation_loans\","
+                    "phase=\"merge\"} 1") );
+}
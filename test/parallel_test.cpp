@@ -0,0 +1,26 @@
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "test.h"
+#include "../src/parallel.h"
+
+TEST_CASE( "Test parallel for", "[parallel]" ) {
+    for (size_t threads : {1, 2, 8}) {
+        vector<int> calls(100, 0);
+        parallel_for(calls.size(), threads, [&](size_t x) { calls[x]++; });
+        for (auto c : calls)
+            CHECK( c == 1 );
+    }
+    parallel_for(0, 4, [&](size_t x) { FAIL(); });
+}
+
+TEST_CASE( "Test parallel for with exception", "[parallel]" ) {
+    atomic<int> count(0);
+    CHECK_THROWS_AS( parallel_for(100, 4, [&](size_t x) {
+        count++;
+        if (x == 10)
+            throw runtime_error("error");
+    }), runtime_error );
+    CHECK( count > 10 );
+}
@@ -0,0 +1,117 @@
+#include <thread>
+
+#include "test.h"
+#include "../src/perf.h"
+
+static void busy_wait(double seconds)
+{
+    auto end = chrono::steady_clock::now() +
+        chrono::duration<double>(seconds);
+    while (chrono::steady_clock::now() < end)
+        ;
+}
+
+static const perf_record* find_record(const vector<perf_record>& rs,
+                                      const string& table,
+                                      const string& phase)
+{
+    for (auto& r : rs)
+        if (r.table == table && r.phase == phase)
+            return &r;
+    return nullptr;
+}
+
+TEST_CASE( "Test scopes without a context", "[perf]" ) {
+    perf_log perf;
+    {
+        perf_scope ps(perf_extract);
+        ps.count(10, 100, 100);
+    }
+    {
+        perf_context pc(nullptr, 1, "t");
+        perf_scope ps(perf_extract);
+    }
+    vector<perf_record> rs;
+    perf.take(&rs);
+    CHECK( rs.empty() );
+    CHECK( perf_scope::current() == nullptr );
+    CHECK( perf_context::current() == nullptr );
+}
+
+TEST_CASE( "Test nested scopes", "[perf]" ) {
+    perf_log perf;
+    {
+        perf_context pc(&perf, 7, "t");
+        perf_scope ps(perf_pass2);
+        perf_count(5, 500, 0);
+        busy_wait(0.02);
+        {
+            perf_scope inner(perf_index);
+            busy_wait(0.05);
+        }
+        perf_count(3, 300, 0);
+    }
+    vector<perf_record> rs;
+    perf.take(&rs);
+    REQUIRE( rs.size() == 2 );
+    const perf_record* pass2 = find_record(rs, "t", perf_pass2);
+    const perf_record* index = find_record(rs, "t", perf_index);
+    REQUIRE( pass2 != nullptr );
+    REQUIRE( index != nullptr );
+    CHECK( pass2->run_id == 7 );
+    CHECK( pass2->counters.records == 8 );
+    CHECK( pass2->counters.bytes_in == 800 );
+    CHECK( index->counters.records == 0 );
+    CHECK( index->counters.wall_time >= 0.05 );
+    CHECK( pass2->counters.wall_time >= 0.02 );
+    // The nested scope is not counted in the enclosing one.
+    CHECK( pass2->counters.wall_time < 0.05 );
+    CHECK( index->counters.cpu_time > 0 );
+    CHECK( pass2->started <= index->started );
+}
+
+TEST_CASE( "Test combining records", "[perf]" ) {
+    perf_log perf;
+    for (int x = 0; x < 3; x++) {
+        perf_context pc(&perf, 1, "t");
+        perf_scope ps(perf_vacuum);
+        ps.count(1, 0, 0);
+    }
+    {
+        perf_context pc(&perf, 2, "t");
+        perf_scope ps(perf_vacuum);
+    }
+    vector<perf_record> rs;
+    perf.take(&rs);
+    REQUIRE( rs.size() == 2 );
+    CHECK( rs[0].run_id == 1 );
+    CHECK( rs[0].counters.records == 3 );
+    CHECK( rs[1].run_id == 2 );
+    perf.take(&rs);
+    CHECK( rs.empty() );
+}
+
+TEST_CASE( "Test work shared with other threads", "[perf]" ) {
+    perf_log perf;
+    {
+        perf_context pc(&perf, 1, "");
+        perf_context* run_perf = perf_context::current();
+        perf_scope ps(perf_merge);
+        perf_scope* scope = perf_scope::current();
+        thread t([&]() {
+            perf_share share(scope);
+            perf_context tpc(run_perf, "t");
+            CHECK( perf_context::current()->run_id == 1 );
+            busy_wait(0.05);
+        });
+        t.join();
+    }
+    vector<perf_record> rs;
+    perf.take(&rs);
+    REQUIRE( rs.size() == 1 );
+    CHECK( rs[0].table == "" );
+    // The CPU time of the other thread is added, but its wall time
+    // overlaps with that of the scope.
+    CHECK( rs[0].counters.cpu_time >= 0.04 );
+    CHECK( rs[0].counters.wall_time >= 0.05 );
+}
@@ -0,0 +1,91 @@
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "test.h"
+#include "../src/scheduler.h"
+
+TEST_CASE( "Test scheduler priority", "[scheduler]" ) {
+    task_scheduler s;
+    size_t r = s.add_resource(1);
+    vector<int> order;
+    s.add_task(r, 1.0, [&]() { order.push_back(1); });
+    s.add_task(r, 3.0, [&]() { order.push_back(3); });
+    s.add_task(r, 2.0, [&]() { order.push_back(2); });
+    s.add_task(r, 3.0, [&]() { order.push_back(4); });
+    task_pool pool(1);
+    s.run(&pool);
+    REQUIRE( order.size() == 4 );
+    CHECK( order[0] == 3 );
+    CHECK( order[1] == 4 );
+    CHECK( order[2] == 2 );
+    CHECK( order[3] == 1 );
+}
+
+TEST_CASE( "Test scheduler dependencies and limits", "[scheduler]" ) {
+    task_scheduler s;
+    size_t a = s.add_resource(2);
+    size_t b = s.add_resource(1);
+    mutex m;
+    vector<bool> done(30, false);
+    atomic<int> running_a(0), running_b(0);
+    atomic<int> max_a(0), max_b(0);
+    bool ordered = true;
+    auto f = [&](size_t x, atomic<int>* running, atomic<int>* max_running) {
+        return [&, x, running, max_running]() {
+            int n = ++(*running);
+            int m0 = *max_running;
+            while (n > m0 && !max_running->compare_exchange_weak(m0, n))
+                ;
+            {
+                lock_guard<mutex> lock(m);
+                if (x % 3 > 0 && !done[x - 1])
+                    ordered = false;
+            }
+            (*running)--;
+            lock_guard<mutex> lock(m);
+            done[x] = true;
+        };
+    };
+    for (size_t t = 0; t < 10; t++) {
+        size_t x = t * 3;
+        size_t t0 = s.add_task(a, t, f(x, &running_a, &max_a));
+        size_t t1 = s.add_task(b, t, f(x + 1, &running_b, &max_b));
+        size_t t2 = s.add_task(a, t, f(x + 2, &running_a, &max_a));
+        s.add_dependency(t1, t0);
+        s.add_dependency(t2, t1);
+    }
+    task_pool pool(3);
+    s.run(&pool);
+    for (bool d : done)
+        CHECK( d );
+    CHECK( ordered );
+    CHECK( max_a <= 2 );
+    CHECK( max_b <= 1 );
+}
+
+TEST_CASE( "Test scheduler with exception", "[scheduler]" ) {
+    task_scheduler s;
+    size_t r = s.add_resource(1);
+    int count = 0;
+    size_t t0 = s.add_task(r, 0, [&]() { count++; });
+    size_t t1 = s.add_task(r, 0, [&]() { throw runtime_error("error"); });
+    size_t t2 = s.add_task(r, 0, [&]() { count++; });
+    s.add_dependency(t1, t0);
+    s.add_dependency(t2, t1);
+    task_pool pool(1);
+    CHECK_THROWS_AS( s.run(&pool), runtime_error );
+    CHECK( count == 1 );
+}
+
+TEST_CASE( "Test scheduler with cycle", "[scheduler]" ) {
+    task_scheduler s;
+    size_t r = s.add_resource(1);
+    size_t t0 = s.add_task(r, 0, [&]() {});
+    size_t t1 = s.add_task(r, 0, [&]() {});
+    s.add_dependency(t0, t1);
+    s.add_dependency(t1, t0);
+    task_pool pool(1);
+    CHECK_THROWS_AS( s.run(&pool), runtime_error );
+}
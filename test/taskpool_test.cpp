@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+#include "../src/parallel.h"
+#include "../src/taskpool.h"
+
+static long fib(task_pool* pool, int n)
+{
+    if (n < 2)
+        return n;
+    long a, b;
+    task_group g(pool);
+    g.run([&]() { a = fib(pool, n - 1); });
+    b = fib(pool, n - 2);
+    g.wait();
+    return a + b;
+}
+
+TEST_CASE( "Test task pool", "[taskpool]" ) {
+    for (size_t workers : {1, 2, 8}) {
+        task_pool pool(workers, 16);
+        CHECK( pool.size() == workers );
+        CHECK( pool.worker_index() == -1 );
+        // Many more tasks than the shared queue holds.
+        vector<atomic<int>> calls(10000);
+        task_group g(&pool);
+        for (size_t x = 0; x < calls.size(); x++)
+            g.run([&, x]() { calls[x]++; });
+        g.wait();
+        for (auto& c : calls)
+            CHECK( c == 1 );
+        // Nested groups that wait within workers.
+        CHECK( fib(&pool, 20) == 6765 );
+    }
+}
+
+TEST_CASE( "Test task pool stress", "[taskpool]" ) {
+    task_pool pool(8, 4);
+    atomic<long> sum(0);
+    task_group g(&pool);
+    for (int x = 0; x < 200; x++) {
+        g.run([&, x]() {
+            task_group h(&pool);
+            for (int y = 0; y < 100; y++)
+                h.run([&, x, y]() { sum += x * 100 + y; });
+            h.wait();
+        });
+    }
+    g.wait();
+    CHECK( sum == 20000L * 19999 / 2 );
+}
+
+TEST_CASE( "Test task group exception and cancellation", "[taskpool]" ) {
+    task_pool pool(4);
+    atomic<int> count(0);
+    {
+        task_group g(&pool);
+        for (int x = 0; x < 1000; x++) {
+            g.run([&, x]() {
+                if (x == 10)
+                    throw runtime_error("error");
+                this_thread::sleep_for(chrono::microseconds(100));
+                count++;
+            });
+        }
+        CHECK_THROWS_AS( g.wait(), runtime_error );
+        CHECK( g.cancelled() );
+    }
+    CHECK( count < 999 );
+    count = 0;
+    {
+        task_group g(&pool);
+        g.cancel();
+        for (int x = 0; x < 100; x++)
+            g.run([&]() { count++; });
+        g.wait();
+    }
+    CHECK( count == 0 );
+}
+
+TEST_CASE( "Test worker local", "[taskpool]" ) {
+    task_pool pool(4);
+    atomic<int> made(0);
+    worker_local<int> local(pool, [&]() {
+        return unique_ptr<int>(new int(made++));
+    });
+    mutex m;
+    set<int*> seen;
+    atomic<bool> stable(true);
+    task_group g(&pool);
+    for (int x = 0; x < 1000; x++) {
+        g.run([&]() {
+            int* p = local.get();
+            if (p != local.get())
+                stable = false;
+            lock_guard<mutex> lock(m);
+            seen.insert(p);
+        });
+    }
+    g.wait();
+    CHECK( stable );
+    CHECK( seen.size() <= 4 );
+    CHECK( made == (int) seen.size() );
+    local.get();
+    CHECK( made == (int) seen.size() + 1 );
+}
+
+// Measures the overhead of running small tasks in the pool, directly
+// and through parallel_for() in the shared pool.  Run with:
+// ldp_test "[benchmark]"
+TEST_CASE( "Benchmark task pool", "[.][benchmark]" ) {
+    const int tasks = 64;
+    size_t workers = max(4u, thread::hardware_concurrency());
+    atomic<long> sum(0);
+    task_pool pool(workers);
+    BENCHMARK( "parallel_for, 64 tasks" ) {
+        parallel_for(tasks, workers, [&](size_t x) { sum += x; });
+    };
+    BENCHMARK( "task_group, 64 tasks" ) {
+        task_group g(&pool);
+        for (int x = 0; x < tasks; x++)
+            g.run([&, x]() { sum += x; });
+        g.wait();
+    };
+    BENCHMARK( "task_group, fib(20) with nested groups" ) {
+        return fib(&pool, 20);
+    };
+}
@@ -1,6 +1,7 @@
 #ifndef LDP_TEST_TEST_H
 #define LDP_TEST_TEST_H
 
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 
 using namespace std;
@@ -0,0 +1,97 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "test.h"
+#include "../etymoncpp/include/trace.h"
+
+static string read_trace(const string& filename)
+{
+    ifstream f(filename);
+    stringstream s;
+    s << f.rdbuf();
+    return s.str();
+}
+
+static size_t count(const string& text, const string& s)
+{
+    size_t n = 0;
+    for (size_t pos = text.find(s); pos != string::npos;
+         pos = text.find(s, pos + 1))
+        n++;
+    return n;
+}
+
+static string trace_filename()
+{
+    return "/tmp/ldp_trace_test_" + to_string(getpid()) + ".json";
+}
+
+TEST_CASE( "Test spans when tracing is disabled", "[trace]" ) {
+    string filename = trace_filename();
+    etymon::trace_start();
+    etymon::trace_write(filename);
+    {
+        etymon::trace_span span("phase", "extract", "table", "t");
+        etymon::trace_counter("pages_fetched", 1);
+    }
+    CHECK( !etymon::trace_enabled() );
+    etymon::trace_write(filename);
+    string text = read_trace(filename);
+    remove(filename.c_str());
+    CHECK( text == "{\"traceEvents\":[\n\n],\"displayTimeUnit\":\"ms\"}\n" );
+}
+
+TEST_CASE( "Test spans and counters", "[trace]" ) {
+    string filename = trace_filename();
+    etymon::trace_start();
+    {
+        etymon::trace_span span("phase", "stage", "table",
+                                "circulation_loans");
+        etymon::trace_span inner("db", "exec", "sql",
+                                 "SELECT \"id\"\nFROM t;" + string(200, 'x'));
+        etymon::trace_counter("records_staged", 42);
+    }
+    etymon::trace_write(filename);
+    string text = read_trace(filename);
+    remove(filename.c_str());
+    CHECK( text.find("{\"name\":\"stage\",\"cat\":\"phase\",\"ph\":\"X\"") !=
+           string::npos );
+    CHECK( text.find("\"args\":{\"table\":\"circulation_loans\"}") !=
+           string::npos );
+    CHECK( text.find("\"args\":{\"sql\":\"SELECT \\\"id\\\"\\nFROM t;xxx") !=
+           string::npos );
+    // The SQL statement is truncated.
+    CHECK( text.find(string(200, 'x')) == string::npos );
+    CHECK( text.find("{\"name\":\"records_staged\",\"ph\":\"C\"") !=
+           string::npos );
+    CHECK( text.find("\"args\":{\"value\":42}") != string::npos );
+    CHECK( count(text, "\"ph\":\"X\"") == 2 );
+}
+
+TEST_CASE( "Test spans recorded by many threads", "[trace]" ) {
+    string filename = trace_filename();
+    etymon::trace_start();
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back([]() {
+            // Enough events to fill more than one chunk.
+            for (int x = 0; x < 3000; x++)
+                etymon::trace_span span("pool", "task");
+        });
+    for (auto& t : threads)
+        t.join();
+    etymon::trace_write(filename);
+    string text = read_trace(filename);
+    remove(filename.c_str());
+    CHECK( count(text, "\"name\":\"task\"") == 12000 );
+    // Events of a previous trace are discarded.
+    etymon::trace_start();
+    etymon::trace_span span("pool", "task");
+    etymon::trace_write(filename);
+    text = read_trace(filename);
+    remove(filename.c_str());
+    CHECK( count(text, "\"name\":\"task\"") == 0 );
+}
@@ -0,0 +1,52 @@
+#include "../etymoncpp/include/odbc.h"
+#include "../src/config.h"
+#include "../src/fkey.h"
+#include "../src/ldp.h"
+#include "../src/options.h"
+#include "../test/test.h"
+
+// A table that was not staged is read from the database, including
+// samples of its id-typed columns, so that its foreign keys are still
+// suggested.
+TEST_CASE( "Test foreign key detection from unstaged tables", "[fkey]" ) {
+    ldp_options opt;
+    ldp_config conf(datadir + "/ldpconf.json");
+    config_options(conf, &opt);
+    etymon::odbc_env odbc;
+    etymon::odbc_conn conn(&odbc, opt.db);
+    ldp_log lg(nullptr, log_level::warning, false, true, "ldp_testint");
+    conn.exec("DROP TABLE IF EXISTS testint_fkey_loans;");
+    conn.exec("DROP TABLE IF EXISTS testint_fkey_items;");
+    conn.exec("CREATE TABLE testint_fkey_loans (\n"
+              "    id VARCHAR(36) NOT NULL,\n"
+              "    item_id VARCHAR(36),\n"
+              "    note VARCHAR(65535)\n"
+              ");");
+    conn.exec("CREATE TABLE testint_fkey_items (\n"
+              "    id VARCHAR(36) NOT NULL\n"
+              ");");
+    conn.exec("INSERT INTO testint_fkey_loans VALUES\n"
+              "    ('00000000-0000-0000-0000-000000000001',\n"
+              "     '00000000-0000-0000-0000-00000000000b',\n"
+              "     '00000000-0000-0000-0000-00000000000c'),\n"
+              "    ('00000000-0000-0000-0000-000000000002', NULL, NULL);");
+    conn.exec("INSERT INTO testint_fkey_items VALUES\n"
+              "    ('00000000-0000-0000-0000-00000000000b'),\n"
+              "    ('00000000-0000-0000-0000-00000000000c');");
+    map<string, table_ids> tables;
+    select_table_ids(&conn, &lg, "testint_fkey_loans",
+                     &(tables["testint_fkey_loans"]));
+    select_table_ids(&conn, &lg, "testint_fkey_items",
+                     &(tables["testint_fkey_items"]));
+    conn.exec("DROP TABLE testint_fkey_loans;");
+    conn.exec("DROP TABLE testint_fkey_items;");
+    CHECK( tables["testint_fkey_loans"].ids.size() == 2 );
+    CHECK( tables["testint_fkey_loans"].samples.count("note") == 0 );
+    map<string, vector<reference>> refs;
+    suggest_foreign_keys(&tables, &refs);
+    REQUIRE( refs.size() == 1 );
+    REQUIRE( refs["testint_fkey_loans.item_id"].size() == 1 );
+    const reference& ref = refs["testint_fkey_loans.item_id"][0];
+    CHECK( ref.referenced_table == "testint_fkey_items" );
+    CHECK( ref.referenced_column == "id" );
+}
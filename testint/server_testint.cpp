@@ -1,5 +1,6 @@
 #include <experimental/filesystem>
 
+#include "../etymoncpp/include/odbc.h"
 #include "../etymoncpp/include/util.h"
 #include "../src/ldp.h"
 #include "../test/test.h"
@@ -99,3 +100,134 @@ TEST_CASE( "Test inconsistent JSON data types", "[update]" ) {
     fs::remove_all(update_dir);
 }
 
+
+static void write_user_groups(const fs::path& update_dir, const string& json)
+{
+    fs::remove_all(update_dir);
+    fs::create_directories(update_dir);
+    {
+        etymon::file f(update_dir / "user_groups_0.json", "w");
+        fputs(json.data(), f.fp);
+    }
+    {
+        etymon::file f(update_dir / "user_groups_count.txt", "w");
+        fputs("1\n", f.fp);
+    }
+}
+
+static string user_group_json(const string& id, const string& group)
+{
+    return "    {\n"
+        "      \"group\" : \"" + group + "\",\n"
+        "      \"desc\" : \"" + group + "\",\n"
+        "      \"id\" : \"" + id + "\"\n"
+        "    }";
+}
+
+static string select_value(etymon::odbc_conn* conn, const string& sql)
+{
+    etymon::odbc_stmt stmt(conn);
+    conn->exec_direct(&stmt, sql);
+    string value;
+    if (conn->fetch(&stmt))
+        conn->get_data(&stmt, 1, &value);
+    return value;
+}
+
+// The deleted records table is written when the table is staged and read
+// when it is merged, on another connection.
+TEST_CASE( "Test upsert with change index", "[update]" ) {
+    fs::path update_dir = fs::path(datadir) / "tmp" / "update";
+    string a = "3684a786-6671-4268-8ed0-9db82ebca60b";
+    string b = "503a81cd-6c26-400f-b620-14c08943697c";
+    string c = "ad0bc554-d5bc-463c-85d1-5562127ae91b";
+    ldp_options opt;
+    opt.cli_mode = true;
+    opt.quiet = true;
+    opt.command = ldp_command::update;
+    opt.datadir = datadir.data();
+    opt.table = "user_groups";
+    opt.load_from_dir = update_dir;
+    opt.merge = merge_mode::upsert;
+    opt.change_index = true;
+    write_user_groups(update_dir,
+                      "{\n  \"usergroups\" : [\n" +
+                      user_group_json(a, "staff") + ",\n" +
+                      user_group_json(b, "faculty") + ",\n" +
+                      user_group_json(c, "graduate") + "\n"
+                      "  ],\n  \"totalRecords\" : 3\n}\n");
+    CHECK_NOTHROW( ldp_exec(&opt) );
+    // Record c is deleted, b is changed, and a is unchanged.
+    write_user_groups(update_dir,
+                      "{\n  \"usergroups\" : [\n" +
+                      user_group_json(a, "staff") + ",\n" +
+                      user_group_json(b, "librarian") + "\n"
+                      "  ],\n  \"totalRecords\" : 2\n}\n");
+    CHECK_NOTHROW( ldp_exec(&opt) );
+    fs::remove_all(update_dir);
+
+    etymon::odbc_env odbc;
+    etymon::odbc_conn conn(&odbc, opt.db);
+    CHECK( select_value(&conn, "SELECT count(*) FROM user_groups;") == "2" );
+    CHECK( select_value(&conn,
+                        "SELECT \"group\" FROM user_groups\n"
+                        "    WHERE id = '" + b + "';") == "librarian" );
+    CHECK( select_value(&conn,
+                        "SELECT count(*) FROM information_schema.tables\n"
+                        "    WHERE table_name = 'ldp_deleted_user_groups';")
+           == "0" );
+}
+
+// Upserting a table leaves foreign key constraints that reference it in
+// place.
+TEST_CASE( "Test upsert keeps foreign key constraints", "[update]" ) {
+    fs::path update_dir = fs::path(datadir) / "tmp" / "update";
+    string a = "3684a786-6671-4268-8ed0-9db82ebca60b";
+    string json = "{\n  \"usergroups\" : [\n" +
+        user_group_json(a, "staff") + "\n"
+        "  ],\n  \"totalRecords\" : 1\n}\n";
+    ldp_options opt;
+    opt.cli_mode = true;
+    opt.quiet = true;
+    opt.command = ldp_command::update;
+    opt.datadir = datadir.data();
+    opt.table = "user_groups";
+    opt.load_from_dir = update_dir;
+    opt.merge = merge_mode::upsert;
+    write_user_groups(update_dir, json);
+    CHECK_NOTHROW( ldp_exec(&opt) );
+
+    etymon::odbc_env odbc;
+    etymon::odbc_conn conn(&odbc, opt.db);
+    conn.exec("DROP TABLE IF EXISTS testint_user_group_refs;");
+    conn.exec("CREATE TABLE testint_user_group_refs (\n"
+              "    id VARCHAR(36) NOT NULL,\n"
+              "    group_id VARCHAR(36)\n"
+              ");");
+    conn.exec("INSERT INTO testint_user_group_refs VALUES\n"
+              "    ('00000000-0000-0000-0000-000000000001', '" + a + "');");
+    conn.exec("ALTER TABLE testint_user_group_refs\n"
+              "    ADD CONSTRAINT testint_user_group_refs_group_id_fkey\n"
+              "    FOREIGN KEY (group_id) REFERENCES user_groups (id);");
+    conn.exec("INSERT INTO dbsystem.foreign_key_constraints\n"
+              "    (referencing_table, referencing_column,\n"
+              "     referenced_table, referenced_column, constraint_name)\n"
+              "    VALUES\n"
+              "    ('testint_user_group_refs', 'group_id',\n"
+              "     'user_groups', 'id',\n"
+              "     'testint_user_group_refs_group_id_fkey');");
+
+    write_user_groups(update_dir, json);
+    CHECK_NOTHROW( ldp_exec(&opt) );
+    fs::remove_all(update_dir);
+
+    string constraints = select_value(&conn,
+            "SELECT count(*) FROM information_schema.table_constraints\n"
+            "    WHERE constraint_name =\n"
+            "          'testint_user_group_refs_group_id_fkey';");
+    conn.exec("DROP TABLE testint_user_group_refs;");
+    conn.exec("DELETE FROM dbsystem.foreign_key_constraints\n"
+              "    WHERE constraint_name =\n"
+              "          'testint_user_group_refs_group_id_fkey';");
+    CHECK( constraints == "1" );
+}